@@ -0,0 +1,14 @@
+LOCAL_PATH := $(call my-dir)
+SUPPORTED_TARGET_ABI := arm64-v8a
+
+PACKAGE_C_INCLUDES += -I $(LOCAL_PATH)/../src/
+PACKAGE_C_INCLUDES += -I $(LOCAL_PATH)/../src/Utils
+
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES               := $(PACKAGE_C_INCLUDES)
+MY_SRC_FILES                   := $(wildcard $(LOCAL_PATH)/../src/sampler_bench.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/Utils/DataKernels.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/Utils/Sampler.cpp)
+LOCAL_MODULE                   := rwkv-qualcomm-sampler-bench
+LOCAL_SRC_FILES                := $(subst make/,,$(MY_SRC_FILES))
+include $(BUILD_EXECUTABLE)
@@ -19,6 +19,10 @@ MY_SRC_FILES                   := $(wildcard $(LOCAL_PATH)/../src/eval_text.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/tokenizer.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm-app.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm-pipeline.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm-async.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm-speculative.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/librwkv-qualcomm-beam.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/Log/*.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/PAL/src/linux/*.cpp)
 MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/PAL/src/common/*.cpp)
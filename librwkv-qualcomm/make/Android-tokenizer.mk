@@ -0,0 +1,12 @@
+LOCAL_PATH := $(call my-dir)
+SUPPORTED_TARGET_ABI := arm64-v8a
+
+PACKAGE_C_INCLUDES += -I $(LOCAL_PATH)/../src/
+
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES               := $(PACKAGE_C_INCLUDES)
+MY_SRC_FILES                   := $(wildcard $(LOCAL_PATH)/../src/tokenizer_compile.cpp)
+MY_SRC_FILES                   += $(wildcard $(LOCAL_PATH)/../src/tokenizer.cpp)
+LOCAL_MODULE                   := rwkv-qualcomm-tokenizer-compile
+LOCAL_SRC_FILES                := $(subst make/,,$(MY_SRC_FILES))
+include $(BUILD_EXECUTABLE)
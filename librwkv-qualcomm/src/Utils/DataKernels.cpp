@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "DataKernels.hpp"
+#include "half.hpp"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DATAKERNELS_NEON 1
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DATAKERNELS_X86 1
+#endif
+
+using namespace qnn::tools::datautil;
+
+namespace {
+
+typedef void (*HalfToFloatFn_t)(float *, const uint16_t *, size_t);
+typedef void (*FloatToHalfFn_t)(uint16_t *, const float *, size_t);
+typedef void (*U8ToFloatFn_t)(float *, const uint8_t *, int32_t, float, size_t);
+typedef void (*U16ToFloatFn_t)(float *, const uint16_t *, int32_t, float, size_t);
+typedef void (*FloatToU8Fn_t)(uint8_t *, const float *, int32_t, float, size_t);
+typedef void (*FloatToU16Fn_t)(uint16_t *, const float *, int32_t, float, size_t);
+typedef void (*ScaledExpFn_t)(float *, const float *, float, float, size_t);
+typedef size_t (*Argmax16Fn_t)(const uint16_t *, size_t);
+typedef void (*BlockMax16Fn_t)(uint16_t *, const uint16_t *, size_t);
+typedef size_t (*ArgmaxF32Fn_t)(const float *, size_t);
+typedef void (*BlockMaxF32Fn_t)(uint32_t *, const float *, size_t);
+
+struct KernelTable {
+  const char *name;
+  HalfToFloatFn_t halfToFloat;
+  FloatToHalfFn_t floatToHalf;
+  U8ToFloatFn_t u8ToFloat;
+  U16ToFloatFn_t u16ToFloat;
+  FloatToU8Fn_t floatToU8;
+  FloatToU16Fn_t floatToU16;
+  ScaledExpFn_t scaledExp;
+  Argmax16Fn_t argmaxU16;
+  Argmax16Fn_t argmaxHalf;
+  BlockMax16Fn_t blockMaxU16;
+  BlockMax16Fn_t blockMaxHalf;
+  ArgmaxF32Fn_t argmaxF32;
+  BlockMaxF32Fn_t blockMaxF32;
+};
+
+void halfToFloatScalar(float *out, const uint16_t *in, size_t numElements) {
+  const half_float::half *ptr = reinterpret_cast<const half_float::half *>(in);
+  for (size_t i = 0; i < numElements; i++) {
+    out[i] = ptr[i];
+  }
+}
+
+void floatToHalfScalar(uint16_t *out, const float *in, size_t numElements) {
+  half_float::half *ptr = reinterpret_cast<half_float::half *>(out);
+  for (size_t i = 0; i < numElements; i++) {
+    ptr[i] = half_float::half(in[i]);
+  }
+}
+
+// (q + offset) is exact in float, so this rounds once like the double version
+template <typename T>
+void tfNToFloatScalar(float *out, const T *in, int32_t offset, float scale, size_t numElements) {
+  const float offsetFloat = static_cast<float>(offset);
+  for (size_t i = 0; i < numElements; i++) {
+    out[i] = (static_cast<float>(in[i]) + offsetFloat) * scale;
+  }
+}
+
+template <typename T>
+void floatToTfNScalar(T *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  const float offsetFloat = static_cast<float>(offset);
+  const float maxValue    = static_cast<float>(std::numeric_limits<T>::max());
+  for (size_t i = 0; i < numElements; i++) {
+    float value = std::floor(in[i] / scale + 0.5f) - offsetFloat;
+    out[i]      = static_cast<T>(std::min(std::max(value, 0.f), maxValue));
+  }
+}
+
+void scaledExpScalar(float *out, const float *in, float shift, float scale, size_t numElements) {
+  for (size_t i = 0; i < numElements; i++) {
+    out[i] = std::exp((in[i] - shift) * scale);
+  }
+}
+
+// Cephes expf: exp(x) = 2^n * exp(r) with n = round(x / ln2) and |r| <= ln2 / 2.
+// x is clamped so that 2^n stays a normal float.
+const float kExpMin   = -87.33654f;
+const float kExpMax   = 88.02969f;
+const float kLog2e    = 1.44269504088896341f;
+const float kLn2Hi    = 0.693359375f;
+const float kLn2Lo    = -2.12194440e-4f;
+const float kExpP[6]  = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                         4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+// fp16 bits as an unsigned key in the order of the values: negative numbers get
+// all bits flipped, positive ones only the sign bit
+inline uint16_t halfKey(uint16_t bits) {
+  return bits ^ ((bits & 0x8000) ? 0xFFFF : 0x8000);
+}
+
+inline uint32_t floatKey(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits ^ ((bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+template <bool isHalf>
+inline uint16_t key16(uint16_t value) {
+  return isHalf ? halfKey(value) : value;
+}
+
+template <typename KeyT, typename KeyFn>
+size_t argmaxScalar(size_t begin, size_t end, KeyFn key) {
+  size_t best  = begin;
+  KeyT bestKey = 0;
+  for (size_t i = begin; i < end; i++) {
+    KeyT value = key(i);
+    if (value > bestKey) {
+      bestKey = value;
+      best    = i;
+    }
+  }
+  return best;
+}
+
+// The SIMD argmax kernels reduce whole blocks and remember the first block that
+// raised the running maximum bestKey; only that block and the tail starting at
+// tailStart are searched element by element.
+template <typename KeyT, typename KeyFn>
+size_t finishArgmax(size_t numElements, size_t tailStart, size_t bestBlock, KeyT bestKey, KeyFn key) {
+  size_t tail = argmaxScalar<KeyT>(tailStart, numElements, key);
+  if (0 == tailStart || (tail < numElements && key(tail) > bestKey)) {
+    return tail;
+  }
+  size_t i = bestBlock;
+  while (key(i) != bestKey) {
+    i++;
+  }
+  return i;
+}
+
+template <bool isHalf>
+size_t argmax16Scalar(const uint16_t *in, size_t numElements) {
+  return argmaxScalar<uint16_t>(0, numElements, [in](size_t i) { return key16<isHalf>(in[i]); });
+}
+
+size_t argmaxF32Scalar(const float *in, size_t numElements) {
+  return argmaxScalar<uint32_t>(0, numElements, [in](size_t i) { return floatKey(in[i]); });
+}
+
+// Selection works on blocks of kSelectBlock elements: the maximum key of every
+// block comes from a max-reduce pass, and the k-th largest block maximum has at
+// least k elements at or above it, so only the blocks reaching it are searched.
+const size_t kSelectBlock = 64;
+
+template <typename KeyT, typename KeyFn>
+void blockMaxScalar(KeyT *out, size_t begin, size_t end, KeyFn key) {
+  for (size_t i = begin; i < end; i += kSelectBlock) {
+    *out++ = key(argmaxScalar<KeyT>(i, std::min(i + kSelectBlock, end), key));
+  }
+}
+
+template <bool isHalf>
+void blockMax16Scalar(uint16_t *out, const uint16_t *in, size_t numElements) {
+  blockMaxScalar<uint16_t>(out, 0, numElements, [in](size_t i) { return key16<isHalf>(in[i]); });
+}
+
+void blockMaxF32Scalar(uint32_t *out, const float *in, size_t numElements) {
+  blockMaxScalar<uint32_t>(out, 0, numElements, [in](size_t i) { return floatKey(in[i]); });
+}
+
+template <typename KeyT, typename KeyFn>
+size_t topKByKey(int32_t *indices, size_t numElements, size_t k, KeyFn key, const std::vector<KeyT> &blockMax) {
+  k = std::min(k, numElements);
+  if (0 == k) {
+    return 0;
+  }
+  KeyT threshold = 0;
+  if (k <= blockMax.size()) {
+    thread_local std::vector<KeyT> maxima;
+    maxima.assign(blockMax.begin(), blockMax.end());
+    std::nth_element(maxima.begin(), maxima.begin() + (k - 1), maxima.end(), std::greater<KeyT>());
+    threshold = maxima[k - 1];
+  }
+  thread_local std::vector<int32_t> candidates;
+  candidates.clear();
+  for (size_t block = 0; block < blockMax.size(); block++) {
+    if (blockMax[block] < threshold) {
+      continue;
+    }
+    const size_t end = std::min((block + 1) * kSelectBlock, numElements);
+    for (size_t i = block * kSelectBlock; i < end; i++) {
+      if (key(i) >= threshold) {
+        candidates.push_back(static_cast<int32_t>(i));
+      }
+    }
+  }
+  auto greater = [&key](int32_t a, int32_t b) {
+    KeyT keyA = key(a), keyB = key(b);
+    return keyA > keyB || (keyA == keyB && a < b);
+  };
+  if (candidates.size() > k) {
+    std::nth_element(candidates.begin(), candidates.begin() + k, candidates.end(), greater);
+  }
+  std::sort(candidates.begin(), candidates.begin() + k, greater);
+  std::copy(candidates.begin(), candidates.begin() + k, indices);
+  return k;
+}
+
+#ifdef DATAKERNELS_X86
+__attribute__((target("avx,f16c"))) void halfToFloatF16C(float *out, const uint16_t *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+  }
+  halfToFloatScalar(out + i, in + i, numElements - i);
+}
+
+__attribute__((target("avx,f16c"))) void floatToHalfF16C(uint16_t *out, const float *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+  }
+  floatToHalfScalar(out + i, in + i, numElements - i);
+}
+
+__attribute__((target("avx2"))) void u8ToFloatAVX2(float *out, const uint8_t *in, int32_t offset, float scale, size_t numElements) {
+  const __m256 vOffset = _mm256_set1_ps(static_cast<float>(offset));
+  const __m256 vScale  = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i));
+    __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(q));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(value, vOffset), vScale));
+  }
+  tfNToFloatScalar<uint8_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+__attribute__((target("avx2"))) void u16ToFloatAVX2(float *out, const uint16_t *in, int32_t offset, float scale, size_t numElements) {
+  const __m256 vOffset = _mm256_set1_ps(static_cast<float>(offset));
+  const __m256 vScale  = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(value, vOffset), vScale));
+  }
+  tfNToFloatScalar<uint16_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+// eight floats to quantized int32 lanes, clamped to [0, maxValue]
+__attribute__((target("avx2"))) inline __m256i quantizeAVX2(const float *in, __m256 vScale, __m256 vOffset, __m256 vMax) {
+  __m256 value = _mm256_floor_ps(_mm256_add_ps(_mm256_div_ps(_mm256_loadu_ps(in), vScale), _mm256_set1_ps(0.5f)));
+  value = _mm256_sub_ps(value, vOffset);
+  value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), vMax);
+  return _mm256_cvttps_epi32(value);
+}
+
+__attribute__((target("avx2"))) void floatToU16AVX2(uint16_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  const __m256 vOffset = _mm256_set1_ps(static_cast<float>(offset));
+  const __m256 vScale  = _mm256_set1_ps(scale);
+  const __m256 vMax    = _mm256_set1_ps(65535.f);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m256i q = quantizeAVX2(in + i, vScale, vOffset, vMax);
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+  }
+  floatToTfNScalar<uint16_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+__attribute__((target("avx2"))) void floatToU8AVX2(uint8_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  const __m256 vOffset = _mm256_set1_ps(static_cast<float>(offset));
+  const __m256 vScale  = _mm256_set1_ps(scale);
+  const __m256 vMax    = _mm256_set1_ps(255.f);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m256i q = quantizeAVX2(in + i, vScale, vOffset, vMax);
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(packed, packed));
+  }
+  floatToTfNScalar<uint8_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+__attribute__((target("avx2"))) inline __m256 expAVX2(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(kExpMin)), _mm256_set1_ps(kExpMax));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(kLn2Hi)));
+  r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(kLn2Lo)));
+  __m256 p = _mm256_set1_ps(kExpP[0]);
+  for (int i = 1; i < 6; i++) {
+    p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(kExpP[i]));
+  }
+  p = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, _mm256_mul_ps(r, r)), r), _mm256_set1_ps(1.f));
+  __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2"))) void scaledExpAVX2(float *out, const float *in, float shift, float scale, size_t numElements) {
+  const __m256 vShift = _mm256_set1_ps(shift);
+  const __m256 vScale = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in + i), vShift), vScale);
+    _mm256_storeu_ps(out + i, expAVX2(x));
+  }
+  scaledExpScalar(out + i, in + i, shift, scale, numElements - i);
+}
+
+template <bool isHalf>
+__attribute__((target("avx2"))) inline __m256i loadKeysAVX2(const uint16_t *in) {
+  __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+  if (!isHalf) {
+    return value;
+  }
+  __m256i flip = _mm256_and_si256(_mm256_srai_epi16(value, 15), _mm256_set1_epi16(0x7FFF));
+  return _mm256_xor_si256(value, _mm256_or_si256(flip, _mm256_set1_epi16(static_cast<short>(0x8000))));
+}
+
+__attribute__((target("avx2"))) inline uint16_t maxKeyAVX2(__m256i keys) {
+  __m128i m = _mm_max_epu16(_mm256_castsi256_si128(keys), _mm256_extracti128_si256(keys, 1));
+  // minpos finds the smallest lane, so search the complement
+  m = _mm_xor_si128(m, _mm_set1_epi32(-1));
+  return static_cast<uint16_t>(~_mm_cvtsi128_si32(_mm_minpos_epu16(m)));
+}
+
+template <bool isHalf>
+__attribute__((target("avx2"))) inline __m256i blockKeysAVX2(const uint16_t *in) {
+  __m256i m = loadKeysAVX2<isHalf>(in);
+  for (size_t j = 16; j < kSelectBlock; j += 16) {
+    m = _mm256_max_epu16(m, loadKeysAVX2<isHalf>(in + j));
+  }
+  return m;
+}
+
+template <bool isHalf>
+__attribute__((target("avx2"))) size_t argmax16AVX2(const uint16_t *in, size_t numElements) {
+  size_t bestBlock = 0;
+  uint16_t bestKey = 0;
+  __m256i vBest    = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    __m256i m = blockKeysAVX2<isHalf>(in + i);
+    // some lane is above the running maximum
+    if (-1 != _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_max_epu16(m, vBest), vBest))) {
+      bestKey   = maxKeyAVX2(m);
+      vBest     = _mm256_set1_epi16(static_cast<short>(bestKey));
+      bestBlock = i;
+    }
+  }
+  return finishArgmax<uint16_t>(numElements, i, bestBlock, bestKey, [in](size_t j) { return key16<isHalf>(in[j]); });
+}
+
+template <bool isHalf>
+__attribute__((target("avx2"))) void blockMax16AVX2(uint16_t *out, const uint16_t *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    *out++ = maxKeyAVX2(blockKeysAVX2<isHalf>(in + i));
+  }
+  blockMaxScalar<uint16_t>(out, i, numElements, [in](size_t j) { return key16<isHalf>(in[j]); });
+}
+
+__attribute__((target("avx2"))) inline __m256i loadKeysF32AVX2(const float *in) {
+  __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+  __m256i flip  = _mm256_or_si256(_mm256_srai_epi32(value, 31), _mm256_set1_epi32(static_cast<int>(0x80000000u)));
+  return _mm256_xor_si256(value, flip);
+}
+
+__attribute__((target("avx2"))) inline __m256i blockKeysF32AVX2(const float *in) {
+  __m256i m = loadKeysF32AVX2(in);
+  for (size_t j = 8; j < kSelectBlock; j += 8) {
+    m = _mm256_max_epu32(m, loadKeysF32AVX2(in + j));
+  }
+  return m;
+}
+
+__attribute__((target("avx2"))) inline uint32_t maxKeyF32AVX2(__m256i keys) {
+  __m128i m = _mm_max_epu32(_mm256_castsi256_si128(keys), _mm256_extracti128_si256(keys, 1));
+  m = _mm_max_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm_max_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(m));
+}
+
+__attribute__((target("avx2"))) size_t argmaxF32AVX2(const float *in, size_t numElements) {
+  size_t bestBlock = 0;
+  uint32_t bestKey = 0;
+  __m256i vBest    = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    __m256i m = blockKeysF32AVX2(in + i);
+    if (-1 != _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_max_epu32(m, vBest), vBest))) {
+      bestKey   = maxKeyF32AVX2(m);
+      vBest     = _mm256_set1_epi32(static_cast<int>(bestKey));
+      bestBlock = i;
+    }
+  }
+  return finishArgmax<uint32_t>(numElements, i, bestBlock, bestKey, [in](size_t j) { return floatKey(in[j]); });
+}
+
+__attribute__((target("avx2"))) void blockMaxF32AVX2(uint32_t *out, const float *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    *out++ = maxKeyF32AVX2(blockKeysF32AVX2(in + i));
+  }
+  blockMaxScalar<uint32_t>(out, i, numElements, [in](size_t j) { return floatKey(in[j]); });
+}
+#endif  // DATAKERNELS_X86
+
+#ifdef DATAKERNELS_NEON
+void halfToFloatNeon(float *out, const uint16_t *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(in + i));
+    vst1q_f32(out + i, vcvt_f32_f16(vget_low_f16(h)));
+    vst1q_f32(out + i + 4, vcvt_high_f32_f16(h));
+  }
+  halfToFloatScalar(out + i, in + i, numElements - i);
+}
+
+void floatToHalfNeon(uint16_t *out, const float *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    float16x8_t h = vcvt_high_f16_f32(vcvt_f16_f32(vld1q_f32(in + i)), vld1q_f32(in + i + 4));
+    vst1q_u16(out + i, vreinterpretq_u16_f16(h));
+  }
+  floatToHalfScalar(out + i, in + i, numElements - i);
+}
+
+inline void dequantizeNeon(float *out, uint16x8_t q, float32x4_t vOffset, float32x4_t vScale) {
+  float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(q)));
+  float32x4_t hi = vcvtq_f32_u32(vmovl_high_u16(q));
+  vst1q_f32(out, vmulq_f32(vaddq_f32(lo, vOffset), vScale));
+  vst1q_f32(out + 4, vmulq_f32(vaddq_f32(hi, vOffset), vScale));
+}
+
+void u8ToFloatNeon(float *out, const uint8_t *in, int32_t offset, float scale, size_t numElements) {
+  const float32x4_t vOffset = vdupq_n_f32(static_cast<float>(offset));
+  const float32x4_t vScale  = vdupq_n_f32(scale);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    dequantizeNeon(out + i, vmovl_u8(vld1_u8(in + i)), vOffset, vScale);
+  }
+  tfNToFloatScalar<uint8_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+void u16ToFloatNeon(float *out, const uint16_t *in, int32_t offset, float scale, size_t numElements) {
+  const float32x4_t vOffset = vdupq_n_f32(static_cast<float>(offset));
+  const float32x4_t vScale  = vdupq_n_f32(scale);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    dequantizeNeon(out + i, vld1q_u16(in + i), vOffset, vScale);
+  }
+  tfNToFloatScalar<uint16_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+// eight floats to quantized uint16 lanes, clamped to [0, maxValue]
+inline uint16x8_t quantizeNeon(const float *in, float32x4_t vScale, float32x4_t vOffset, float32x4_t vMax) {
+  const float32x4_t vHalf = vdupq_n_f32(0.5f);
+  const float32x4_t vZero = vdupq_n_f32(0.f);
+  float32x4_t lo = vsubq_f32(vrndmq_f32(vaddq_f32(vdivq_f32(vld1q_f32(in), vScale), vHalf)), vOffset);
+  float32x4_t hi = vsubq_f32(vrndmq_f32(vaddq_f32(vdivq_f32(vld1q_f32(in + 4), vScale), vHalf)), vOffset);
+  lo = vminq_f32(vmaxq_f32(lo, vZero), vMax);
+  hi = vminq_f32(vmaxq_f32(hi, vZero), vMax);
+  return vcombine_u16(vmovn_u32(vcvtq_u32_f32(lo)), vmovn_u32(vcvtq_u32_f32(hi)));
+}
+
+void floatToU8Neon(uint8_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  const float32x4_t vOffset = vdupq_n_f32(static_cast<float>(offset));
+  const float32x4_t vScale  = vdupq_n_f32(scale);
+  const float32x4_t vMax    = vdupq_n_f32(255.f);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    vst1_u8(out + i, vmovn_u16(quantizeNeon(in + i, vScale, vOffset, vMax)));
+  }
+  floatToTfNScalar<uint8_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+void floatToU16Neon(uint16_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  const float32x4_t vOffset = vdupq_n_f32(static_cast<float>(offset));
+  const float32x4_t vScale  = vdupq_n_f32(scale);
+  const float32x4_t vMax    = vdupq_n_f32(65535.f);
+  size_t i = 0;
+  for (; i + 8 <= numElements; i += 8) {
+    vst1q_u16(out + i, quantizeNeon(in + i, vScale, vOffset, vMax));
+  }
+  floatToTfNScalar<uint16_t>(out + i, in + i, offset, scale, numElements - i);
+}
+
+inline float32x4_t expNeon(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(kExpMin)), vdupq_n_f32(kExpMax));
+  float32x4_t n = vrndnq_f32(vmulq_n_f32(x, kLog2e));
+  float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(kLn2Hi));
+  r = vfmsq_f32(r, n, vdupq_n_f32(kLn2Lo));
+  float32x4_t p = vdupq_n_f32(kExpP[0]);
+  for (int i = 1; i < 6; i++) {
+    p = vfmaq_f32(vdupq_n_f32(kExpP[i]), p, r);
+  }
+  p = vaddq_f32(vfmaq_f32(r, p, vmulq_f32(r, r)), vdupq_n_f32(1.f));
+  int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(e));
+}
+
+void scaledExpNeon(float *out, const float *in, float shift, float scale, size_t numElements) {
+  const float32x4_t vShift = vdupq_n_f32(shift);
+  size_t i = 0;
+  for (; i + 4 <= numElements; i += 4) {
+    vst1q_f32(out + i, expNeon(vmulq_n_f32(vsubq_f32(vld1q_f32(in + i), vShift), scale)));
+  }
+  scaledExpScalar(out + i, in + i, shift, scale, numElements - i);
+}
+
+template <bool isHalf>
+inline uint16x8_t loadKeysNeon(const uint16_t *in) {
+  uint16x8_t value = vld1q_u16(in);
+  if (!isHalf) {
+    return value;
+  }
+  uint16x8_t flip = vandq_u16(vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(value), 15)), vdupq_n_u16(0x7FFF));
+  return veorq_u16(value, vorrq_u16(flip, vdupq_n_u16(0x8000)));
+}
+
+template <bool isHalf>
+inline uint16x8_t blockKeysNeon(const uint16_t *in) {
+  uint16x8_t m = loadKeysNeon<isHalf>(in);
+  for (size_t j = 8; j < kSelectBlock; j += 8) {
+    m = vmaxq_u16(m, loadKeysNeon<isHalf>(in + j));
+  }
+  return m;
+}
+
+template <bool isHalf>
+size_t argmax16Neon(const uint16_t *in, size_t numElements) {
+  size_t bestBlock = 0;
+  uint16_t bestKey = 0;
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    uint16_t blockKey = vmaxvq_u16(blockKeysNeon<isHalf>(in + i));
+    if (blockKey > bestKey) {
+      bestKey   = blockKey;
+      bestBlock = i;
+    }
+  }
+  return finishArgmax<uint16_t>(numElements, i, bestBlock, bestKey, [in](size_t j) { return key16<isHalf>(in[j]); });
+}
+
+template <bool isHalf>
+void blockMax16Neon(uint16_t *out, const uint16_t *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    *out++ = vmaxvq_u16(blockKeysNeon<isHalf>(in + i));
+  }
+  blockMaxScalar<uint16_t>(out, i, numElements, [in](size_t j) { return key16<isHalf>(in[j]); });
+}
+
+inline uint32x4_t blockKeysF32Neon(const float *in) {
+  uint32x4_t m = vdupq_n_u32(0);
+  for (size_t j = 0; j < kSelectBlock; j += 4) {
+    uint32x4_t value = vld1q_u32(reinterpret_cast<const uint32_t *>(in + j));
+    uint32x4_t flip  = vorrq_u32(vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(value), 31)), vdupq_n_u32(0x80000000u));
+    m = vmaxq_u32(m, veorq_u32(value, flip));
+  }
+  return m;
+}
+
+size_t argmaxF32Neon(const float *in, size_t numElements) {
+  size_t bestBlock = 0;
+  uint32_t bestKey = 0;
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    uint32_t blockKey = vmaxvq_u32(blockKeysF32Neon(in + i));
+    if (blockKey > bestKey) {
+      bestKey   = blockKey;
+      bestBlock = i;
+    }
+  }
+  return finishArgmax<uint32_t>(numElements, i, bestBlock, bestKey, [in](size_t j) { return floatKey(in[j]); });
+}
+
+void blockMaxF32Neon(uint32_t *out, const float *in, size_t numElements) {
+  size_t i = 0;
+  for (; i + kSelectBlock <= numElements; i += kSelectBlock) {
+    *out++ = vmaxvq_u32(blockKeysF32Neon(in + i));
+  }
+  blockMaxScalar<uint32_t>(out, i, numElements, [in](size_t j) { return floatKey(in[j]); });
+}
+#endif  // DATAKERNELS_NEON
+
+KernelTable selectKernels() {
+  KernelTable table = {"scalar",
+                       halfToFloatScalar,
+                       floatToHalfScalar,
+                       tfNToFloatScalar<uint8_t>,
+                       tfNToFloatScalar<uint16_t>,
+                       floatToTfNScalar<uint8_t>,
+                       floatToTfNScalar<uint16_t>,
+                       scaledExpScalar,
+                       argmax16Scalar<false>,
+                       argmax16Scalar<true>,
+                       blockMax16Scalar<false>,
+                       blockMax16Scalar<true>,
+                       argmaxF32Scalar,
+                       blockMaxF32Scalar};
+#if defined(DATAKERNELS_NEON)
+  // fp16 conversion and vdivq/vrndmq are part of the arm64 baseline
+  table = {"neon",
+           halfToFloatNeon,
+           floatToHalfNeon,
+           u8ToFloatNeon,
+           u16ToFloatNeon,
+           floatToU8Neon,
+           floatToU16Neon,
+           scaledExpNeon,
+           argmax16Neon<false>,
+           argmax16Neon<true>,
+           blockMax16Neon<false>,
+           blockMax16Neon<true>,
+           argmaxF32Neon,
+           blockMaxF32Neon};
+#elif defined(DATAKERNELS_X86)
+  __builtin_cpu_init();
+  const bool hasF16C = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  if (hasF16C) {
+    table.name        = "f16c";
+    table.halfToFloat = halfToFloatF16C;
+    table.floatToHalf = floatToHalfF16C;
+  }
+  if (hasF16C && __builtin_cpu_supports("avx2")) {
+    table.name       = "avx2";
+    table.u8ToFloat  = u8ToFloatAVX2;
+    table.u16ToFloat = u16ToFloatAVX2;
+    table.floatToU8  = floatToU8AVX2;
+    table.floatToU16 = floatToU16AVX2;
+    table.scaledExp  = scaledExpAVX2;
+    table.argmaxU16  = argmax16AVX2<false>;
+    table.argmaxHalf = argmax16AVX2<true>;
+    table.blockMaxU16  = blockMax16AVX2<false>;
+    table.blockMaxHalf = blockMax16AVX2<true>;
+    table.argmaxF32    = argmaxF32AVX2;
+    table.blockMaxF32  = blockMaxF32AVX2;
+  }
+#endif
+  return table;
+}
+
+const KernelTable &kernelTable() {
+  static const KernelTable table = selectKernels();
+  return table;
+}
+
+}  // namespace
+
+void kernels::halfToFloat(float *out, const uint16_t *in, size_t numElements) {
+  kernelTable().halfToFloat(out, in, numElements);
+}
+
+void kernels::floatToHalf(uint16_t *out, const float *in, size_t numElements) {
+  kernelTable().floatToHalf(out, in, numElements);
+}
+
+template <>
+void kernels::tfNToFloat<uint8_t>(float *out, const uint8_t *in, int32_t offset, float scale, size_t numElements) {
+  kernelTable().u8ToFloat(out, in, offset, scale, numElements);
+}
+
+template <>
+void kernels::tfNToFloat<uint16_t>(float *out, const uint16_t *in, int32_t offset, float scale, size_t numElements) {
+  kernelTable().u16ToFloat(out, in, offset, scale, numElements);
+}
+
+template <>
+void kernels::floatToTfN<uint8_t>(uint8_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  kernelTable().floatToU8(out, in, offset, scale, numElements);
+}
+
+template <>
+void kernels::floatToTfN<uint16_t>(uint16_t *out, const float *in, int32_t offset, float scale, size_t numElements) {
+  kernelTable().floatToU16(out, in, offset, scale, numElements);
+}
+
+// Plain loops: the compiler vectorizes these with the baseline ISA.
+template <typename T>
+void kernels::castToFloat(float *out, const T *in, size_t numElements) {
+  for (size_t i = 0; i < numElements; i++) {
+    out[i] = static_cast<float>(in[i]);
+  }
+}
+
+template <typename T>
+void kernels::castFromFloat(T *out, const float *in, size_t numElements) {
+  for (size_t i = 0; i < numElements; i++) {
+    out[i] = static_cast<T>(in[i]);
+  }
+}
+
+template void kernels::castToFloat<uint8_t>(float *out, const uint8_t *in, size_t numElements);
+template void kernels::castToFloat<uint16_t>(float *out, const uint16_t *in, size_t numElements);
+template void kernels::castToFloat<uint32_t>(float *out, const uint32_t *in, size_t numElements);
+template void kernels::castToFloat<int8_t>(float *out, const int8_t *in, size_t numElements);
+template void kernels::castToFloat<int16_t>(float *out, const int16_t *in, size_t numElements);
+template void kernels::castToFloat<int32_t>(float *out, const int32_t *in, size_t numElements);
+
+template void kernels::castFromFloat<uint8_t>(uint8_t *out, const float *in, size_t numElements);
+template void kernels::castFromFloat<uint16_t>(uint16_t *out, const float *in, size_t numElements);
+template void kernels::castFromFloat<uint32_t>(uint32_t *out, const float *in, size_t numElements);
+template void kernels::castFromFloat<int8_t>(int8_t *out, const float *in, size_t numElements);
+template void kernels::castFromFloat<int16_t>(int16_t *out, const float *in, size_t numElements);
+template void kernels::castFromFloat<int32_t>(int32_t *out, const float *in, size_t numElements);
+
+void kernels::scaledExp(float *out, const float *in, float shift, float scale, size_t numElements) {
+  kernelTable().scaledExp(out, in, shift, scale, numElements);
+}
+
+size_t kernels::argmax(const uint8_t *in, size_t numElements) {
+  return std::max_element(in, in + numElements) - in;
+}
+
+size_t kernels::argmax(const uint16_t *in, size_t numElements, bool isHalf) {
+  return isHalf ? kernelTable().argmaxHalf(in, numElements) : kernelTable().argmaxU16(in, numElements);
+}
+
+size_t kernels::argmax(const float *in, size_t numElements) {
+  return kernelTable().argmaxF32(in, numElements);
+}
+
+size_t kernels::topK(int32_t *indices, const uint8_t *in, size_t numElements, size_t k) {
+  auto key = [in](size_t i) { return in[i]; };
+  thread_local std::vector<uint8_t> blockMax;
+  blockMax.resize((numElements + kSelectBlock - 1) / kSelectBlock);
+  blockMaxScalar<uint8_t>(blockMax.data(), 0, numElements, key);
+  return topKByKey(indices, numElements, k, key, blockMax);
+}
+
+size_t kernels::topK(int32_t *indices, const uint16_t *in, size_t numElements, size_t k, bool isHalf) {
+  thread_local std::vector<uint16_t> blockMax;
+  blockMax.resize((numElements + kSelectBlock - 1) / kSelectBlock);
+  if (isHalf) {
+    kernelTable().blockMaxHalf(blockMax.data(), in, numElements);
+    return topKByKey(indices, numElements, k, [in](size_t i) { return halfKey(in[i]); }, blockMax);
+  }
+  kernelTable().blockMaxU16(blockMax.data(), in, numElements);
+  return topKByKey(indices, numElements, k, [in](size_t i) { return in[i]; }, blockMax);
+}
+
+size_t kernels::topK(int32_t *indices, const float *in, size_t numElements, size_t k) {
+  thread_local std::vector<uint32_t> blockMax;
+  blockMax.resize((numElements + kSelectBlock - 1) / kSelectBlock);
+  kernelTable().blockMaxF32(blockMax.data(), in, numElements);
+  return topKByKey(indices, numElements, k, [in](size_t i) { return floatKey(in[i]); }, blockMax);
+}
+
+const char *kernels::isaName() {
+  return kernelTable().name;
+}
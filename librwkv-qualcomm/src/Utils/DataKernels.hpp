@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace qnn {
+namespace tools {
+namespace datautil {
+namespace kernels {
+
+// Conversions between native tensor data and float, writing into caller-provided
+// buffers. The implementation is picked once at first use from what the CPU
+// supports: AVX2 / F16C on x86, NEON on arm64, scalar elsewhere.
+//
+// tfNToFloat and the casts give the same results as the scalar datautil versions.
+// floatToTfN computes round(in / scale) - offset in single precision, which can
+// differ by one step from the double precision datautil::floatToTfN near ties.
+
+void halfToFloat(float *out, const uint16_t *in, size_t numElements);
+
+void floatToHalf(uint16_t *out, const float *in, size_t numElements);
+
+// T is uint8_t or uint16_t
+template <typename T>
+void tfNToFloat(float *out, const T *in, int32_t offset, float scale, size_t numElements);
+
+template <typename T>
+void floatToTfN(T *out, const float *in, int32_t offset, float scale, size_t numElements);
+
+// T is one of the 8/16/32-bit integer types
+template <typename T>
+void castToFloat(float *out, const T *in, size_t numElements);
+
+template <typename T>
+void castFromFloat(T *out, const float *in, size_t numElements);
+
+// out[i] = exp((in[i] - shift) * scale). The SIMD versions use a polynomial within
+// a few ulp of std::exp; results below FLT_MIN are not denormalized.
+void scaledExp(float *out, const float *in, float shift, float scale, size_t numElements);
+
+// Selection on native logits without converting them to float. The uint16_t
+// overloads read ufixed16 data, or fp16 data with isHalf set (NaNs are not ordered).
+// Quantization scales are positive, so a larger quantized value is a larger logit.
+// Ties go to the lower index, as with std::max_element.
+size_t argmax(const uint8_t *in, size_t numElements);
+
+size_t argmax(const uint16_t *in, size_t numElements, bool isHalf);
+
+size_t argmax(const float *in, size_t numElements);
+
+// Indices of the k largest elements, largest first. Returns min(k, numElements).
+// Scratch space is kept per thread, so repeated calls do not allocate.
+size_t topK(int32_t *indices, const uint8_t *in, size_t numElements, size_t k);
+
+size_t topK(int32_t *indices, const uint16_t *in, size_t numElements, size_t k, bool isHalf);
+
+size_t topK(int32_t *indices, const float *in, size_t numElements, size_t k);
+
+// "avx2", "f16c", "neon" or "scalar"
+const char *isaName();
+
+}  // namespace kernels
+}  // namespace datautil
+}  // namespace tools
+}  // namespace qnn
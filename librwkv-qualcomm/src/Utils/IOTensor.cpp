@@ -11,6 +11,7 @@
 #include <iostream>
 
 #include "half.hpp"
+#include "DataKernels.hpp"
 #include "DataUtil.hpp"
 #include "IOTensor.hpp"
 #include "Logger.hpp"
@@ -71,99 +72,57 @@ iotensor::StatusCode iotensor::IOTensor::copyFromFloatToNative(float* floatBuffe
   StatusCode returnStatus = StatusCode::SUCCESS;
   std::vector<size_t> dims;
   fillDims(dims, QNN_TENSOR_GET_DIMENSIONS(tensor), QNN_TENSOR_GET_RANK(tensor));
+  size_t elementCount = datautil::calculateElementCount(dims);
+  void* data          = QNN_TENSOR_GET_CLIENT_BUF(tensor).data;
 
   switch (QNN_TENSOR_GET_DATA_TYPE(tensor)) {
+    case QNN_DATATYPE_FLOAT_32:
+      memcpy(data, floatBuffer, elementCount * sizeof(float));
+      break;
+
+    case QNN_DATATYPE_FLOAT_16:
+      datautil::kernels::floatToHalf(static_cast<uint16_t*>(data), floatBuffer, elementCount);
+      break;
+
     case QNN_DATATYPE_UFIXED_POINT_8:
-      datautil::floatToTfN<uint8_t>(static_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-                                    floatBuffer,
-                                    QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
-                                    QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
-                                    datautil::calculateElementCount(dims));
+      datautil::kernels::floatToTfN<uint8_t>(static_cast<uint8_t*>(data),
+                                             floatBuffer,
+                                             QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
+                                             QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
+                                             elementCount);
       break;
 
     case QNN_DATATYPE_UFIXED_POINT_16:
-      datautil::floatToTfN<uint16_t>(static_cast<uint16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-                                     floatBuffer,
-                                     QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
-                                     QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
-                                     datautil::calculateElementCount(dims));
+      datautil::kernels::floatToTfN<uint16_t>(static_cast<uint16_t*>(data),
+                                              floatBuffer,
+                                              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
+                                              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
+                                              elementCount);
       break;
 
     case QNN_DATATYPE_UINT_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<uint8_t>(
-              static_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<uint8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+    case QNN_DATATYPE_BOOL_8:
+      datautil::kernels::castFromFloat<uint8_t>(static_cast<uint8_t*>(data), floatBuffer, elementCount);
       break;
 
     case QNN_DATATYPE_UINT_16:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<uint16_t>(
-              static_cast<uint16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<uint16_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castFromFloat<uint16_t>(static_cast<uint16_t*>(data), floatBuffer, elementCount);
       break;
 
     case QNN_DATATYPE_UINT_32:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<uint32_t>(
-              static_cast<uint32_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<uint32_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castFromFloat<uint32_t>(static_cast<uint32_t*>(data), floatBuffer, elementCount);
       break;
 
     case QNN_DATATYPE_INT_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<int8_t>(
-              static_cast<int8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<int8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castFromFloat<int8_t>(static_cast<int8_t*>(data), floatBuffer, elementCount);
       break;
 
     case QNN_DATATYPE_INT_16:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<int16_t>(
-              static_cast<int16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<int16_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castFromFloat<int16_t>(static_cast<int16_t*>(data), floatBuffer, elementCount);
       break;
 
     case QNN_DATATYPE_INT_32:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<int32_t>(
-              static_cast<int32_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<int32_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
-      break;
-
-    case QNN_DATATYPE_BOOL_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castFromFloat<uint8_t>(
-              static_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              floatBuffer,
-              datautil::calculateElementCount(dims))) {
-        QNN_ERROR("failure in castFromFloat<bool>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castFromFloat<int32_t>(static_cast<int32_t*>(data), floatBuffer, elementCount);
       break;
 
     default:
@@ -301,11 +260,41 @@ iotensor::PopulateInputTensorsRetType_t iotensor::IOTensor::populateInputTensors
   return {StatusCode::SUCCESS, numFilesPopulated, numBatchSize};
 }
 
+static const size_t kArenaAlignment = 64;
+
+// Computes the offset of each tensor's client buffer in the arena, starting at
+// arenaSize, and advances arenaSize past them.
+iotensor::StatusCode iotensor::IOTensor::layoutTensors(Qnn_Tensor_t* tensorWrappers,
+                                                       uint32_t tensorCount,
+                                                       size_t& arenaSize,
+                                                       std::vector<size_t>& offsets) {
+  offsets.clear();
+  for (size_t tensorIdx = 0; tensorIdx < tensorCount; tensorIdx++) {
+    std::vector<size_t> dims;
+    fillDims(dims,
+             QNN_TENSOR_GET_DIMENSIONS(tensorWrappers[tensorIdx]),
+             QNN_TENSOR_GET_RANK(tensorWrappers[tensorIdx]));
+    datautil::StatusCode datautilStatus{datautil::StatusCode::SUCCESS};
+    size_t length{0};
+    std::tie(datautilStatus, length) =
+        datautil::calculateLength(dims, QNN_TENSOR_GET_DATA_TYPE(tensorWrappers[tensorIdx]));
+    if (datautilStatus != datautil::StatusCode::SUCCESS) {
+      return StatusCode::FAILURE;
+    }
+    offsets.push_back(arenaSize);
+    arenaSize += (length + kArenaAlignment - 1) / kArenaAlignment * kArenaAlignment;
+  }
+  return StatusCode::SUCCESS;
+}
+
 // Setup details for Qnn_Tensor_t for execution
 // based on information in Qnn_TensorWrapper_t provided by model.so.
+// Client buffers point into arena at the offsets computed by layoutTensors.
 iotensor::StatusCode iotensor::IOTensor::setupTensors(Qnn_Tensor_t** tensors,
                                                       uint32_t tensorCount,
-                                                      Qnn_Tensor_t* tensorWrappers) {
+                                                      Qnn_Tensor_t* tensorWrappers,
+                                                      uint8_t* arena,
+                                                      const std::vector<size_t>& offsets) {
   if (nullptr == tensorWrappers) {
     QNN_ERROR("tensorWrappers is nullptr");
     return StatusCode::FAILURE;
@@ -325,37 +314,30 @@ iotensor::StatusCode iotensor::IOTensor::setupTensors(Qnn_Tensor_t** tensors,
     Qnn_Tensor_t wrapperTensor = tensorWrappers[tensorIdx];
     std::vector<size_t> dims;
     fillDims(dims, QNN_TENSOR_GET_DIMENSIONS(wrapperTensor), QNN_TENSOR_GET_RANK(wrapperTensor));
-    if (StatusCode::SUCCESS == returnStatus) {
-      QNN_DEBUG("allocateBuffer successful");
-      (*tensors)[tensorIdx] = QNN_TENSOR_INIT;
-      returnStatus =
-          (rwkv_app::deepCopyQnnTensorInfo(((*tensors) + tensorIdx), &wrapperTensor) == true
-               ? StatusCode::SUCCESS
-               : StatusCode::FAILURE);
-    }
+    (*tensors)[tensorIdx] = QNN_TENSOR_INIT;
+    returnStatus =
+        (rwkv_app::deepCopyQnnTensorInfo(((*tensors) + tensorIdx), &wrapperTensor) == true
+             ? StatusCode::SUCCESS
+             : StatusCode::FAILURE);
     if (StatusCode::SUCCESS == returnStatus) {
       QNN_DEBUG("deepCopyQnnTensorInfo successful");
       QNN_TENSOR_SET_MEM_TYPE(((*tensors) + tensorIdx), QNN_TENSORMEMTYPE_RAW);
     }
     Qnn_ClientBuffer_t clientBuffer = QNN_CLIENT_BUFFER_INIT;
-    returnStatus = allocateBuffer(reinterpret_cast<uint8_t**>(&clientBuffer.data),
-                                  dims,
-                                  QNN_TENSOR_GET_DATA_TYPE((*tensors) + tensorIdx));
     datautil::StatusCode datautilStatus{datautil::StatusCode::SUCCESS};
     size_t length{0};
     std::tie(datautilStatus, length) =
         datautil::calculateLength(dims, QNN_TENSOR_GET_DATA_TYPE((*tensors) + tensorIdx));
     if (datautilStatus != datautil::StatusCode::SUCCESS) {
       returnStatus = StatusCode::FAILURE;
+    } else {
+      clientBuffer.data     = arena + offsets[tensorIdx];
+      clientBuffer.dataSize = length;
     }
-    clientBuffer.dataSize = length;
     QNN_TENSOR_SET_CLIENT_BUF(((*tensors) + tensorIdx), clientBuffer);
     if (StatusCode::SUCCESS != returnStatus) {
       QNN_ERROR("Failure in setupTensors, cleaning up resources");
-      if (nullptr != (QNN_TENSOR_GET_CLIENT_BUF((*tensors) + tensorIdx)).data) {
-        free(QNN_TENSOR_GET_CLIENT_BUF((*tensors) + tensorIdx).data);
-      }
-      tearDownTensors(*tensors, tensorIdx);
+      tearDownTensors(*tensors, tensorIdx + 1);
       *tensors     = nullptr;
       returnStatus = StatusCode::FAILURE;
       QNN_ERROR("Failure in setupTensors, done cleaning up resources");
@@ -368,14 +350,39 @@ iotensor::StatusCode iotensor::IOTensor::setupTensors(Qnn_Tensor_t** tensors,
 // Setup details for all input and output tensors for graph execution.
 iotensor::StatusCode iotensor::IOTensor::setupInputAndOutputTensors(
     Qnn_Tensor_t** inputs, Qnn_Tensor_t** outputs, qnn_wrapper_api::GraphInfo_t graphInfo) {
+  TensorArena arena;
+  if (StatusCode::SUCCESS != layoutTensors(graphInfo.inputTensors,
+                                           graphInfo.numInputTensors,
+                                           arena.size,
+                                           arena.inputOffsets) ||
+      StatusCode::SUCCESS != layoutTensors(graphInfo.outputTensors,
+                                           graphInfo.numOutputTensors,
+                                           arena.size,
+                                           arena.outputOffsets)) {
+    QNN_ERROR("Failure in computing the tensor arena layout");
+    return StatusCode::FAILURE;
+  }
+  QNN_DEBUG("allocating a %zu byte arena from the %s allocator", arena.size, m_allocator->name());
+  arena.base = static_cast<uint8_t*>(m_allocator->allocate(std::max(arena.size, kArenaAlignment)));
+  if (nullptr == arena.base) {
+    QNN_ERROR("mem alloc failed for the tensor arena");
+    return StatusCode::FAILURE;
+  }
+
   auto returnStatus = StatusCode::SUCCESS;
-  if (StatusCode::SUCCESS !=
-      setupTensors(inputs, graphInfo.numInputTensors, (graphInfo.inputTensors))) {
+  if (StatusCode::SUCCESS != setupTensors(inputs,
+                                          graphInfo.numInputTensors,
+                                          (graphInfo.inputTensors),
+                                          arena.base,
+                                          arena.inputOffsets)) {
     QNN_ERROR("Failure in setting up input tensors");
     returnStatus = StatusCode::FAILURE;
   }
-  if (StatusCode::SUCCESS !=
-      setupTensors(outputs, graphInfo.numOutputTensors, (graphInfo.outputTensors))) {
+  if (StatusCode::SUCCESS != setupTensors(outputs,
+                                          graphInfo.numOutputTensors,
+                                          (graphInfo.outputTensors),
+                                          arena.base,
+                                          arena.outputOffsets)) {
     QNN_ERROR("Failure in setting up output tensors");
     returnStatus = StatusCode::FAILURE;
   }
@@ -391,12 +398,83 @@ iotensor::StatusCode iotensor::IOTensor::setupInputAndOutputTensors(
       tearDownTensors(*outputs, graphInfo.numOutputTensors);
       *outputs = nullptr;
     }
+    m_allocator->deallocate(arena.base);
     QNN_ERROR("Failure in setupInputAndOutputTensors, done cleaning up resources");
+    return returnStatus;
   }
+  m_arenas[nullptr != *inputs ? *inputs : *outputs] = std::move(arena);
   return returnStatus;
 }
 
-// Clean up all tensors related data after execution.
+const iotensor::TensorArena* iotensor::IOTensor::getArena(Qnn_Tensor_t* inputs,
+                                                          Qnn_Tensor_t* outputs) const {
+  auto it = m_arenas.find(nullptr != inputs ? inputs : outputs);
+  return it != m_arenas.end() ? &it->second : nullptr;
+}
+
+iotensor::StatusCode iotensor::IOTensor::fillWithZero(Qnn_Tensor_t* tensor) {
+  if (nullptr == tensor || nullptr == QNN_TENSOR_GET_CLIENT_BUF(tensor).data) {
+    QNN_ERROR("fillWithZero(): received a nullptr");
+    return StatusCode::FAILURE;
+  }
+  std::vector<size_t> dims;
+  fillDims(dims, QNN_TENSOR_GET_DIMENSIONS(tensor), QNN_TENSOR_GET_RANK(tensor));
+  const size_t elementCount = datautil::calculateElementCount(dims);
+  // floatToTfN(0) rounds to -offset
+  const int32_t zeroPoint   = -QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset;
+  switch (QNN_TENSOR_GET_DATA_TYPE(tensor)) {
+    case QNN_DATATYPE_UFIXED_POINT_8: {
+      uint8_t* data = static_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data);
+      std::fill(data, data + elementCount, static_cast<uint8_t>(std::min(std::max(zeroPoint, 0), 0xff)));
+      break;
+    }
+
+    case QNN_DATATYPE_UFIXED_POINT_16: {
+      uint16_t* data = static_cast<uint16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data);
+      std::fill(data, data + elementCount, static_cast<uint16_t>(std::min(std::max(zeroPoint, 0), 0xffff)));
+      break;
+    }
+
+    default:
+      memset(QNN_TENSOR_GET_CLIENT_BUF(tensor).data, 0, QNN_TENSOR_GET_CLIENT_BUF(tensor).dataSize);
+      break;
+  }
+  return StatusCode::SUCCESS;
+}
+
+static bool isZeroBytePattern(const Qnn_Tensor_t& tensor) {
+  auto dataType = QNN_TENSOR_GET_DATA_TYPE(tensor);
+  if (dataType != QNN_DATATYPE_UFIXED_POINT_8 && dataType != QNN_DATATYPE_UFIXED_POINT_16) {
+    return true;
+  }
+  return QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset >= 0;
+}
+
+iotensor::StatusCode iotensor::IOTensor::zeroArena(Qnn_Tensor_t* inputs,
+                                                   Qnn_Tensor_t* outputs,
+                                                   size_t numInputTensors,
+                                                   size_t numOutputTensors) {
+  const TensorArena* arena = getArena(inputs, outputs);
+  if (nullptr == arena) {
+    QNN_ERROR("zeroArena(): no arena for these tensors");
+    return StatusCode::FAILURE;
+  }
+  memset(arena->base, 0, arena->size);
+  for (size_t tensorIdx = 0; tensorIdx < numInputTensors; tensorIdx++) {
+    if (!isZeroBytePattern(inputs[tensorIdx])) {
+      fillWithZero(&inputs[tensorIdx]);
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < numOutputTensors; tensorIdx++) {
+    if (!isZeroBytePattern(outputs[tensorIdx])) {
+      fillWithZero(&outputs[tensorIdx]);
+    }
+  }
+  return StatusCode::SUCCESS;
+}
+
+// Clean up all tensors related data after execution. Client buffers belong to
+// the graph's arena.
 iotensor::StatusCode iotensor::IOTensor::tearDownTensors(Qnn_Tensor_t* tensors,
                                                          uint32_t tensorCount) {
   for (size_t tensorIdx = 0; tensorIdx < tensorCount; tensorIdx++) {
@@ -405,20 +483,43 @@ iotensor::StatusCode iotensor::IOTensor::tearDownTensors(Qnn_Tensor_t* tensors,
       QNN_DEBUG("freeing dimensions");
       free(QNN_TENSOR_GET_DIMENSIONS(tensors[tensorIdx]));
     }
-    if (nullptr != QNN_TENSOR_GET_CLIENT_BUF(tensors[tensorIdx]).data) {
-      QNN_DEBUG("freeing clientBuf.data");
-      free(QNN_TENSOR_GET_CLIENT_BUF(tensors[tensorIdx]).data);
-    }
   }
   free(tensors);
   return StatusCode::SUCCESS;
 }
 
+// Memory handles are resolved per execute rather than stored in the tensors, so the
+// app can keep moving buffers between tensors as plain client buffers.
+Qnn_Tensor_t* iotensor::IOTensor::bindRegisteredBuffers(Qnn_Tensor_t* tensors,
+                                                        uint32_t tensorCount,
+                                                        Qnn_ContextHandle_t context,
+                                                        std::vector<Qnn_Tensor_t>& scratch) {
+  if (!m_allocator->registersMemory()) {
+    return tensors;
+  }
+  scratch.assign(tensors, tensors + tensorCount);
+  for (auto& tensor : scratch) {
+    Qnn_MemHandle_t memHandle =
+        m_allocator->getMemHandle(QNN_TENSOR_GET_CLIENT_BUF(tensor).data, tensor, context);
+    if (nullptr != memHandle) {
+      QNN_TENSOR_SET_MEM_TYPE(tensor, QNN_TENSORMEMTYPE_MEMHANDLE);
+      QNN_TENSOR_SET_MEM_HANDLE(tensor, memHandle);
+    }
+  }
+  return scratch.data();
+}
+
 // Clean up all input and output tensors after execution.
 iotensor::StatusCode iotensor::IOTensor::tearDownInputAndOutputTensors(Qnn_Tensor_t* inputs,
                                                                        Qnn_Tensor_t* outputs,
                                                                        size_t numInputTensors,
                                                                        size_t numOutputTensors) {
+  auto arena = m_arenas.find(nullptr != inputs ? inputs : outputs);
+  if (arena != m_arenas.end()) {
+    QNN_INFO("freeing the tensor arena");
+    m_allocator->deallocate(arena->second.base);
+    m_arenas.erase(arena);
+  }
   if (nullptr != inputs) {
     QNN_INFO("cleaning up resources for input tensors");
     tearDownTensors(inputs, numInputTensors);
@@ -528,125 +629,85 @@ iotensor::StatusCode iotensor::IOTensor::convertToFloat(float** out, Qnn_Tensor_
     QNN_ERROR("failure in allocateBuffer<float>");
     return returnStatus;
   }
+  returnStatus = convertToFloat(*out, tensor);
+  if (StatusCode::SUCCESS != returnStatus) {
+    QNN_DEBUG("freeing *out");
+    free(*out);
+    *out = nullptr;
+  }
+  return returnStatus;
+}
+#endif
+
+// Converts the tensor to float into out, which holds at least as many floats as
+// the tensor has elements.
+iotensor::StatusCode iotensor::IOTensor::convertToFloat(float* out, Qnn_Tensor_t* tensor) {
+  if (nullptr == out || nullptr == tensor) {
+    QNN_ERROR("convertToFloat(): received a nullptr");
+    return StatusCode::FAILURE;
+  }
+  std::vector<size_t> dims;
+  fillDims(dims, QNN_TENSOR_GET_DIMENSIONS(tensor), QNN_TENSOR_GET_RANK(tensor));
+  size_t elementCount = datautil::calculateElementCount(dims);
+  const void* data    = QNN_TENSOR_GET_CLIENT_BUF(tensor).data;
   switch (QNN_TENSOR_GET_DATA_TYPE(tensor)) {
+    case QNN_DATATYPE_FLOAT_32:
+      memcpy(out, data, elementCount * sizeof(float));
+      break;
+
+    case QNN_DATATYPE_FLOAT_16:
+      datautil::kernels::halfToFloat(out, static_cast<const uint16_t*>(data), elementCount);
+      break;
+
     case QNN_DATATYPE_UFIXED_POINT_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::tfNToFloat<uint8_t>(
-              *out,
-              reinterpret_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
-              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
-              elementCount)) {
-        QNN_ERROR("failure in tfNToFloat<uint8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::tfNToFloat<uint8_t>(out,
+                                             static_cast<const uint8_t*>(data),
+                                             QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
+                                             QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
+                                             elementCount);
       break;
 
     case QNN_DATATYPE_UFIXED_POINT_16:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::tfNToFloat<uint16_t>(
-              *out,
-              reinterpret_cast<uint16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
-              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
-              elementCount)) {
-        QNN_ERROR("failure in tfNToFloat<uint8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::tfNToFloat<uint16_t>(out,
+                                              static_cast<const uint16_t*>(data),
+                                              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset,
+                                              QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale,
+                                              elementCount);
       break;
 
     case QNN_DATATYPE_UINT_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<uint8_t>(
-              *out,
-              reinterpret_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<uint8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+    case QNN_DATATYPE_BOOL_8:
+      datautil::kernels::castToFloat<uint8_t>(out, static_cast<const uint8_t*>(data), elementCount);
       break;
 
     case QNN_DATATYPE_UINT_16:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<uint16_t>(
-              *out,
-              reinterpret_cast<uint16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<uint16_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castToFloat<uint16_t>(out, static_cast<const uint16_t*>(data), elementCount);
       break;
 
     case QNN_DATATYPE_UINT_32:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<uint32_t>(
-              *out,
-              reinterpret_cast<uint32_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<uint32_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castToFloat<uint32_t>(out, static_cast<const uint32_t*>(data), elementCount);
       break;
 
     case QNN_DATATYPE_INT_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<int8_t>(
-              *out,
-              reinterpret_cast<int8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<int8_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castToFloat<int8_t>(out, static_cast<const int8_t*>(data), elementCount);
       break;
 
     case QNN_DATATYPE_INT_16:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<int16_t>(
-              *out,
-              reinterpret_cast<int16_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<int16_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castToFloat<int16_t>(out, static_cast<const int16_t*>(data), elementCount);
       break;
 
     case QNN_DATATYPE_INT_32:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<int32_t>(
-              *out,
-              reinterpret_cast<int32_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<int32_t>");
-        returnStatus = StatusCode::FAILURE;
-      }
-      break;
-
-    case QNN_DATATYPE_BOOL_8:
-      if (datautil::StatusCode::SUCCESS !=
-          datautil::castToFloat<uint8_t>(
-              *out,
-              reinterpret_cast<uint8_t*>(QNN_TENSOR_GET_CLIENT_BUF(tensor).data),
-              elementCount)) {
-        QNN_ERROR("failure in castToFloat<bool>");
-        returnStatus = StatusCode::FAILURE;
-      }
+      datautil::kernels::castToFloat<int32_t>(out, static_cast<const int32_t*>(data), elementCount);
       break;
 
     default:
       QNN_ERROR("convertToFloat: Datatype not supported yet!");
-      returnStatus = StatusCode::FAILURE;
-      break;
+      return StatusCode::FAILURE;
   }
-  if (StatusCode::SUCCESS != returnStatus) {
-    QNN_DEBUG("freeing *out");
-    if (*out != nullptr) {
-      free(*out);
-      *out = nullptr;
-    }
-  }
-  return returnStatus;
+  return StatusCode::SUCCESS;
 }
 
+#ifndef __hexagon__
 // Helper method to convert Output tensors to float and write them
 // out to files.
 iotensor::StatusCode iotensor::IOTensor::convertAndWriteOutputTensorInFloat(
@@ -9,6 +9,7 @@
 
 #include <memory>
 #include <queue>
+#include <unordered_map>
 
 #include "QnnBackend.h"
 #include "QnnCommon.h"
@@ -19,6 +20,7 @@
 #include "QnnTensor.h"
 #include "QnnTypes.h"
 #include "QnnWrapperUtils.hpp"
+#include "TensorAllocator.hpp"
 
 namespace qnn {
 namespace tools {
@@ -33,6 +35,15 @@ InputDataType parseInputDataType(std::string dataTypeString);
 
 using PopulateInputTensorsRetType_t = std::tuple<StatusCode, size_t, size_t>;
 
+// All client buffers of one graph live in a single allocation: the inputs and then
+// the outputs, in tensor order, each at a 64-byte aligned offset.
+struct TensorArena {
+  uint8_t *base = nullptr;
+  size_t size   = 0;
+  std::vector<size_t> inputOffsets;
+  std::vector<size_t> outputOffsets;
+};
+
 class IOTensor {
  public:
   StatusCode setupInputAndOutputTensors(Qnn_Tensor_t **inputs,
@@ -69,8 +80,37 @@ class IOTensor {
 
   StatusCode copyFromFloatToNative(float *floatBuffer, Qnn_Tensor_t *tensor);
 
+  // Writes the native encoding of 0.0 to every element, i.e. the zero point for
+  // ufixed types.
+  StatusCode fillWithZero(Qnn_Tensor_t *tensor);
+
+  // Zeroes the arena of a graph with one memset, then rewrites the ufixed tensors
+  // whose zero point is not the all-zero pattern.
+  StatusCode zeroArena(Qnn_Tensor_t *inputs,
+                       Qnn_Tensor_t *outputs,
+                       size_t numInputTensors,
+                       size_t numOutputTensors);
+
+  // The arena set up by setupInputAndOutputTensors for these tensors, or nullptr.
+  const TensorArena *getArena(Qnn_Tensor_t *inputs, Qnn_Tensor_t *outputs) const;
+
   StatusCode convertToFloat(float **out, Qnn_Tensor_t *output);
 
+  StatusCode convertToFloat(float *out, Qnn_Tensor_t *output);
+
+  // Must be set before any tensor is set up; buffers are returned to the allocator
+  // that provided them.
+  void setAllocator(std::shared_ptr<TensorAllocator> allocator) { m_allocator = allocator; }
+
+  TensorAllocator *allocator() { return m_allocator.get(); }
+
+  // Returns the tensors to hand to graphExecute for a graph of context: tensors itself,
+  // or a copy in scratch with the allocator's registered buffers bound as memory handles.
+  Qnn_Tensor_t *bindRegisteredBuffers(Qnn_Tensor_t *tensors,
+                                      uint32_t tensorCount,
+                                      Qnn_ContextHandle_t context,
+                                      std::vector<Qnn_Tensor_t> &scratch);
+
  private:
   PopulateInputTensorsRetType_t populateInputTensor(const std::vector<std::string> &filePaths,
                                                     const size_t filePathsIndexOffset,
@@ -104,9 +144,23 @@ class IOTensor {
 
   StatusCode allocateBuffer(uint8_t **buffer, std::vector<size_t> dims, Qnn_DataType_t dataType);
 
-  StatusCode setupTensors(Qnn_Tensor_t **tensors, uint32_t tensorCount, Qnn_Tensor_t *tensorsInfo);
+  StatusCode layoutTensors(Qnn_Tensor_t *tensorWrappers,
+                           uint32_t tensorCount,
+                           size_t &arenaSize,
+                           std::vector<size_t> &offsets);
+
+  StatusCode setupTensors(Qnn_Tensor_t **tensors,
+                          uint32_t tensorCount,
+                          Qnn_Tensor_t *tensorsInfo,
+                          uint8_t *arena,
+                          const std::vector<size_t> &offsets);
 
   StatusCode fillDims(std::vector<size_t> &dims, uint32_t *inDimensions, uint32_t rank);
+
+  std::shared_ptr<TensorAllocator> m_allocator = std::make_shared<HeapAllocator>();
+
+  // keyed by the inputs array (the outputs array for graphs without inputs)
+  std::unordered_map<Qnn_Tensor_t *, TensorArena> m_arenas;
 };
 }  // namespace iotensor
 }  // namespace tools
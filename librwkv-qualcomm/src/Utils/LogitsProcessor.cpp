@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "DataKernels.hpp"
+#include "LogitsProcessor.hpp"
+
+using namespace qnn::tools;
+using namespace qnn::tools::datautil;
+
+static const sampler::Stage kDefaultChain[] = {sampler::Stage::Bias,
+                                               sampler::Stage::Ban,
+                                               sampler::Stage::Penalties,
+                                               sampler::Stage::TopK,
+                                               sampler::Stage::Typical,
+                                               sampler::Stage::TopP,
+                                               sampler::Stage::MinP,
+                                               sampler::Stage::Temperature,
+                                               sampler::Stage::Mirostat};
+
+sampler::LogitsProcessor::LogitsProcessor(size_t vocabSize, uint64_t seed)
+    : m_vocabSize(vocabSize),
+      m_chain(std::begin(kDefaultChain), std::end(kDefaultChain)),
+      m_rng(seed),
+      m_bias(vocabSize, 0.f),
+      m_banned((vocabSize + 63) / 64, 0),
+      m_penalties(vocabSize),
+      m_probs(vocabSize),
+      m_index(vocabSize),
+      m_scratchIds(vocabSize),
+      m_scratchLogits(vocabSize),
+      m_scratchProbs(vocabSize),
+      m_scores(vocabSize) {}
+
+void sampler::LogitsProcessor::setParams(const SamplingParams &params) {
+  const bool restartMirostat = params.mirostatTau != m_params.mirostatTau;
+  m_params                   = params;
+  if (restartMirostat) {
+    m_mirostatMu = 2 * m_params.mirostatTau;
+  }
+}
+
+void sampler::LogitsProcessor::setChain(const Stage *stages, size_t count) {
+  m_chain.assign(stages, stages + count);
+}
+
+void sampler::LogitsProcessor::setBias(int token, float bias) {
+  if (0.f == m_bias[token] && 0.f != bias) {
+    m_biasTokens.push_back(token);
+  }
+  m_bias[token] = bias;
+}
+
+void sampler::LogitsProcessor::clearBias() {
+  for (int32_t token : m_biasTokens) {
+    m_bias[token] = 0.f;
+  }
+  m_biasTokens.clear();
+}
+
+void sampler::LogitsProcessor::setBanned(int token, bool banned) {
+  const uint64_t bit = uint64_t(1) << (token & 63);
+  if (isBanned(token) != banned) {
+    m_banned[token >> 6] ^= bit;
+    m_numBanned += banned ? 1 : -1;
+  }
+}
+
+void sampler::LogitsProcessor::clearBanned() {
+  std::fill(m_banned.begin(), m_banned.end(), 0);
+  m_numBanned = 0;
+}
+
+void sampler::LogitsProcessor::reset() {
+  m_penalties.reset();
+  m_mirostatMu = 2 * m_params.mirostatTau;
+}
+
+// Walks the chain up to the first stage that cuts the candidates to a fixed
+// count. Stages before it may only lower logits or drop tokens, and each token
+// they can lower or drop widens the count by one.
+size_t sampler::LogitsProcessor::numCandidates() const {
+  size_t extra = 0;
+  for (Stage stage : m_chain) {
+    switch (stage) {
+      case Stage::Bias:
+        for (int32_t token : m_biasTokens) {
+          if (m_bias[token] > 0) {
+            return m_vocabSize;
+          }
+        }
+        break;
+      case Stage::Ban:
+        extra += m_numBanned;
+        break;
+      case Stage::Penalties:
+        if (m_params.presencePenalty < 0 || m_params.frequencyPenalty < 0) {
+          return m_vocabSize;
+        }
+        extra += m_penalties.numTokens();
+        break;
+      case Stage::Temperature:
+        if (m_params.temperature <= 0) {
+          return std::min(1 + extra, m_vocabSize);
+        }
+        break;
+      case Stage::TopK:
+        if (m_params.topK > 0) {
+          return std::min(m_params.topK + extra, m_vocabSize);
+        }
+        break;
+      case Stage::MinP:
+        break;
+      case Stage::TopP:
+        if (m_params.topP < 1) {
+          return m_vocabSize;
+        }
+        break;
+      case Stage::Typical:
+        if (m_params.typicalP < 1) {
+          return m_vocabSize;
+        }
+        break;
+      case Stage::Mirostat:
+        if (m_params.mirostatTau > 0) {
+          return m_vocabSize;
+        }
+        break;
+    }
+  }
+  return m_vocabSize;
+}
+
+int sampler::LogitsProcessor::sample(int *ids, float *logits, size_t size) {
+  m_ids      = ids;
+  m_logits   = logits;
+  m_size     = size;
+  m_scale    = 1.f;
+  m_sorted   = false;
+  m_hasProbs = false;
+  m_mirostat = false;
+
+  // Consecutive bias / ban / penalty stages are collected and run as one pass.
+  // A logit stored here stands for logit * m_scale, so what a stage adds is
+  // divided by the scale at its position in the chain.
+  unsigned pending   = 0;
+  float biasScale    = 1.f;
+  float penaltyScale = 1.f;
+  const bool penalize =
+      (0.f != m_params.presencePenalty || 0.f != m_params.frequencyPenalty) && m_penalties.numTokens() > 0;
+  for (Stage stage : m_chain) {
+    switch (stage) {
+      case Stage::Bias:
+        if (!m_biasTokens.empty()) {
+          pending |= kBias;
+          biasScale = 1.f / m_scale;
+        }
+        continue;
+      case Stage::Ban:
+        pending |= m_numBanned ? kBan : 0;
+        continue;
+      case Stage::Penalties:
+        if (penalize) {
+          pending |= kPenalties;
+          penaltyScale = 1.f / m_scale;
+        }
+        continue;
+      case Stage::Temperature:
+        if (m_params.temperature > 0) {
+          m_scale /= m_params.temperature;
+          m_hasProbs = false;
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    if (pending) {
+      applyPointwise(pending, biasScale, penaltyScale);
+      pending = 0;
+    }
+    if (0 == m_size) {
+      return -1;
+    }
+    switch (stage) {
+      case Stage::Temperature:
+        applyTemperature();
+        break;
+      case Stage::TopK:
+        applyTopK();
+        break;
+      case Stage::TopP:
+        applyTopP();
+        break;
+      case Stage::MinP:
+        applyMinP();
+        break;
+      case Stage::Typical:
+        applyTypical();
+        break;
+      case Stage::Mirostat:
+        applyMirostat();
+        break;
+      default:
+        break;
+    }
+  }
+  if (pending) {
+    applyPointwise(pending, biasScale, penaltyScale);
+  }
+  if (0 == m_size) {
+    return -1;
+  }
+
+  size_t chosen = 0;
+  if (m_size > 1) {
+    softmax();
+    const float target = uniform() * m_probSum;
+    float cumsum       = 0;
+    chosen             = m_size - 1;
+    for (size_t i = 0; i < m_size; i++) {
+      cumsum += m_probs[i];
+      if (cumsum > target) {
+        chosen = i;
+        break;
+      }
+    }
+  }
+  if (m_mirostat) {
+    const float prob     = m_size > 1 ? m_probs[chosen] / m_probSum : 1.f;
+    const float surprise = -std::log2(prob);
+    m_mirostatMu -= m_params.mirostatEta * (surprise - m_params.mirostatTau);
+  }
+  const int token = m_ids[chosen];
+  m_penalties.update(token, m_params.penaltyDecay);
+  return token;
+}
+
+void sampler::LogitsProcessor::applyPointwise(unsigned flags, float biasScale, float penaltyScale) {
+  const float presence  = m_params.presencePenalty;
+  const float frequency = m_params.frequencyPenalty;
+  size_t kept           = 0;
+  for (size_t i = 0; i < m_size; i++) {
+    const int token = m_ids[i];
+    if ((flags & kBan) && isBanned(token)) {
+      continue;
+    }
+    float logit = m_logits[i];
+    if (flags & kBias) {
+      logit += m_bias[token] * biasScale;
+    }
+    if (flags & kPenalties) {
+      logit -= m_penalties.penalty(token, presence, frequency) * penaltyScale;
+    }
+    m_ids[kept]    = token;
+    m_logits[kept] = logit;
+    kept++;
+  }
+  m_size     = kept;
+  m_hasProbs = false;
+  if (flags & (kBias | kPenalties)) {
+    m_sorted = false;
+  }
+}
+
+// temperature <= 0: keep the largest logit
+void sampler::LogitsProcessor::applyTemperature() {
+  if (!m_sorted) {
+    const size_t best = kernels::argmax(m_logits, m_size);
+    std::swap(m_ids[0], m_ids[best]);
+    std::swap(m_logits[0], m_logits[best]);
+  }
+  m_size     = 1;
+  m_sorted   = true;
+  m_hasProbs = false;
+}
+
+void sampler::LogitsProcessor::applyTopK() {
+  if (m_params.topK <= 0 || static_cast<size_t>(m_params.topK) >= m_size) {
+    return;
+  }
+  const size_t k = m_params.topK;
+  if (m_sorted || std::is_sorted(m_logits, m_logits + m_size, std::greater<float>())) {
+    m_sorted = true;
+    truncate(k);
+    return;
+  }
+  kernels::topK(m_index.data(), m_logits, m_size, k);
+  gather(k);
+  m_sorted = true;
+}
+
+// Cuts after the most probable candidates whose mass reaches topP. Unsorted
+// candidates are not sorted as a whole: the selection grows from kTopPChunk
+// until the mass is reached.
+void sampler::LogitsProcessor::applyTopP() {
+  if (m_params.topP >= 1 || m_size <= 1) {
+    return;
+  }
+  softmax();
+  const float limit = m_params.topP * m_probSum;
+  if (!m_sorted && std::is_sorted(m_logits, m_logits + m_size, std::greater<float>())) {
+    m_sorted = true;
+  }
+  if (m_sorted) {
+    float cumsum = 0;
+    for (size_t i = 0; i < m_size; i++) {
+      cumsum += m_probs[i];
+      if (cumsum >= limit) {
+        truncate(i + 1);
+        return;
+      }
+    }
+    return;
+  }
+  for (size_t selected = m_size < kTopPChunk ? m_size : kTopPChunk;; selected = std::min(selected * 8, m_size)) {
+    kernels::topK(m_index.data(), m_logits, m_size, selected);
+    float cumsum = 0;
+    size_t kept  = selected;
+    for (size_t i = 0; i < selected; i++) {
+      cumsum += m_probs[m_index[i]];
+      if (cumsum >= limit) {
+        kept = i + 1;
+        break;
+      }
+    }
+    if (kept < selected || selected == m_size) {
+      gather(kept);
+      m_sorted = true;
+      return;
+    }
+  }
+}
+
+// p >= minP * pmax is logit >= maxLogit + log(minP) / scale, so this needs
+// neither the probabilities nor the order
+void sampler::LogitsProcessor::applyMinP() {
+  if (m_params.minP <= 0 || m_size <= 1) {
+    return;
+  }
+  keepAbove(maxLogit() + std::log(m_params.minP) / m_scale);
+}
+
+// Locally typical sampling: keeps the candidates whose surprise is closest to
+// the entropy of the distribution until their mass reaches typicalP
+void sampler::LogitsProcessor::applyTypical() {
+  if (m_params.typicalP >= 1 || m_size <= 1) {
+    return;
+  }
+  softmax();
+  const float largest  = maxLogit();
+  const float logSum   = std::log(m_probSum);
+  float entropy        = 0;
+  for (size_t i = 0; i < m_size; i++) {
+    // m_probs[i] is exp((logit - maxLogit) * scale)
+    const float logProb = (m_logits[i] - largest) * m_scale - logSum;
+    m_scores[i]         = logProb;
+    entropy -= m_probs[i] / m_probSum * logProb;
+  }
+  for (size_t i = 0; i < m_size; i++) {
+    m_scores[i] = -std::fabs(m_scores[i] + entropy);
+  }
+  kernels::topK(m_index.data(), m_scores.data(), m_size, m_size);
+
+  const float limit = m_params.typicalP * m_probSum;
+  float cumsum      = 0;
+  size_t kept       = m_size;
+  for (size_t i = 0; i < m_size; i++) {
+    cumsum += m_probs[m_index[i]];
+    if (cumsum >= limit) {
+      kept = i + 1;
+      break;
+    }
+  }
+  gather(kept);
+  m_sorted = false;
+}
+
+// Mirostat v2: keeps the candidates with surprise -log2(p) up to mu, at least
+// the most probable one; mu moves toward tau with every drawn token
+void sampler::LogitsProcessor::applyMirostat() {
+  if (m_params.mirostatTau <= 0) {
+    return;
+  }
+  m_mirostat = true;
+  if (m_size <= 1) {
+    return;
+  }
+  softmax();
+  // p >= 2^-mu with p = exp((logit - maxLogit) * scale) / m_probSum
+  const float logLimit = std::log(m_probSum) - m_mirostatMu * std::log(2.f);
+  keepAbove(maxLogit() + std::min(logLimit, 0.f) / m_scale);
+}
+
+// Keeps the candidates with logit >= threshold, in order
+void sampler::LogitsProcessor::keepAbove(float threshold) {
+  size_t kept = 0;
+  for (size_t i = 0; i < m_size; i++) {
+    if (m_logits[i] >= threshold) {
+      m_ids[kept]    = m_ids[i];
+      m_logits[kept] = m_logits[i];
+      if (m_hasProbs) {
+        m_probs[kept] = m_probs[i];
+      }
+      kept++;
+    }
+  }
+  truncate(kept);
+}
+
+float sampler::LogitsProcessor::maxLogit() const {
+  return m_sorted ? m_logits[0] : m_logits[kernels::argmax(m_logits, m_size)];
+}
+
+// Unnormalized: m_probs[i] = exp((logit - maxLogit) * scale), summing to m_probSum
+void sampler::LogitsProcessor::softmax() {
+  if (m_hasProbs) {
+    return;
+  }
+  kernels::scaledExp(m_probs.data(), m_logits, maxLogit(), m_scale, m_size);
+  m_probSum = 0;
+  for (size_t i = 0; i < m_size; i++) {
+    m_probSum += m_probs[i];
+  }
+  m_hasProbs = true;
+}
+
+void sampler::LogitsProcessor::truncate(size_t size) {
+  m_size = size;
+  if (m_hasProbs) {
+    m_probSum = 0;
+    for (size_t i = 0; i < m_size; i++) {
+      m_probSum += m_probs[i];
+    }
+  }
+}
+
+// Reorders the candidates to m_index[0..size)
+void sampler::LogitsProcessor::gather(size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    m_scratchIds[i]    = m_ids[m_index[i]];
+    m_scratchLogits[i] = m_logits[m_index[i]];
+  }
+  std::copy(m_scratchIds.begin(), m_scratchIds.begin() + size, m_ids);
+  std::copy(m_scratchLogits.begin(), m_scratchLogits.begin() + size, m_logits);
+  if (m_hasProbs) {
+    for (size_t i = 0; i < size; i++) {
+      m_scratchProbs[i] = m_probs[m_index[i]];
+    }
+    std::copy(m_scratchProbs.begin(), m_scratchProbs.begin() + size, m_probs.begin());
+  }
+  truncate(size);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "PenaltyTable.hpp"
+
+namespace qnn {
+namespace tools {
+namespace sampler {
+
+enum class Stage { Bias, Ban, Penalties, Temperature, TopK, TopP, MinP, Typical, Mirostat };
+
+// Neutral values disable a stage: topK <= 0, topP >= 1, minP <= 0, typicalP >= 1,
+// mirostatTau <= 0. temperature <= 0 is greedy.
+struct SamplingParams {
+  float temperature      = 1.f;
+  int topK               = 0;
+  float topP             = 1.f;
+  float minP             = 0.f;
+  float typicalP         = 1.f;
+  float presencePenalty  = 0.f;
+  float frequencyPenalty = 0.f;
+  float penaltyDecay     = 1.f;
+  float mirostatTau      = 0.f;  // target surprise in bits
+  float mirostatEta      = 0.1f;
+};
+
+// Runs a chain of stages over one candidate buffer (token ids and logits, e.g.
+// from QnnRwkvGetOutputTopK) and draws a token from what is left. The buffer is
+// filtered in place and shrinks as it goes, so later stages only see the
+// survivors of earlier ones.
+//
+// Bias, ban and penalties are fused into one pass over the candidates; the
+// temperature is a scale carried along and folded into the next softmax, and
+// min-p compares logits against a threshold, so neither exponentiates anything.
+// Probabilities are computed once and kept aligned with the candidates until a
+// stage changes the logits or their scale.
+//
+// Penalty counts and the mirostat target are per instance and updated with the
+// drawn token; reset() starts them over.
+class LogitsProcessor {
+ public:
+  explicit LogitsProcessor(size_t vocabSize, uint64_t seed = std::random_device()());
+
+  void seed(uint64_t seed) { m_rng.seed(seed); }
+
+  void setParams(const SamplingParams &params);
+
+  const SamplingParams &params() const { return m_params; }
+
+  // Stages run in the given order; the default is bias, ban, penalties, top-k,
+  // typical, top-p, min-p, temperature, mirostat.
+  void setChain(const Stage *stages, size_t count);
+
+  // Added to the token's logit; 0 removes the bias
+  void setBias(int token, float bias);
+
+  void clearBias();
+
+  void setBanned(int token, bool banned);
+
+  void clearBanned();
+
+  void reset();
+
+  // How many of the largest logits sample() needs to see to give the same
+  // result as with the whole vocabulary
+  size_t numCandidates() const;
+
+  // Filters ids/logits (ids below vocabSize, size at most vocabSize) in place and
+  // returns the drawn token, or -1 if every candidate was banned
+  int sample(int *ids, float *logits, size_t size);
+
+ private:
+  enum PointwiseFlags { kBias = 1, kBan = 2, kPenalties = 4 };
+
+  static const size_t kTopPChunk = 256;
+
+  // uniform in (0, 1)
+  float uniform() { return ((m_rng() >> 40) + 0.5f) * (1.f / (1 << 24)); }
+
+  bool isBanned(int token) const { return (m_banned[token >> 6] >> (token & 63)) & 1; }
+
+  void applyPointwise(unsigned flags, float biasScale, float penaltyScale);
+
+  void applyTemperature();
+
+  void applyTopK();
+
+  void applyTopP();
+
+  void applyMinP();
+
+  void applyTypical();
+
+  void applyMirostat();
+
+  void keepAbove(float threshold);
+
+  float maxLogit() const;
+
+  void softmax();
+
+  void truncate(size_t size);
+
+  void gather(size_t size);
+
+  size_t m_vocabSize;
+  SamplingParams m_params;
+  std::vector<Stage> m_chain;
+  std::mt19937_64 m_rng;
+
+  std::vector<float> m_bias;
+  std::vector<int32_t> m_biasTokens;
+  std::vector<uint64_t> m_banned;
+  size_t m_numBanned = 0;
+  PenaltyTable m_penalties;
+  float m_mirostatMu = 0.f;
+
+  // the candidate buffer of the current sample() call
+  int *m_ids       = nullptr;
+  float *m_logits  = nullptr;
+  size_t m_size    = 0;
+  float m_scale    = 1.f;  // inverse temperature applied so far
+  bool m_sorted    = false;
+  bool m_hasProbs  = false;
+  bool m_mirostat  = false;
+  float m_probSum  = 0.f;
+
+  std::vector<float> m_probs;
+  std::vector<int32_t> m_index;
+  std::vector<int> m_scratchIds;
+  std::vector<float> m_scratchLogits;
+  std::vector<float> m_scratchProbs;
+  std::vector<float> m_scores;
+};
+
+}  // namespace sampler
+}  // namespace tools
+}  // namespace qnn
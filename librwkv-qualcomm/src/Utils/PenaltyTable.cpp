@@ -0,0 +1,71 @@
+#include "PenaltyTable.hpp"
+
+using namespace qnn::tools;
+
+// Below this the stored counts (up to about 1 / scale per step) are folded back
+// so that they stay far from the float range
+static const float kRenormalizeScale = 1e-12f;
+
+sampler::PenaltyTable::PenaltyTable(size_t vocabSize) : m_slot(vocabSize, -1) {
+  m_tokens.reserve(vocabSize);
+  m_counts.reserve(vocabSize);
+  m_penalties.reserve(vocabSize);
+}
+
+void sampler::PenaltyTable::reset() {
+  for (int32_t token : m_tokens) {
+    m_slot[token] = -1;
+  }
+  m_tokens.clear();
+  m_counts.clear();
+  m_scale = 1.f;
+}
+
+void sampler::PenaltyTable::apply(float *logits, float presence, float frequency) {
+  const size_t n    = m_tokens.size();
+  const float scale = frequency * m_scale;
+  m_penalties.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    m_penalties[i] = m_counts[i] * scale + presence;
+  }
+  for (size_t i = 0; i < n; i++) {
+    logits[m_tokens[i]] -= m_penalties[i];
+  }
+}
+
+void sampler::PenaltyTable::apply(
+    const int *ids, float *logits, size_t size, float presence, float frequency) const {
+  const float scale = frequency * m_scale;
+  for (size_t i = 0; i < size; i++) {
+    int32_t slot = m_slot[ids[i]];
+    if (slot >= 0) {
+      logits[i] -= m_counts[slot] * scale + presence;
+    }
+  }
+}
+
+void sampler::PenaltyTable::update(int token, float decay) {
+  m_scale *= decay;
+  if (m_scale < kRenormalizeScale) {
+    renormalize();
+  }
+  int32_t &slot = m_slot[token];
+  if (slot < 0) {
+    slot = static_cast<int32_t>(m_tokens.size());
+    m_tokens.push_back(token);
+    m_counts.push_back(0.f);
+  }
+  m_counts[slot] += 1.f / m_scale;
+}
+
+float sampler::PenaltyTable::count(int token) const {
+  int32_t slot = m_slot[token];
+  return slot < 0 ? 0.f : m_counts[slot] * m_scale;
+}
+
+void sampler::PenaltyTable::renormalize() {
+  for (float &count : m_counts) {
+    count *= m_scale;
+  }
+  m_scale = 1.f;
+}
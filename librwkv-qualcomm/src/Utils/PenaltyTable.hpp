@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace qnn {
+namespace tools {
+namespace sampler {
+
+// Presence / frequency penalties over a dense vocabulary-sized table. Counts
+// decay by a factor each step; instead of touching every count, the decay is
+// folded into one scale factor and the stored counts are count / scale. When
+// the scale gets small the counts are renormalized once.
+//
+// Tokens seen since reset are kept in a compact list with their stored counts
+// alongside, so applying penalties is one contiguous multiply-add over the
+// list and a scatter into the logits.
+class PenaltyTable {
+ public:
+  explicit PenaltyTable(size_t vocabSize);
+
+  void reset();
+
+  // logits[t] -= frequency * count(t) + presence for every token seen since reset
+  void apply(float *logits, float presence, float frequency);
+
+  // The same for candidate tokens ids[i] with logits[i]
+  void apply(const int *ids, float *logits, size_t size, float presence, float frequency) const;
+
+  // frequency * count(token) + presence, or 0 for a token not seen since reset
+  float penalty(int token, float presence, float frequency) const {
+    int32_t slot = m_slot[token];
+    return slot < 0 ? 0.f : m_counts[slot] * m_scale * frequency + presence;
+  }
+
+  // Decays all counts by decay, then counts token once
+  void update(int token, float decay);
+
+  float count(int token) const;
+
+  size_t numTokens() const { return m_tokens.size(); }
+
+ private:
+  void renormalize();
+
+  std::vector<int32_t> m_slot;    // token -> index in m_tokens, or -1
+  std::vector<int32_t> m_tokens;  // tokens seen since reset
+  std::vector<float> m_counts;    // count / m_scale, parallel to m_tokens
+  std::vector<float> m_penalties;
+  float m_scale = 1.f;            // product of the decays since the last renormalization
+};
+
+}  // namespace sampler
+}  // namespace tools
+}  // namespace qnn
@@ -0,0 +1,104 @@
+#include "PrefixCache.hpp"
+
+using namespace qnn::tools;
+
+prefixcache::PrefixCache::PrefixCache(size_t stride, size_t maxBytes)
+    : m_stride(stride), m_maxBytes(maxBytes) {
+  m_nodes.emplace_back();
+}
+
+uint32_t prefixcache::PrefixCache::newNode(uint32_t parent, int token) {
+  uint32_t idx;
+  if (!m_freeNodes.empty()) {
+    idx = m_freeNodes.back();
+    m_freeNodes.pop_back();
+    m_nodes[idx] = Node();
+  } else {
+    idx = m_nodes.size();
+    m_nodes.emplace_back();
+  }
+  m_nodes[idx].parent = parent;
+  m_nodes[idx].token  = token;
+  m_nodes[parent].children[token] = idx;
+  return idx;
+}
+
+size_t prefixcache::PrefixCache::lookup(const int *tokens, size_t length, const std::vector<uint8_t> **state) {
+  uint32_t node    = 0;
+  size_t matched   = 0;
+  uint32_t matchedNode = 0;
+  for (size_t i = 0; i < length; i++) {
+    auto it = m_nodes[node].children.find(tokens[i]);
+    if (it == m_nodes[node].children.end()) {
+      break;
+    }
+    node = it->second;
+    if (m_nodes[node].hasEntry) {
+      matched     = i + 1;
+      matchedNode = node;
+    }
+  }
+
+  if (0 == matched) {
+    m_stats.misses++;
+    return 0;
+  }
+  m_lru.splice(m_lru.begin(), m_lru, m_nodes[matchedNode].entry);
+  *state = &m_nodes[matchedNode].entry->state;
+  m_stats.hits++;
+  m_stats.reusedTokens += matched;
+  return matched;
+}
+
+void prefixcache::PrefixCache::insert(const int *tokens, size_t length, std::vector<uint8_t> &&state) {
+  if (0 == length || state.size() > m_maxBytes) {
+    return;
+  }
+  uint32_t node = 0;
+  for (size_t i = 0; i < length; i++) {
+    auto it = m_nodes[node].children.find(tokens[i]);
+    node = (it == m_nodes[node].children.end()) ? newNode(node, tokens[i]) : it->second;
+  }
+
+  if (m_nodes[node].hasEntry) {
+    m_stats.bytes -= m_nodes[node].entry->state.size();
+    m_nodes[node].entry->state = std::move(state);
+    m_lru.splice(m_lru.begin(), m_lru, m_nodes[node].entry);
+  } else {
+    m_lru.push_front(Entry{node, std::move(state)});
+    m_nodes[node].hasEntry = true;
+    m_nodes[node].entry    = m_lru.begin();
+    m_stats.entries++;
+  }
+  m_stats.bytes += m_lru.front().state.size();
+
+  while (m_stats.bytes > m_maxBytes) {
+    evictLast();
+  }
+}
+
+// Drops the least recently used snapshot and prunes the trie path that only led to it.
+void prefixcache::PrefixCache::evictLast() {
+  uint32_t node = m_lru.back().node;
+  m_stats.bytes -= m_lru.back().state.size();
+  m_stats.entries--;
+  m_stats.evictions++;
+  m_lru.pop_back();
+  m_nodes[node].hasEntry = false;
+
+  while (node != 0 && !m_nodes[node].hasEntry && m_nodes[node].children.empty()) {
+    uint32_t parent = m_nodes[node].parent;
+    m_nodes[parent].children.erase(m_nodes[node].token);
+    m_freeNodes.push_back(node);
+    node = parent;
+  }
+}
+
+void prefixcache::PrefixCache::clear() {
+  m_lru.clear();
+  m_nodes.clear();
+  m_freeNodes.clear();
+  m_nodes.emplace_back();
+  m_stats.entries = 0;
+  m_stats.bytes   = 0;
+}
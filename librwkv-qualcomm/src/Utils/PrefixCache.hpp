@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace qnn {
+namespace tools {
+namespace prefixcache {
+
+struct Stats {
+  uint64_t hits         = 0;
+  uint64_t misses       = 0;
+  uint64_t reusedTokens = 0;
+  uint64_t evictions    = 0;
+  size_t entries        = 0;
+  size_t bytes          = 0;
+};
+
+// Trie over token ids whose nodes may hold a state snapshot taken after the
+// tokens on the path from the root. Snapshots are evicted in LRU order once
+// the total snapshot size exceeds the byte budget.
+class PrefixCache {
+ public:
+  PrefixCache(size_t stride, size_t maxBytes);
+
+  // Returns the length of the longest cached prefix of tokens[0, length), 0 if none.
+  // *state points to its snapshot and stays valid until the next insert/clear.
+  size_t lookup(const int *tokens, size_t length, const std::vector<uint8_t> **state);
+
+  void insert(const int *tokens, size_t length, std::vector<uint8_t> &&state);
+
+  bool isStridePoint(size_t length) const { return m_stride > 0 && length > 0 && length % m_stride == 0; }
+
+  size_t stride() const { return m_stride; }
+
+  void clear();
+
+  const Stats &stats() const { return m_stats; }
+
+ private:
+  struct Entry {
+    uint32_t node;
+    std::vector<uint8_t> state;
+  };
+
+  struct Node {
+    std::unordered_map<int, uint32_t> children;
+    uint32_t parent = 0;
+    int token       = 0;
+    bool hasEntry   = false;
+    std::list<Entry>::iterator entry;
+  };
+
+  uint32_t newNode(uint32_t parent, int token);
+  void evictLast();
+
+  size_t m_stride;
+  size_t m_maxBytes;
+  std::vector<Node> m_nodes;  // m_nodes[0] is the root
+  std::vector<uint32_t> m_freeNodes;
+  std::list<Entry> m_lru;  // most recently used first
+  Stats m_stats;
+};
+
+}  // namespace prefixcache
+}  // namespace tools
+}  // namespace qnn
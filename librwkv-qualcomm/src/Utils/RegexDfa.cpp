@@ -0,0 +1,691 @@
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <map>
+#include <set>
+
+#include "RegexDfa.hpp"
+
+using namespace qnn::tools;
+
+namespace {
+
+const int kMaxRepeat         = 1000;
+const size_t kMaxNfaSize     = 1 << 20;
+const size_t kMaxDfaSize     = 1 << 14;
+const size_t kMaxGrammarSize = 1 << 20;  // expanded pattern bytes
+const int kMaxNesting        = 200;      // groups and stacked quantifiers
+
+typedef std::bitset<256> ByteSet;
+
+struct Node {
+  enum Kind { Bytes, Concat, Alt, Repeat };
+  Kind kind;
+  ByteSet bytes;
+  std::vector<int> children;
+  int min = 1;
+  int max = 1;  // -1: unbounded
+};
+
+// Recursive descent over the pattern into a tree of Nodes
+class Parser {
+ public:
+  explicit Parser(const std::string &pattern) : m_pattern(pattern) {}
+
+  bool parse(std::vector<Node> &nodes, int *root, std::string *error) {
+    m_nodes = &nodes;
+    *root   = parseAlt();
+    if (m_error.empty() && m_pos < m_pattern.size()) {
+      fail("unbalanced ')'");
+    }
+    if (!m_error.empty()) {
+      *error = m_error + " at offset " + std::to_string(m_pos);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  bool atEnd() const { return m_pos >= m_pattern.size(); }
+
+  uint8_t peek() const { return m_pattern[m_pos]; }
+
+  int fail(const std::string &message) {
+    if (m_error.empty()) {
+      m_error = message;
+    }
+    return -1;
+  }
+
+  int add(Node::Kind kind) {
+    m_nodes->push_back(Node());
+    m_nodes->back().kind = kind;
+    return static_cast<int>(m_nodes->size() - 1);
+  }
+
+  int parseAlt() {
+    int first = parseConcat();
+    if (atEnd() || peek() != '|') {
+      return first;
+    }
+    int alt = add(Node::Alt);
+    (*m_nodes)[alt].children.push_back(first);
+    while (!atEnd() && peek() == '|') {
+      m_pos++;
+      int branch = parseConcat();
+      (*m_nodes)[alt].children.push_back(branch);
+    }
+    return alt;
+  }
+
+  int parseConcat() {
+    int concat = add(Node::Concat);
+    while (m_error.empty() && !atEnd() && peek() != '|' && peek() != ')') {
+      int item = parseRepeat();
+      (*m_nodes)[concat].children.push_back(item);
+    }
+    return concat;
+  }
+
+  int parseRepeat() {
+    int item    = parseAtom();
+    int stacked = 0;
+    while (m_error.empty() && !atEnd()) {
+      int min = 0, max = -1;
+      switch (peek()) {
+        case '*':
+          m_pos++;
+          break;
+        case '+':
+          min = 1;
+          m_pos++;
+          break;
+        case '?':
+          max = 1;
+          m_pos++;
+          break;
+        case '{':
+          if (!parseBounds(&min, &max)) {
+            return -1;
+          }
+          break;
+        default:
+          return item;
+      }
+      // each quantifier nests the item one level deeper for the NFA construction
+      if (m_depth + ++stacked > kMaxNesting) {
+        return fail("nested deeper than " + std::to_string(kMaxNesting));
+      }
+      int repeat                  = add(Node::Repeat);
+      (*m_nodes)[repeat].min      = min;
+      (*m_nodes)[repeat].max      = max;
+      (*m_nodes)[repeat].children = {item};
+      item                        = repeat;
+    }
+    return item;
+  }
+
+  bool parseNumber(int *value) {
+    if (atEnd() || !isdigit(peek())) {
+      return false;
+    }
+    *value = 0;
+    while (!atEnd() && isdigit(peek())) {
+      *value = *value * 10 + (peek() - '0');
+      if (*value > kMaxRepeat) {
+        fail("repeat count over " + std::to_string(kMaxRepeat));
+        return false;
+      }
+      m_pos++;
+    }
+    return true;
+  }
+
+  // {n}, {n,} or {n,m}
+  bool parseBounds(int *min, int *max) {
+    m_pos++;
+    if (!parseNumber(min)) {
+      fail("bad repeat bounds");
+      return false;
+    }
+    *max = *min;
+    if (!atEnd() && peek() == ',') {
+      m_pos++;
+      *max = -1;
+      if (!atEnd() && peek() != '}' && !parseNumber(max)) {
+        fail("bad repeat bounds");
+        return false;
+      }
+    }
+    if (atEnd() || peek() != '}' || (*max >= 0 && *max < *min)) {
+      fail("bad repeat bounds");
+      return false;
+    }
+    m_pos++;
+    return true;
+  }
+
+  int parseAtom() {
+    const uint8_t c = peek();
+    if (c == '(') {
+      m_pos++;
+      if (m_pattern.compare(m_pos, 2, "?:") == 0) {
+        m_pos += 2;
+      }
+      // the parser and the NFA construction both recurse per level
+      if (++m_depth > kMaxNesting) {
+        return fail("nested deeper than " + std::to_string(kMaxNesting));
+      }
+      int group = parseAlt();
+      m_depth--;
+      if (atEnd() || peek() != ')') {
+        return fail("missing ')'");
+      }
+      m_pos++;
+      return group;
+    }
+    if (c == '*' || c == '+' || c == '?' || c == '{') {
+      return fail("nothing to repeat");
+    }
+    if (c == '^' || c == '$') {
+      return fail("anchors are implicit");
+    }
+    int bytes = add(Node::Bytes);
+    ByteSet set;
+    if (c == '[') {
+      m_pos++;
+      parseClass(&set);
+    } else if (c == '.') {
+      m_pos++;
+      set.set();
+      set.reset('\n');
+    } else if (c == '\\') {
+      m_pos++;
+      parseEscape(&set);
+    } else {
+      m_pos++;
+      set.set(c);
+    }
+    (*m_nodes)[bytes].bytes = set;
+    return bytes;
+  }
+
+  void parseClass(ByteSet *set) {
+    const bool negate = !atEnd() && peek() == '^';
+    if (negate) {
+      m_pos++;
+    }
+    bool first = true;
+    while (m_error.empty() && !atEnd() && (peek() != ']' || first)) {
+      first = false;
+      ByteSet item;
+      int low = -1;
+      if (peek() == '\\') {
+        m_pos++;
+        low = parseEscape(&item);
+      } else {
+        low = peek();
+        item.set(low);
+        m_pos++;
+      }
+      // a range needs single bytes on both ends
+      if (low >= 0 && m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']') {
+        m_pos++;
+        ByteSet unused;
+        int high = -1;
+        if (peek() == '\\') {
+          m_pos++;
+          high = parseEscape(&unused);
+        } else {
+          high = peek();
+          m_pos++;
+        }
+        if (high < low) {
+          fail("bad class range");
+          return;
+        }
+        for (int b = low; b <= high; b++) {
+          item.set(b);
+        }
+      }
+      *set |= item;
+    }
+    if (atEnd()) {
+      fail("missing ']'");
+      return;
+    }
+    m_pos++;
+    if (negate) {
+      set->flip();
+    }
+  }
+
+  // Returns the byte for a single-byte escape, -1 for a class escape
+  int parseEscape(ByteSet *set) {
+    if (atEnd()) {
+      return fail("trailing '\\'");
+    }
+    const uint8_t c = peek();
+    m_pos++;
+    int byte = -1;
+    switch (c) {
+      case 'd':
+      case 'D':
+        for (int b = '0'; b <= '9'; b++) {
+          set->set(b);
+        }
+        break;
+      case 'w':
+      case 'W':
+        for (int b = 0; b < 128; b++) {
+          if (isalnum(b) || b == '_') {
+            set->set(b);
+          }
+        }
+        break;
+      case 's':
+      case 'S':
+        for (char b : std::string(" \t\n\r\f\v")) {
+          set->set(static_cast<uint8_t>(b));
+        }
+        break;
+      case 'n':
+        byte = '\n';
+        break;
+      case 'r':
+        byte = '\r';
+        break;
+      case 't':
+        byte = '\t';
+        break;
+      case 'f':
+        byte = '\f';
+        break;
+      case 'v':
+        byte = '\v';
+        break;
+      case 'x': {
+        if (m_pos + 2 > m_pattern.size() || !isxdigit(m_pattern[m_pos]) || !isxdigit(m_pattern[m_pos + 1])) {
+          return fail("bad \\x escape");
+        }
+        byte = std::stoi(m_pattern.substr(m_pos, 2), nullptr, 16);
+        m_pos += 2;
+        break;
+      }
+      default:
+        if (isalnum(c)) {
+          return fail(std::string("unknown escape \\") + static_cast<char>(c));
+        }
+        byte = c;
+        break;
+    }
+    if (c == 'D' || c == 'W' || c == 'S') {
+      set->flip();
+    }
+    if (byte >= 0) {
+      set->set(byte);
+    }
+    return byte;
+  }
+
+  const std::string &m_pattern;
+  size_t m_pos = 0;
+  int m_depth  = 0;
+  std::vector<Node> *m_nodes;
+  std::string m_error;
+};
+
+// Thompson construction: every state has either epsilon edges or one byte-set
+// edge to `next`
+struct Nfa {
+  struct State {
+    std::vector<int> epsilon;
+    int set  = -1;
+    int next = -1;
+  };
+
+  std::vector<State> states;
+  std::vector<ByteSet> sets;
+
+  int addState() {
+    states.push_back(State());
+    return static_cast<int>(states.size() - 1);
+  }
+
+  // Builds the fragment for nodes[id] from `from`, returning its end state or -1
+  // once the automaton gets too large
+  int build(const std::vector<Node> &nodes, int id, int from) {
+    if (from < 0 || states.size() > kMaxNfaSize) {
+      return -1;
+    }
+    const Node &node = nodes[id];
+    switch (node.kind) {
+      case Node::Bytes: {
+        int to              = addState();
+        states[from].set    = static_cast<int>(sets.size());
+        states[from].next   = to;
+        sets.push_back(node.bytes);
+        return to;
+      }
+      case Node::Concat:
+        for (int child : node.children) {
+          int start = addState();
+          states[from].epsilon.push_back(start);
+          from = build(nodes, child, start);
+          if (from < 0) {
+            return -1;
+          }
+        }
+        return from;
+      case Node::Alt: {
+        int to = addState();
+        for (int child : node.children) {
+          int start = addState();
+          states[from].epsilon.push_back(start);
+          int end = build(nodes, child, start);
+          if (end < 0) {
+            return -1;
+          }
+          states[end].epsilon.push_back(to);
+        }
+        return to;
+      }
+      case Node::Repeat: {
+        int child = node.children[0];
+        for (int i = 0; i < node.min; i++) {
+          from = build(nodes, child, from);
+          if (from < 0) {
+            return -1;
+          }
+        }
+        int to = addState();
+        if (node.max < 0) {
+          int loop = addState();
+          states[from].epsilon.push_back(loop);
+          states[loop].epsilon.push_back(to);
+          int end = build(nodes, child, loop);
+          if (end < 0) {
+            return -1;
+          }
+          states[end].epsilon.push_back(loop);
+          return to;
+        }
+        for (int i = node.min; i < node.max; i++) {
+          states[from].epsilon.push_back(to);
+          from = build(nodes, child, from);
+          if (from < 0) {
+            return -1;
+          }
+        }
+        states[from].epsilon.push_back(to);
+        return to;
+      }
+    }
+    return -1;
+  }
+
+  void closure(std::vector<int> &set, std::vector<char> &seen) const {
+    std::vector<int> stack(set);
+    for (int state : set) {
+      seen[state] = 1;
+    }
+    while (!stack.empty()) {
+      int state = stack.back();
+      stack.pop_back();
+      for (int next : states[state].epsilon) {
+        if (!seen[next]) {
+          seen[next] = 1;
+          set.push_back(next);
+          stack.push_back(next);
+        }
+      }
+    }
+    for (int state : set) {
+      seen[state] = 0;
+    }
+    std::sort(set.begin(), set.end());
+  }
+};
+
+// Replaces <name> references with the referenced rule body in parentheses. Inside
+// a [...] class the brackets are literal bytes, as for the parser.
+bool expandRule(const std::map<std::string, std::string> &rules,
+                const std::string &name,
+                std::set<std::string> &active,
+                std::string *out,
+                std::string *error) {
+  auto rule = rules.find(name);
+  if (rule == rules.end()) {
+    *error = "undefined rule " + name;
+    return false;
+  }
+  if (!active.insert(name).second) {
+    *error = "rule " + name + " is recursive";
+    return false;
+  }
+  // every reference becomes a group, which the parser would reject anyway
+  if (active.size() > static_cast<size_t>(kMaxNesting)) {
+    *error = "rules nested deeper than " + std::to_string(kMaxNesting);
+    return false;
+  }
+  const std::string &body = rule->second;
+  bool inClass = false;
+  for (size_t i = 0; i < body.size(); i++) {
+    // each rule may refer to the previous one several times, doubling the size
+    if (out->size() > kMaxGrammarSize) {
+      *error = "grammar expands to over " + std::to_string(kMaxGrammarSize) + " bytes";
+      return false;
+    }
+    if (body[i] == '\\' && i + 1 < body.size()) {
+      out->append(body, i, 2);
+      i++;
+      continue;
+    }
+    if (inClass) {
+      inClass = body[i] != ']';
+      out->push_back(body[i]);
+      continue;
+    }
+    if (body[i] == '[') {
+      // a ']' right after "[" or "[^" belongs to the class
+      out->push_back(body[i]);
+      if (i + 1 < body.size() && body[i + 1] == '^') {
+        out->push_back(body[++i]);
+      }
+      if (i + 1 < body.size() && body[i + 1] == ']') {
+        out->push_back(body[++i]);
+      }
+      inClass = true;
+      continue;
+    }
+    size_t close = body.find('>', i);
+    if (body[i] == '<' && close != std::string::npos && close > i + 1 &&
+        std::all_of(body.begin() + i + 1, body.begin() + close, [](char c) {
+          return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+        })) {
+      out->push_back('(');
+      if (!expandRule(rules, body.substr(i + 1, close - i - 1), active, out, error)) {
+        return false;
+      }
+      out->push_back(')');
+      i = close;
+      continue;
+    }
+    out->push_back(body[i]);
+  }
+  active.erase(name);
+  return true;
+}
+
+}  // namespace
+
+bool constraint::Dfa::compileRegex(const std::string &pattern, std::string *error) {
+  std::string message;
+  std::vector<Node> nodes;
+  int root = -1;
+  if (!Parser(pattern).parse(nodes, &root, &message)) {
+    if (error) {
+      *error = message;
+    }
+    return false;
+  }
+
+  Nfa nfa;
+  const int nfaStart  = nfa.addState();
+  const int nfaAccept = nfa.build(nodes, root, nfaStart);
+  if (nfaAccept < 0) {
+    if (error) {
+      *error = "pattern too large";
+    }
+    return false;
+  }
+
+  // Subset construction
+  std::vector<char> seen(nfa.states.size(), 0);
+  std::map<std::vector<int>, int32_t> ids;
+  std::vector<std::vector<int>> subsets(1, std::vector<int>{nfaStart});
+  nfa.closure(subsets[0], seen);
+  ids[subsets[0]] = 0;
+  std::vector<int32_t> transitions;
+  std::vector<bool> accepting;
+  for (size_t current = 0; current < subsets.size(); current++) {
+    if (subsets.size() > kMaxDfaSize) {
+      if (error) {
+        *error = "pattern needs too many states";
+      }
+      return false;
+    }
+    transitions.resize((current + 1) * 256, -1);
+    accepting.push_back(std::binary_search(subsets[current].begin(), subsets[current].end(), nfaAccept));
+    std::vector<int> targets[256];
+    for (int state : subsets[current]) {
+      const Nfa::State &s = nfa.states[state];
+      if (s.set < 0) {
+        continue;
+      }
+      const ByteSet &set = nfa.sets[s.set];
+      for (int b = 0; b < 256; b++) {
+        if (set[b]) {
+          targets[b].push_back(s.next);
+        }
+      }
+    }
+    for (int b = 0; b < 256; b++) {
+      if (targets[b].empty()) {
+        continue;
+      }
+      std::sort(targets[b].begin(), targets[b].end());
+      targets[b].erase(std::unique(targets[b].begin(), targets[b].end()), targets[b].end());
+      nfa.closure(targets[b], seen);
+      auto inserted = ids.insert(std::make_pair(targets[b], static_cast<int32_t>(subsets.size())));
+      if (inserted.second) {
+        subsets.push_back(targets[b]);
+      }
+      transitions[current * 256 + b] = inserted.first->second;
+    }
+  }
+
+  // Keep the states a match is reachable from, renumbered in order so the start
+  // stays 0. One search back from the accepting states over the reversed edges.
+  const size_t numStates = accepting.size();
+  std::vector<std::vector<int32_t>> sources(numStates);
+  std::vector<int32_t> lastSource(numStates, -1);
+  for (size_t state = 0; state < numStates; state++) {
+    for (int b = 0; b < 256; b++) {
+      int32_t next = transitions[state * 256 + b];
+      if (next >= 0 && lastSource[next] != static_cast<int32_t>(state)) {
+        lastSource[next] = static_cast<int32_t>(state);
+        sources[next].push_back(static_cast<int32_t>(state));
+      }
+    }
+  }
+  std::vector<char> live(accepting.begin(), accepting.end());
+  std::vector<int32_t> queue;
+  for (size_t state = 0; state < numStates; state++) {
+    if (live[state]) {
+      queue.push_back(static_cast<int32_t>(state));
+    }
+  }
+  for (size_t head = 0; head < queue.size(); head++) {
+    for (int32_t source : sources[queue[head]]) {
+      if (!live[source]) {
+        live[source] = 1;
+        queue.push_back(source);
+      }
+    }
+  }
+  if (!live[0]) {
+    if (error) {
+      *error = "pattern matches nothing";
+    }
+    return false;
+  }
+  std::vector<int32_t> renumber(numStates, -1);
+  int32_t numLive = 0;
+  for (size_t state = 0; state < numStates; state++) {
+    if (live[state]) {
+      renumber[state] = numLive++;
+    }
+  }
+  m_transitions.assign(numLive * 256, -1);
+  m_accepting.assign(numLive, false);
+  for (size_t state = 0; state < numStates; state++) {
+    if (renumber[state] < 0) {
+      continue;
+    }
+    m_accepting[renumber[state]] = accepting[state];
+    for (int b = 0; b < 256; b++) {
+      int32_t next = transitions[state * 256 + b];
+      m_transitions[renumber[state] * 256 + b] = next >= 0 ? renumber[next] : -1;
+    }
+  }
+  return true;
+}
+
+bool constraint::Dfa::compileGrammar(const std::string &grammar, std::string *error) {
+  std::map<std::string, std::string> rules;
+  size_t lineStart = 0;
+  for (int line = 1; lineStart < grammar.size(); line++) {
+    size_t lineEnd = grammar.find('\n', lineStart);
+    if (lineEnd == std::string::npos) {
+      lineEnd = grammar.size();
+    }
+    std::string text = grammar.substr(lineStart, lineEnd - lineStart);
+    lineStart        = lineEnd + 1;
+    if (!text.empty() && text.back() == '\r') {
+      text.pop_back();
+    }
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos || text[first] == '#') {
+      continue;
+    }
+    size_t separator = text.find("::=");
+    if (separator == std::string::npos) {
+      if (error) {
+        *error = "line " + std::to_string(line) + ": expected name ::= pattern";
+      }
+      return false;
+    }
+    size_t nameEnd = text.find_last_not_of(" \t", separator - 1);
+    size_t body    = text.find_first_not_of(" \t", separator + 3);
+    size_t bodyEnd = text.find_last_not_of(" \t");
+    if (nameEnd == std::string::npos || nameEnd < first) {
+      if (error) {
+        *error = "line " + std::to_string(line) + ": missing rule name";
+      }
+      return false;
+    }
+    rules[text.substr(first, nameEnd - first + 1)] =
+        body == std::string::npos ? "" : text.substr(body, bodyEnd - body + 1);
+  }
+
+  std::string pattern, message;
+  std::set<std::string> active;
+  if (!expandRule(rules, "root", active, &pattern, &message)) {
+    if (error) {
+      *error = message;
+    }
+    return false;
+  }
+  return compileRegex(pattern, error);
+}
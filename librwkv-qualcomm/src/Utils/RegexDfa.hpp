@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace qnn {
+namespace tools {
+namespace constraint {
+
+// Byte-level DFA compiled from a regular expression, for constraining generated
+// text. The whole output has to match, so there are no anchors.
+//
+// Syntax: literals, `.` (any byte but '\n'), [...] and [^...] classes with
+// ranges, \d \D \w \W \s \S \n \r \t \xHH and escaped metacharacters, (...)
+// and (?:...) groups, |, and the * + ? {n} {n,} {n,m} quantifiers. Patterns are
+// matched byte by byte, so a UTF-8 literal is a sequence and a negated class
+// lets multi-byte characters through.
+//
+// A grammar is a list of `name ::= regex` lines whose bodies may refer to other
+// rules as <name>; the start rule is `root`. Blank lines and lines starting with
+// '#' are skipped, and whitespace around a body is not part of it. References
+// are expanded in place, so rules cannot be recursive and the language stays
+// regular, e.g. JSON with a bounded nesting depth is written as one rule per
+// level. Groups, stacked quantifiers and rule references nest at most 200 deep,
+// and a grammar may expand to at most 1MB of pattern.
+//
+// States that cannot reach a match are removed: every transition is either to a
+// state from which a match is still possible or -1.
+class Dfa {
+ public:
+  bool compileRegex(const std::string &pattern, std::string *error);
+
+  bool compileGrammar(const std::string &grammar, std::string *error);
+
+  int32_t start() const { return 0; }
+
+  int32_t next(int32_t state, uint8_t byte) const { return m_transitions[state * 256 + byte]; }
+
+  bool accepting(int32_t state) const { return m_accepting[state]; }
+
+  size_t numStates() const { return m_accepting.size(); }
+
+  // 256 next states per state
+  const int32_t *transitions() const { return m_transitions.data(); }
+
+ private:
+  std::vector<int32_t> m_transitions;
+  std::vector<bool> m_accepting;
+};
+
+}  // namespace constraint
+}  // namespace tools
+}  // namespace qnn
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "DataKernels.hpp"
+#include "Sampler.hpp"
+
+using namespace qnn::tools;
+using namespace qnn::tools::datautil;
+
+sampler::Sampler::Sampler(size_t vocabSize, uint64_t seed) : m_rng(seed) { reserve(vocabSize); }
+
+void sampler::Sampler::reserve(size_t size) {
+  if (m_index.size() < size) {
+    m_index.resize(size);
+    m_logits.resize(size);
+    m_probs.resize(size);
+  }
+}
+
+int sampler::Sampler::sample(const float *logits, size_t size, float temperature, int topK, float topP) {
+  return sample(nullptr, logits, size, temperature, topK, topP);
+}
+
+int sampler::Sampler::sample(
+    const int *ids, const float *logits, size_t size, float temperature, int topK, float topP) {
+  if (0 == size) {
+    return -1;
+  }
+  temperature = std::min(std::max(temperature, 0.1f), 5.f);
+  const size_t k = (topK < 0 || static_cast<size_t>(topK) > size) ? size : topK;
+  if (k <= 1) {
+    size_t best = kernels::argmax(logits, size);
+    return ids ? ids[best] : static_cast<int>(best);
+  }
+  reserve(size);
+  if (m_gumbelMax && topP >= 1.f) {
+    return drawGumbel(ids, logits, size, k, 1.f / temperature);
+  }
+
+  size_t len = 0;
+  if (k == size && size > kTopPChunk) {
+    len = selectTopPFull(logits, size, topP);
+  } else {
+    len = selectTopP(logits, size, k, topP);
+  }
+  for (size_t i = 0; i < len; i++) {
+    m_logits[i] = logits[m_index[i]];
+  }
+
+  // p^(1/T) renormalized is exp(logit / T) renormalized
+  kernels::scaledExp(m_probs.data(), m_logits.data(), m_logits[0], 1.f / temperature, len);
+  float cumsum = 0;
+  for (size_t i = 0; i < len; i++) {
+    cumsum += m_probs[i];
+  }
+
+  const float target = uniform() * cumsum;
+  size_t chosen      = len - 1;
+  cumsum             = 0;
+  for (size_t i = 0; i < len; i++) {
+    cumsum += m_probs[i];
+    if (cumsum > target) {
+      chosen = i;
+      break;
+    }
+  }
+  return ids ? ids[m_index[chosen]] : m_index[chosen];
+}
+
+// Sorts the top k into m_index and returns how many of them top-p keeps, with
+// the softmax at temperature 1 normalized over the k.
+size_t sampler::Sampler::selectTopP(const float *logits, size_t size, size_t k, float topP) {
+  kernels::topK(m_index.data(), logits, size, k);
+  for (size_t i = 0; i < k; i++) {
+    m_logits[i] = logits[m_index[i]];
+  }
+  kernels::scaledExp(m_probs.data(), m_logits.data(), m_logits[0], 1.f, k);
+  float sum = 0;
+  for (size_t i = 0; i < k; i++) {
+    sum += m_probs[i];
+  }
+  const float limit = topP * sum;
+  float cumsum      = 0;
+  for (size_t i = 0; i < k; i++) {
+    cumsum += m_probs[i];
+    if (cumsum >= limit) {
+      return i + 1;
+    }
+  }
+  return k;
+}
+
+// Without top-k the softmax is normalized over the whole vocabulary, but only as
+// many of the largest logits as top-p reaches need sorting: the selection grows
+// from kTopPChunk until the kept mass passes topP.
+size_t sampler::Sampler::selectTopPFull(const float *logits, size_t size, float topP) {
+  const float maxLogit = logits[kernels::argmax(logits, size)];
+  kernels::scaledExp(m_probs.data(), logits, maxLogit, 1.f, size);
+  float sum = 0;
+  for (size_t i = 0; i < size; i++) {
+    sum += m_probs[i];
+  }
+  const float limit = topP * sum;
+  for (size_t selected = kTopPChunk;; selected = std::min(selected * 8, size)) {
+    kernels::topK(m_index.data(), logits, size, selected);
+    float cumsum = 0;
+    for (size_t i = 0; i < selected; i++) {
+      cumsum += m_probs[m_index[i]];
+      if (cumsum >= limit) {
+        return i + 1;
+      }
+    }
+    if (selected == size) {
+      return size;
+    }
+  }
+}
+
+// argmax(logit / T + G) with G = -log(-log(U)) is distributed as softmax(logit / T)
+int sampler::Sampler::drawGumbel(
+    const int *ids, const float *logits, size_t size, size_t topK, float invTemperature) {
+  const bool selected = topK < size;
+  if (selected) {
+    kernels::topK(m_index.data(), logits, size, topK);
+  }
+  float bestScore = -std::numeric_limits<float>::infinity();
+  size_t best     = selected ? m_index[0] : 0;
+  for (size_t i = 0; i < topK; i++) {
+    size_t token = selected ? m_index[i] : i;
+    float score  = logits[token] * invTemperature - std::log(-std::log(uniform()));
+    if (score > bestScore) {
+      bestScore = score;
+      best      = token;
+    }
+  }
+  return ids ? ids[best] : static_cast<int>(best);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace qnn {
+namespace tools {
+namespace sampler {
+
+// Draws a token from logits with temperature, top-k and top-p. All workspaces
+// are sized for the vocabulary up front and reused, so sampling does not
+// allocate. Each instance has its own generator; the same seed and logits give
+// the same tokens.
+//
+// topK of 0 or 1 is greedy, a negative one keeps the whole vocabulary. Otherwise
+// the topK largest logits are selected before anything is exponentiated, top-p
+// is applied to their softmax at temperature 1, renormalized over the topK, and
+// the token is drawn from the remaining ones at the given temperature.
+// With Gumbel-max enabled and topP >= 1, the draw adds Gumbel noise to the
+// candidates' scaled logits and takes the maximum, so the candidates are never
+// sorted or normalized.
+class Sampler {
+ public:
+  explicit Sampler(size_t vocabSize, uint64_t seed = std::random_device()());
+
+  void seed(uint64_t seed) { m_rng.seed(seed); }
+
+  void setGumbelMax(bool enable) { m_gumbelMax = enable; }
+
+  // logits of the whole vocabulary
+  int sample(const float *logits, size_t size, float temperature, int topK, float topP);
+
+  // candidate tokens ids[i] with logits[i], e.g. from QnnRwkvGetOutputTopK
+  int sample(const int *ids, const float *logits, size_t size, float temperature, int topK, float topP);
+
+ private:
+  // uniform in (0, 1)
+  float uniform() { return ((m_rng() >> 40) + 0.5f) * (1.f / (1 << 24)); }
+
+  static const size_t kTopPChunk = 256;
+
+  void reserve(size_t size);
+
+  size_t selectTopP(const float *logits, size_t size, size_t k, float topP);
+
+  size_t selectTopPFull(const float *logits, size_t size, float topP);
+
+  int drawGumbel(const int *ids, const float *logits, size_t size, size_t topK, float invTemperature);
+
+  std::mt19937_64 m_rng;
+  bool m_gumbelMax = false;
+  std::vector<int32_t> m_index;
+  std::vector<float> m_logits;
+  std::vector<float> m_probs;
+};
+
+}  // namespace sampler
+}  // namespace tools
+}  // namespace qnn
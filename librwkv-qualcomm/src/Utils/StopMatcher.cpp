@@ -0,0 +1,100 @@
+#include "StopMatcher.hpp"
+
+using namespace qnn::tools;
+
+void textstream::StopMatcher::setPatterns(const std::vector<std::string> &patterns) {
+  // trie of the patterns, -1 for a missing edge
+  m_next.assign(256, -1);
+  m_matchLength.assign(1, 0);
+  m_matchPattern.assign(1, -1);
+  m_depth.assign(1, 0);
+  for (size_t p = 0; p < patterns.size(); p++) {
+    const std::string &pattern = patterns[p];
+    if (pattern.empty()) {
+      continue;
+    }
+    int32_t state = 0;
+    for (unsigned char byte : pattern) {
+      int32_t &next = m_next[state * 256 + byte];
+      if (next < 0) {
+        next = static_cast<int32_t>(m_depth.size());
+        m_depth.push_back(m_depth[state] + 1);
+        m_matchLength.push_back(0);
+        m_matchPattern.push_back(-1);
+        m_next.resize(m_next.size() + 256, -1);
+      }
+      state = m_next[state * 256 + byte];
+    }
+    if (m_matchPattern[state] < 0) {
+      m_matchLength[state]  = static_cast<uint32_t>(pattern.size());
+      m_matchPattern[state] = static_cast<int32_t>(p);
+    }
+  }
+
+  // breadth-first, so that the failure state of a state is complete before it;
+  // missing edges take the failure state's edge, making the table a full DFA
+  std::vector<int32_t> fail(m_depth.size(), 0);
+  std::vector<int32_t> queue;
+  queue.reserve(m_depth.size());
+  for (int byte = 0; byte < 256; byte++) {
+    int32_t &next = m_next[byte];
+    if (next < 0) {
+      next = 0;
+    } else {
+      queue.push_back(next);
+    }
+  }
+  for (size_t head = 0; head < queue.size(); head++) {
+    const int32_t state = queue[head];
+    if (0 == m_matchLength[state]) {
+      m_matchLength[state]  = m_matchLength[fail[state]];
+      m_matchPattern[state] = m_matchPattern[fail[state]];
+    }
+    for (int byte = 0; byte < 256; byte++) {
+      int32_t &next          = m_next[state * 256 + byte];
+      const int32_t fallback = m_next[fail[state] * 256 + byte];
+      if (next < 0) {
+        next = fallback;
+      } else {
+        fail[next] = fallback;
+        queue.push_back(next);
+      }
+    }
+  }
+  reset();
+}
+
+void textstream::StopMatcher::reset() {
+  m_state   = 0;
+  m_matched = -1;
+  m_held.clear();
+}
+
+bool textstream::StopMatcher::feed(const char *data, size_t size, std::string &out) {
+  if (m_matched >= 0) {
+    return true;
+  }
+  // m_held is always the last m_depth[m_state] bytes of the text
+  for (size_t i = 0; i < size; i++) {
+    m_held.push_back(data[i]);
+    m_state = m_next[m_state * 256 + static_cast<unsigned char>(data[i])];
+    if (m_matchLength[m_state] > 0) {
+      out.append(m_held, 0, m_held.size() - m_matchLength[m_state]);
+      m_held.clear();
+      m_matched = m_matchPattern[m_state];
+      return true;
+    }
+    const size_t release = m_held.size() - m_depth[m_state];
+    if (release > 0) {
+      out.append(m_held, 0, release);
+      m_held.erase(0, release);
+    }
+  }
+  return false;
+}
+
+void textstream::StopMatcher::flush(std::string &out) {
+  out += m_held;
+  m_held.clear();
+  m_state = 0;
+}
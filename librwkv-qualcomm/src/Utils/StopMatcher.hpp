@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace qnn {
+namespace tools {
+namespace textstream {
+
+// Finds any of a set of stop strings in streamed text. The strings are compiled
+// into an Aho-Corasick automaton over bytes with every transition resolved, so a
+// byte costs one table lookup however many strings there are.
+//
+// Text that may still turn out to be the start of a stop string is held back: at
+// most the longest stop string minus one byte, and only while a partial match is
+// pending. Everything else is passed through as soon as it is fed.
+class StopMatcher {
+ public:
+  StopMatcher() { setPatterns({}); }
+
+  // Empty strings are skipped
+  void setPatterns(const std::vector<std::string> &patterns);
+
+  void reset();
+
+  // Appends to out the bytes that can no longer be part of a stop string. Returns
+  // true once a stop string is complete, with out ending just before it; the rest
+  // of data is then dropped and further calls do nothing until reset().
+  bool feed(const char *data, size_t size, std::string &out);
+
+  // Appends the held back bytes (at the end of the text, when no stop string came)
+  void flush(std::string &out);
+
+  bool stopped() const { return m_matched >= 0; }
+
+  // Index of the stop string found, -1 if none
+  int matched() const { return m_matched; }
+
+  size_t pending() const { return m_held.size(); }
+
+ private:
+  // 256 next states per state
+  std::vector<int32_t> m_next;
+  // length of the longest stop string ending at the state, 0 for none
+  std::vector<uint32_t> m_matchLength;
+  std::vector<int32_t> m_matchPattern;
+  std::vector<uint32_t> m_depth;
+  int32_t m_state = 0;
+  int m_matched   = -1;
+  std::string m_held;
+};
+
+}  // namespace textstream
+}  // namespace tools
+}  // namespace qnn
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+#include "PAL/DynamicLoading.hpp"
+#include "QnnTypeMacros.hpp"
+#include "TensorAllocator.hpp"
+
+#include <HTP/QnnHtpMem.h>
+
+using namespace qnn;
+using namespace qnn::tools;
+
+void *iotensor::HeapAllocator::allocate(size_t size) {
+  // aligned_alloc wants a multiple of the alignment
+  size = (size + m_alignment - 1) / m_alignment * m_alignment;
+#ifdef _WIN32
+  return _aligned_malloc(size, m_alignment);
+#else
+  void *buffer = nullptr;
+  if (0 != posix_memalign(&buffer, m_alignment, size)) {
+    return nullptr;
+  }
+  return buffer;
+#endif
+}
+
+void iotensor::HeapAllocator::deallocate(void *buffer) {
+#ifdef _WIN32
+  _aligned_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+
+iotensor::HugePageAllocator::~HugePageAllocator() {
+#ifndef _WIN32
+  for (auto &mapping : m_mappings) {
+    munmap(mapping.first, mapping.second);
+  }
+#endif
+}
+
+void *iotensor::HugePageAllocator::allocate(size_t size) {
+#ifndef _WIN32
+  if (size >= m_minSize) {
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    size_t length = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+    void *buffer  = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (MAP_FAILED == buffer) {
+      buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (MAP_FAILED != buffer) {
+        madvise(buffer, length, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    if (MAP_FAILED != buffer) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_mappings[buffer] = length;
+      return buffer;
+    }
+    QNN_WARN("mmap of %zu bytes failed, falling back to heap", length);
+  }
+#endif
+  return m_heap.allocate(size);
+}
+
+void iotensor::HugePageAllocator::deallocate(void *buffer) {
+#ifndef _WIN32
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_mappings.find(buffer);
+    if (it != m_mappings.end()) {
+      munmap(it->first, it->second);
+      m_mappings.erase(it);
+      return;
+    }
+  }
+#endif
+  m_heap.deallocate(buffer);
+}
+
+// from rpcmem.h
+#define RPCMEM_HEAP_ID_SYSTEM 25
+#define RPCMEM_DEFAULT_FLAGS  1
+
+iotensor::SharedMemAllocator::SharedMemAllocator(const QNN_INTERFACE_VER_TYPE &qnnInterface)
+    : m_qnnInterface(qnnInterface) {
+  if (nullptr == m_qnnInterface.memRegister || nullptr == m_qnnInterface.memDeRegister) {
+    QNN_WARN("Backend does not support memRegister, shared memory disabled");
+    return;
+  }
+  m_libCdspRpc = pal::dynamicloading::dlOpen("libcdsprpc.so", pal::dynamicloading::DL_NOW | pal::dynamicloading::DL_LOCAL);
+  if (nullptr == m_libCdspRpc) {
+    QNN_WARN("Unable to load libcdsprpc.so, shared memory disabled");
+    return;
+  }
+  auto rpcmemAlloc = reinterpret_cast<RpcMemAllocFn_t>(pal::dynamicloading::dlSym(m_libCdspRpc, "rpcmem_alloc"));
+  m_rpcmemFree     = reinterpret_cast<RpcMemFreeFn_t>(pal::dynamicloading::dlSym(m_libCdspRpc, "rpcmem_free"));
+  m_rpcmemToFd     = reinterpret_cast<RpcMemToFdFn_t>(pal::dynamicloading::dlSym(m_libCdspRpc, "rpcmem_to_fd"));
+  if (nullptr == rpcmemAlloc || nullptr == m_rpcmemFree || nullptr == m_rpcmemToFd) {
+    QNN_WARN("Unable to resolve rpcmem symbols, shared memory disabled");
+    return;
+  }
+  m_rpcmemAlloc = rpcmemAlloc;
+}
+
+iotensor::SharedMemAllocator::~SharedMemAllocator() {
+  for (auto &block : m_blocks) {
+    releaseHandles(block.second);
+    m_rpcmemFree(block.first);
+  }
+  m_blocks.clear();
+  if (m_libCdspRpc) {
+    pal::dynamicloading::dlClose(m_libCdspRpc);
+  }
+}
+
+void *iotensor::SharedMemAllocator::allocate(size_t size) {
+  if (!isAvailable()) {
+    return m_heap.allocate(size);
+  }
+  void *buffer = m_rpcmemAlloc(RPCMEM_HEAP_ID_SYSTEM, RPCMEM_DEFAULT_FLAGS, size);
+  if (nullptr == buffer) {
+    QNN_WARN("rpcmem_alloc of %zu bytes failed, falling back to heap", size);
+    return m_heap.allocate(size);
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_blocks[static_cast<uint8_t *>(buffer)] = Block{m_rpcmemToFd(buffer), size, {}};
+  return buffer;
+}
+
+void iotensor::SharedMemAllocator::releaseHandles(Block &block) {
+  for (auto &handle : block.handles) {
+    if (handle.second && QNN_MEM_NO_ERROR != m_qnnInterface.memDeRegister(&handle.second, 1)) {
+      QNN_WARN("memDeRegister failed");
+    }
+  }
+  block.handles.clear();
+}
+
+std::map<uint8_t *, iotensor::SharedMemAllocator::Block>::iterator iotensor::SharedMemAllocator::findBlock(
+    void *buffer) {
+  uint8_t *address = static_cast<uint8_t *>(buffer);
+  auto it          = m_blocks.upper_bound(address);
+  if (it == m_blocks.begin()) {
+    return m_blocks.end();
+  }
+  --it;
+  return address < it->first + it->second.size ? it : m_blocks.end();
+}
+
+void iotensor::SharedMemAllocator::deallocate(void *buffer) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_blocks.find(static_cast<uint8_t *>(buffer));
+    if (it != m_blocks.end()) {
+      releaseHandles(it->second);
+      m_rpcmemFree(buffer);
+      m_blocks.erase(it);
+      return;
+    }
+  }
+  m_heap.deallocate(buffer);
+}
+
+// Buffers move between tensors by client-buffer swaps, including across the
+// contexts of a chunked model, so a buffer gets one registration per context.
+// A failed registration is remembered as nullptr and the buffer then stays raw.
+Qnn_MemHandle_t iotensor::SharedMemAllocator::getMemHandle(void *buffer,
+                                                           const Qnn_Tensor_t &tensor,
+                                                           Qnn_ContextHandle_t context) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = findBlock(buffer);
+  if (it == m_blocks.end() || it->second.fd < 0) {
+    return nullptr;
+  }
+  Block &block        = it->second;
+  const size_t offset = static_cast<uint8_t *>(buffer) - it->first;
+  auto handle         = block.handles.find({offset, context});
+  if (handle != block.handles.end()) {
+    return handle->second;
+  }
+
+  Qnn_MemDescriptor_t descriptor  = QNN_MEM_DESCRIPTOR_INIT;
+  descriptor.memShape.numDim      = QNN_TENSOR_GET_RANK(tensor);
+  descriptor.memShape.dimSize     = QNN_TENSOR_GET_DIMENSIONS(tensor);
+  descriptor.memShape.shapeConfig = nullptr;
+  descriptor.dataType             = QNN_TENSOR_GET_DATA_TYPE(tensor);
+  QnnMemHtp_Descriptor_t htpDescriptor;
+  if (0 == offset && QNN_TENSOR_GET_CLIENT_BUF(tensor).dataSize == block.size) {
+    descriptor.memType    = QNN_MEM_TYPE_ION;
+    descriptor.ionInfo.fd = block.fd;
+  } else {
+    htpDescriptor.type                      = QNN_HTP_MEM_SHARED_BUFFER;
+    htpDescriptor.size                      = block.size;
+    htpDescriptor.sharedBufferConfig.fd     = block.fd;
+    htpDescriptor.sharedBufferConfig.offset = offset;
+    descriptor.memType                      = QNN_MEM_TYPE_CUSTOM;
+    descriptor.customInfo                   = &htpDescriptor;
+  }
+  Qnn_MemHandle_t memHandle = nullptr;
+  if (QNN_MEM_NO_ERROR != m_qnnInterface.memRegister(context, &descriptor, 1, &memHandle)) {
+    QNN_WARN("memRegister failed for tensor %s, using a raw buffer", QNN_TENSOR_GET_NAME(tensor));
+    memHandle = nullptr;
+  }
+  block.handles[{offset, context}] = memHandle;
+  return memHandle;
+}
+
+iotensor::TrackingAllocator::TrackingAllocator(std::shared_ptr<TensorAllocator> inner)
+    : m_inner(inner) {}
+
+iotensor::TrackingAllocator::~TrackingAllocator() {
+  if (!m_sizes.empty()) {
+    QNN_ERROR("%zu tensor buffers (%zu bytes) were never freed", m_sizes.size(), m_stats.liveBytes);
+  }
+  QNN_INFO("Tensor allocations: %zu, peak %zu bytes, bad frees %zu",
+           m_stats.allocations, m_stats.peakBytes, m_stats.badFrees);
+}
+
+void *iotensor::TrackingAllocator::allocate(size_t size) {
+  void *buffer = m_inner->allocate(size);
+  if (nullptr == buffer) {
+    return nullptr;
+  }
+  memset(buffer, 0xA5, size);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_sizes[buffer] = size;
+  m_stats.allocations++;
+  m_stats.liveBuffers++;
+  m_stats.liveBytes += size;
+  m_stats.peakBytes = std::max(m_stats.peakBytes, m_stats.liveBytes);
+  return buffer;
+}
+
+void iotensor::TrackingAllocator::deallocate(void *buffer) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_sizes.find(buffer);
+    if (it == m_sizes.end()) {
+      QNN_ERROR("Freeing unknown tensor buffer %p", buffer);
+      m_stats.badFrees++;
+      return;
+    }
+    m_stats.liveBuffers--;
+    m_stats.liveBytes -= it->second;
+    m_sizes.erase(it);
+  }
+  m_inner->deallocate(buffer);
+}
+
+Qnn_MemHandle_t iotensor::TrackingAllocator::getMemHandle(void *buffer,
+                                                          const Qnn_Tensor_t &tensor,
+                                                          Qnn_ContextHandle_t context) {
+  return m_inner->getMemHandle(buffer, tensor, context);
+}
+
+iotensor::TrackingAllocator::Stats iotensor::TrackingAllocator::stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+std::shared_ptr<iotensor::TensorAllocator> iotensor::createTensorAllocator(
+    const std::string &name, const QNN_INTERFACE_VER_TYPE &qnnInterface) {
+  if (name == "heap") {
+    return std::make_shared<HeapAllocator>();
+  } else if (name == "hugepage") {
+    return std::make_shared<HugePageAllocator>();
+  } else if (name == "shared") {
+    return std::make_shared<SharedMemAllocator>(qnnInterface);
+  } else if (name == "tracking") {
+    return std::make_shared<TrackingAllocator>(std::make_shared<HeapAllocator>());
+  } else if (name.compare(0, 9, "tracking:") == 0) {
+    auto inner = createTensorAllocator(name.substr(9), qnnInterface);
+    return inner ? std::make_shared<TrackingAllocator>(inner) : nullptr;
+  }
+  return nullptr;
+}
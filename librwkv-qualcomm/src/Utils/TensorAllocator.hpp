@@ -0,0 +1,171 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "QnnInterface.h"
+#include "QnnTypes.h"
+
+namespace qnn {
+namespace tools {
+namespace iotensor {
+
+// Source of the client buffers IOTensor::setupTensors attaches to graph tensors.
+// Buffers stay addressed by their host pointer everywhere in the app; allocators whose
+// memory is registered with the backend hand out a memory handle for a buffer at
+// execute time (see IOTensor::bindRegisteredBuffers).
+class TensorAllocator {
+ public:
+  virtual ~TensorAllocator() = default;
+
+  virtual void *allocate(size_t size) = 0;
+
+  virtual void deallocate(void *buffer) = 0;
+
+  virtual bool registersMemory() const { return false; }
+
+  // Handle of buffer registered in context with the shape and type of tensor, or
+  // nullptr to pass the buffer as a raw client buffer.
+  virtual Qnn_MemHandle_t getMemHandle(void *buffer, const Qnn_Tensor_t &tensor, Qnn_ContextHandle_t context) {
+    return nullptr;
+  }
+
+  virtual const char *name() const = 0;
+};
+
+// 64-byte aligned host memory.
+class HeapAllocator : public TensorAllocator {
+ public:
+  explicit HeapAllocator(size_t alignment = 64) : m_alignment(alignment) {}
+
+  void *allocate(size_t size) override;
+
+  void deallocate(void *buffer) override;
+
+  const char *name() const override { return "heap"; }
+
+ private:
+  size_t m_alignment;
+};
+
+// Anonymous mappings backed by huge pages: MAP_HUGETLB when the system has reserved
+// huge pages, transparent huge pages (MADV_HUGEPAGE) otherwise. Buffers below
+// minSize come from the heap so that small tensors do not each take a whole page.
+class HugePageAllocator : public TensorAllocator {
+ public:
+  explicit HugePageAllocator(size_t minSize = 64 * 1024) : m_minSize(minSize) {}
+
+  ~HugePageAllocator();
+
+  void *allocate(size_t size) override;
+
+  void deallocate(void *buffer) override;
+
+  const char *name() const override { return "hugepage"; }
+
+ private:
+  size_t m_minSize;
+  HeapAllocator m_heap;
+  std::mutex m_mutex;
+  std::unordered_map<void *, size_t> m_mappings;  // buffer -> mapped length
+};
+
+// ION/DMA-BUF memory from libcdsprpc's rpcmem, registered with memRegister the first
+// time a buffer is used in a context. The HTP then reads it in place instead of
+// copying every client buffer into device-visible memory on each execute.
+// Buffers may point into the middle of an allocation (a tensor arena); those are
+// registered as HTP shared buffers at their offset in the block's fd.
+// Falls back to heap memory when rpcmem is not available.
+class SharedMemAllocator : public TensorAllocator {
+ public:
+  explicit SharedMemAllocator(const QNN_INTERFACE_VER_TYPE &qnnInterface);
+
+  ~SharedMemAllocator();
+
+  bool isAvailable() const { return nullptr != m_rpcmemAlloc; }
+
+  void *allocate(size_t size) override;
+
+  void deallocate(void *buffer) override;
+
+  bool registersMemory() const override { return isAvailable(); }
+
+  Qnn_MemHandle_t getMemHandle(void *buffer, const Qnn_Tensor_t &tensor, Qnn_ContextHandle_t context) override;
+
+  const char *name() const override { return "shared"; }
+
+ private:
+  typedef void *(*RpcMemAllocFn_t)(int, uint32_t, int);
+  typedef void (*RpcMemFreeFn_t)(void *);
+  typedef int (*RpcMemToFdFn_t)(void *);
+
+  struct Block {
+    int fd;
+    size_t size;
+    // (offset, context) -> handle
+    std::map<std::pair<size_t, Qnn_ContextHandle_t>, Qnn_MemHandle_t> handles;
+  };
+
+  void releaseHandles(Block &block);
+
+  // The block containing buffer, or m_blocks.end()
+  std::map<uint8_t *, Block>::iterator findBlock(void *buffer);
+
+  QNN_INTERFACE_VER_TYPE m_qnnInterface;
+  void *m_libCdspRpc             = nullptr;
+  RpcMemAllocFn_t m_rpcmemAlloc  = nullptr;
+  RpcMemFreeFn_t m_rpcmemFree    = nullptr;
+  RpcMemToFdFn_t m_rpcmemToFd    = nullptr;
+  HeapAllocator m_heap;
+  std::mutex m_mutex;
+  std::map<uint8_t *, Block> m_blocks;
+};
+
+// Wraps another allocator for testing allocation strategies, e.g. on Linux with the
+// CPU backend: counts live and peak bytes, fills new buffers with a poison pattern so
+// that reads of uninitialized tensors show up, and reports bad frees and leaks.
+class TrackingAllocator : public TensorAllocator {
+ public:
+  struct Stats {
+    size_t allocations = 0;
+    size_t liveBuffers = 0;
+    size_t liveBytes   = 0;
+    size_t peakBytes   = 0;
+    size_t badFrees    = 0;
+  };
+
+  explicit TrackingAllocator(std::shared_ptr<TensorAllocator> inner);
+
+  ~TrackingAllocator();
+
+  void *allocate(size_t size) override;
+
+  void deallocate(void *buffer) override;
+
+  bool registersMemory() const override { return m_inner->registersMemory(); }
+
+  Qnn_MemHandle_t getMemHandle(void *buffer, const Qnn_Tensor_t &tensor, Qnn_ContextHandle_t context) override;
+
+  const char *name() const override { return "tracking"; }
+
+  Stats stats();
+
+ private:
+  std::shared_ptr<TensorAllocator> m_inner;
+  std::mutex m_mutex;
+  std::unordered_map<void *, size_t> m_sizes;
+  Stats m_stats;
+};
+
+// "heap", "hugepage", "shared" or "tracking" (tracking over heap, or over the
+// allocator named after a colon, e.g. "tracking:hugepage"). nullptr if unknown.
+std::shared_ptr<TensorAllocator> createTensorAllocator(const std::string &name,
+                                                       const QNN_INTERFACE_VER_TYPE &qnnInterface);
+
+}  // namespace iotensor
+}  // namespace tools
+}  // namespace qnn
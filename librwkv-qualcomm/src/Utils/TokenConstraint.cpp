@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "TokenConstraint.hpp"
+
+using namespace qnn::tools;
+
+constraint::TokenConstraint::TokenConstraint(Dfa dfa, CollectTokens collect, int endToken)
+    : m_dfa(std::move(dfa)), m_collect(std::move(collect)), m_endToken(endToken), m_entries(m_dfa.numStates()) {
+  reset();
+}
+
+void constraint::TokenConstraint::reset() {
+  m_state    = m_dfa.start();
+  m_finished = false;
+}
+
+const constraint::TokenConstraint::Entry &constraint::TokenConstraint::entry(int32_t state) {
+  Entry &entry = m_entries[state];
+  if (entry.cached) {
+    return entry;
+  }
+  m_scratch.clear();
+  m_collect(m_dfa.transitions(), state, m_scratch);
+  if (m_endToken >= 0 && m_dfa.accepting(state)) {
+    m_scratch.push_back(std::make_pair(m_endToken, int32_t(-1)));
+  }
+  std::sort(m_scratch.begin(), m_scratch.end());
+  m_scratch.erase(std::unique(m_scratch.begin(),
+                              m_scratch.end(),
+                              [](const std::pair<int, int32_t> &a, const std::pair<int, int32_t> &b) {
+                                return a.first == b.first;
+                              }),
+                  m_scratch.end());
+  entry.tokens.resize(m_scratch.size());
+  entry.next.resize(m_scratch.size());
+  for (size_t i = 0; i < m_scratch.size(); i++) {
+    entry.tokens[i] = m_scratch[i].first;
+    entry.next[i]   = m_scratch[i].second;
+  }
+  entry.cached = true;
+  return entry;
+}
+
+const std::vector<int> &constraint::TokenConstraint::allowed() {
+  return m_finished ? m_none : entry(m_state).tokens;
+}
+
+bool constraint::TokenConstraint::advance(int token) {
+  if (m_finished) {
+    return false;
+  }
+  const Entry &current = entry(m_state);
+  auto it              = std::lower_bound(current.tokens.begin(), current.tokens.end(), token);
+  if (it == current.tokens.end() || *it != token) {
+    return false;
+  }
+  if (token == m_endToken && m_dfa.accepting(m_state)) {
+    m_finished = true;
+  } else {
+    m_state = current.next[it - current.tokens.begin()];
+  }
+  return true;
+}
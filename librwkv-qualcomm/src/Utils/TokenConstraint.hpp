@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "RegexDfa.hpp"
+
+namespace qnn {
+namespace tools {
+namespace constraint {
+
+// Restricts generated tokens to those that keep the output a prefix of a match
+// of a Dfa. The allowed tokens of an automaton state are found by walking the
+// tokenizer's byte trie in lockstep with the automaton, skipping a whole subtree
+// at the first byte that leads nowhere, and are cached with the state each one
+// ends in. Once every reachable state has been seen, a step is a lookup.
+//
+// endToken (e.g. end-of-text) is allowed in accepting states and finishes the
+// output.
+class TokenConstraint {
+ public:
+  // Appends (token, end state) for every token whose bytes lead from state
+  // through non-negative states; transitions holds 256 next states per state
+  typedef std::function<void(const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens)>
+      CollectTokens;
+
+  TokenConstraint(Dfa dfa, CollectTokens collect, int endToken = -1);
+
+  void reset();
+
+  // The tokens allowed next, ascending; empty once finished
+  const std::vector<int> &allowed();
+
+  // Moves past token, which has to be one of allowed()
+  bool advance(int token);
+
+  bool accepting() const { return !m_finished && m_dfa.accepting(m_state); }
+
+  bool finished() const { return m_finished; }
+
+ private:
+  struct Entry {
+    bool cached = false;
+    std::vector<int> tokens;
+    std::vector<int32_t> next;
+  };
+
+  const Entry &entry(int32_t state);
+
+  Dfa m_dfa;
+  CollectTokens m_collect;
+  int m_endToken;
+  int32_t m_state = 0;
+  bool m_finished = false;
+  std::vector<Entry> m_entries;
+  std::vector<std::pair<int, int32_t>> m_scratch;
+  std::vector<int> m_none;
+};
+
+}  // namespace constraint
+}  // namespace tools
+}  // namespace qnn
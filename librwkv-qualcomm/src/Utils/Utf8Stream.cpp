@@ -0,0 +1,63 @@
+#include "Utf8Stream.hpp"
+
+using namespace qnn::tools;
+
+static bool isContinuation(char byte) { return (static_cast<uint8_t>(byte) & 0xC0) == 0x80; }
+
+// Length of the character a lead byte starts, 1 for anything else
+static uint8_t sequenceLength(char byte) {
+  const uint8_t b = static_cast<uint8_t>(byte);
+  if (b >= 0xC2 && b <= 0xDF) {
+    return 2;
+  }
+  if ((b & 0xF0) == 0xE0) {
+    return 3;
+  }
+  if (b >= 0xF0 && b <= 0xF4) {
+    return 4;
+  }
+  return 1;
+}
+
+void textstream::Utf8Stream::feed(const char *data, size_t size, std::string &out) {
+  size_t i = 0;
+  // finish the pending character; a byte that does not continue it releases it as is
+  while (m_size > 0 && i < size) {
+    if (!isContinuation(data[i])) {
+      out.append(m_pending, m_size);
+      m_size = 0;
+      break;
+    }
+    m_pending[m_size++] = data[i++];
+    if (m_size == m_length) {
+      out.append(m_pending, m_size);
+      m_size = 0;
+    }
+  }
+  if (i == size) {
+    return;
+  }
+
+  // hold back the last character if it is cut off
+  size_t end  = size;
+  size_t lead = size;
+  while (lead > i && size - lead < 3 && isContinuation(data[lead - 1])) {
+    lead--;
+  }
+  if (lead > i) {
+    const uint8_t length = sequenceLength(data[lead - 1]);
+    if (length > size - (lead - 1)) {
+      end      = lead - 1;
+      m_length = length;
+    }
+  }
+  out.append(data + i, end - i);
+  for (; end < size; end++) {
+    m_pending[m_size++] = data[end];
+  }
+}
+
+void textstream::Utf8Stream::flush(std::string &out) {
+  out.append(m_pending, m_size);
+  m_size = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace qnn {
+namespace tools {
+namespace textstream {
+
+// Cuts streamed bytes (e.g. decoded tokens, which can end inside a character) at
+// UTF-8 character boundaries. The bytes of a character that is not complete yet,
+// at most three, are held back until the rest arrives. Bytes that are not valid
+// UTF-8 are passed through unchanged, so the concatenated output always equals the
+// input. Use one per output stream.
+class Utf8Stream {
+ public:
+  void reset() { m_size = 0; }
+
+  // Appends to out the input up to the end of its last complete character
+  void feed(const char *data, size_t size, std::string &out);
+
+  // Appends the held back bytes, at the end of the stream
+  void flush(std::string &out);
+
+  size_t pending() const { return m_size; }
+
+ private:
+  char m_pending[4];
+  uint8_t m_size   = 0;
+  uint8_t m_length = 0;  // of the pending character
+};
+
+}  // namespace textstream
+}  // namespace tools
+}  // namespace qnn
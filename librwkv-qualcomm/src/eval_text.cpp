@@ -5,9 +5,12 @@
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <string_view>
 
 #include "librwkv-qualcomm.h"
 #include "tokenizer.h"
+#include "Utf8Stream.hpp"
 
 int main(int argc, char **argv) {
     std::cout.setf(std::ios::unitbuf);
@@ -81,59 +84,78 @@ int main(int argc, char **argv) {
     delete[] eval_text_buf;
     std::cout << "Eval texts num: " << eval_text.size() << std::endl;
 
+    // prompt and target of sample i are documents 2 * i and 2 * i + 1
+    std::vector<std::string_view> eval_docs;
+    size_t eval_bytes = 0;
+    for (const auto &text : eval_text) {
+        const size_t split = std::min(text.find_last_of(' '), text.size());
+        eval_docs.push_back(std::string_view(text).substr(0, split));
+        eval_docs.push_back(std::string_view(text).substr(split));
+        eval_bytes += text.size();
+    }
+    std::vector<int> eval_ids;
+    std::vector<size_t> eval_offsets;
+    auto encode_start = std::chrono::steady_clock::now();
+    tokenizer.EncodeBatch(eval_docs, eval_ids, eval_offsets);
+    double encode_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - encode_start).count();
+    std::cout << "Encoded " << eval_ids.size() << " tokens in " << encode_time * 1000 << " ms ("
+              << eval_bytes / std::max(encode_time, 1e-9) / 1e6 << " MB/s)" << std::endl;
+
     float xsum = 0;
     int xcnt = 0;
     int xacc = 0;
 
-    auto softmax = [](std::vector<float> &logits) {
-        std::vector<float> probs(logits.size());
-        float max_val = *std::max_element(logits.begin(), logits.end());
+    // the perplexity needs the full float output anyway, so the prediction is its
+    // argmax rather than a second readback
+    auto log_prob = [](const std::vector<float> &logits, int token, float max_logit) {
         float sum = 0;
         for (size_t i = 0; i < logits.size(); i++) {
-            probs[i] = std::exp((logits[i] - max_val));
-            sum += probs[i];
+            sum += std::exp(logits[i] - max_logit);
         }
-        for (size_t i = 0; i < logits.size(); i++) {
-            probs[i] /= sum;
-        }
-        return probs;
+        return logits[token] - max_logit - std::log(sum);
     };
 
-    for (const auto &text : eval_text) {
+    for (size_t sample = 0; sample < eval_text.size(); sample++) {
         std::cout << "Sample num: " << xcnt << std::endl;
-        auto prompt_ids = tokenizer.Encode(text.substr(0, text.find_last_of(' ')));
-        auto target_ids = tokenizer.Encode(text.substr(text.find_last_of(' ')));
-        std::cout << "Prompt: " << text.substr(0, text.find_last_of(' ')) << std::endl;
-        std::cout << "Target: " << text.substr(text.find_last_of(' ')) << std::endl;
+        const int *prompt_ids = eval_ids.data() + eval_offsets[2 * sample];
+        const size_t prompt_len = eval_offsets[2 * sample + 1] - eval_offsets[2 * sample];
+        const int *target_ids = eval_ids.data() + eval_offsets[2 * sample + 1];
+        const size_t target_len = eval_offsets[2 * sample + 2] - eval_offsets[2 * sample + 1];
+        std::cout << "Prompt: " << eval_docs[2 * sample] << std::endl;
+        std::cout << "Target: " << eval_docs[2 * sample + 1] << std::endl;
         QnnRwkvResetStates(backend);
         std::cout << "Response: ";
 
         bool correct = true;
         float logits_val = 0;
-        for (auto token_id : prompt_ids) {
-            if (QnnRwkvExecute(backend, token_id) != StatusCode::SUCCESS) {
-                std::cerr << "QnnRwkvExecute failed" << std::endl;
-                return EXIT_FAILURE;
-            }
+        qnn::tools::textstream::Utf8Stream utf8;
+        std::string response;
+        if (QnnRwkvExecuteSequence(backend, prompt_ids, prompt_len) != StatusCode::SUCCESS) {
+            std::cerr << "QnnRwkvExecuteSequence failed" << std::endl;
+            return EXIT_FAILURE;
         }
 
-        QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, output.data(), output.size());
-        auto probs = softmax(output);
-        for (int i = 0; i < target_ids.size(); i++) {
-            auto output_id = std::max_element(probs.begin(), probs.end()) - probs.begin();
-            logits_val += std::log(probs[target_ids[i]]);
+        for (size_t i = 0; i < target_len; i++) {
+            QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, output.data(), output.size());
+            const int output_id = std::max_element(output.begin(), output.end()) - output.begin();
+            const float max_logit = output[output_id];
+            logits_val += log_prob(output, target_ids[i], max_logit);
             if (output_id != target_ids[i]) {
                 correct = false;
             }
-            std::cout << tokenizer.Decode(output_id);
+            std::string_view piece = tokenizer.DecodeView(output_id);
+            response.clear();
+            utf8.feed(piece.data(), piece.size(), response);
+            std::cout << response;
 
             if (QnnRwkvExecute(backend, target_ids[i]) != StatusCode::SUCCESS) {
                 std::cerr << "QnnRwkvExecute failed" << std::endl;
                 return EXIT_FAILURE;
             }
-            QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, output.data(), output.size());
-            probs = softmax(output);
         }
+        response.clear();
+        utf8.flush(response);
+        std::cout << response;
 
         xcnt++;
         if (correct) {
@@ -1,5 +1,6 @@
 #include <inttypes.h>
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <sstream>
@@ -10,7 +11,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #endif
-#include "half.hpp"
+#include "DataKernels.hpp"
 #include "DataUtil.hpp"
 #include "Logger.hpp"
 #include "PAL/Directory.hpp"
@@ -19,6 +20,10 @@
 #include "PAL/StringOp.hpp"
 #include "QnnTypeMacros.hpp"
 #include "librwkv-qualcomm-app.hpp"
+#include "librwkv-qualcomm-async.hpp"
+#include "librwkv-qualcomm-beam.hpp"
+#include "librwkv-qualcomm-pipeline.hpp"
+#include "librwkv-qualcomm-speculative.hpp"
 #include "Utils.hpp"
 #include "QnnWrapperUtils.hpp"
 #include "IOTensor.hpp"
@@ -253,6 +258,14 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::freeContext() {
     QNN_ERROR("Could not free context");
     return StatusCode::FAILURE;
   }
+  for (int i = 0; i < max_chunks; i++) {
+    if (m_prefillContext[i] && QNN_CONTEXT_NO_ERROR !=
+        m_qnnFunctionPointers.qnnInterface.contextFree(m_prefillContext[i], m_profileBackendHandle)) {
+      QNN_ERROR("Could not free prefill context");
+      return StatusCode::FAILURE;
+    }
+    m_prefillContext[i] = nullptr;
+  }
   m_isContextCreated = false;
   return StatusCode::SUCCESS;
 }
@@ -354,58 +367,115 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createFromBinary(uint8_t *in_buffer,
     bufferSizes[0] = bufferSize;
   } else {
     // read serialized binary into a byte buffer
-    tools::datautil::StatusCode status{tools::datautil::StatusCode::SUCCESS};
     for (int i = 0; i < n_chunks; i++) {
       if (n_chunks > 1) {
         m_cachedBinaryPath = m_cachedBinaryPath.substr(0, pos) + "_chunk" + std::to_string(i+1) + "of" + std::to_string(n_chunks) + ".bin";
         std::cout << "Reading chunk: " << m_cachedBinaryPath << std::endl;
       }
-      std::tie(status, bufferSizes[i]) = tools::datautil::getFileSize(m_cachedBinaryPath);
-      if (0 == bufferSizes[i]) {
-        QNN_ERROR("Received path to an empty file. Nothing to deserialize.");
+      if (StatusCode::SUCCESS != readBinaryFromFile(m_cachedBinaryPath, buffer[i], bufferSizes[i])) {
         return StatusCode::FAILURE;
       }
-      std::cout << "Buffer size: " << bufferSizes[i] << std::endl;
+    }
+  }
+
+  auto returnStatus = createContextsFromBuffers(buffer, bufferSizes, m_context, m_graphsInfo, m_graphsCount);
+  if (StatusCode::SUCCESS != returnStatus || (in_buffer && bufferSize)) {
+    return returnStatus;
+  }
+
+  // Sequence graphs exported with convert_model.py --prefill_model are optional and
+  // live next to the decode binaries as <name>_prefill_chunkXofY.bin.
+  std::vector<std::string> prefillPaths;
+  if (n_chunks > 1) {
+    for (int i = 0; i < n_chunks; i++) {
+      prefillPaths.push_back(m_cachedBinaryPath.substr(0, pos) + "_prefill_chunk" + std::to_string(i+1) + "of" + std::to_string(n_chunks) + ".bin");
+    }
+  } else {
+    prefillPaths.push_back(m_cachedBinaryPath.substr(0, m_cachedBinaryPath.find_last_of(".")) + "_prefill.bin");
+  }
+  if (!pal::FileOp::checkFileExists(prefillPaths[0])) {
+    return StatusCode::SUCCESS;
+  }
+
+  std::vector<std::shared_ptr<uint8_t>> prefillBuffer(n_chunks);
+  std::vector<uint64_t> prefillBufferSizes(n_chunks);
+  for (int i = 0; i < n_chunks; i++) {
+    std::cout << "Reading prefill chunk: " << prefillPaths[i] << std::endl;
+    if (StatusCode::SUCCESS != readBinaryFromFile(prefillPaths[i], prefillBuffer[i], prefillBufferSizes[i])) {
+      QNN_WARN("Failed to read prefill binary, sequence prefill disabled.");
+      return StatusCode::SUCCESS;
+    }
+  }
+  if (StatusCode::SUCCESS != createContextsFromBuffers(prefillBuffer, prefillBufferSizes, m_prefillContext,
+                                                       m_prefillGraphsInfo, m_prefillGraphsCount)) {
+    QNN_WARN("Failed to load prefill graphs, sequence prefill disabled.");
+    if (nullptr != m_prefillGraphsInfo) {
+      qnn_wrapper_api::freeGraphsInfo(&m_prefillGraphsInfo, m_prefillGraphsCount);
+    }
+    m_prefillGraphsInfo = nullptr;
+    m_prefillGraphsCount = 0;
+  }
+  return StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::readBinaryFromFile(const std::string &path,
+                                                              std::shared_ptr<uint8_t> &buffer,
+                                                              uint64_t &bufferSize) {
+  tools::datautil::StatusCode status{tools::datautil::StatusCode::SUCCESS};
+  std::tie(status, bufferSize) = tools::datautil::getFileSize(path);
+  if (0 == bufferSize) {
+    QNN_ERROR("Received path to an empty file. Nothing to deserialize.");
+    return StatusCode::FAILURE;
+  }
+  std::cout << "Buffer size: " << bufferSize << std::endl;
 
 #if USE_MMAP
-      int fd = open(m_cachedBinaryPath.c_str(), O_RDONLY);
-      if (fd < 0) {
-        QNN_ERROR("Failed to open file %s", m_cachedBinaryPath.c_str());
-        return StatusCode::FAILURE;
-      }
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    QNN_ERROR("Failed to open file %s", path.c_str());
+    return StatusCode::FAILURE;
+  }
 
-      buffer[i] = std::shared_ptr<uint8_t>(
-          (uint8_t*)mmap(NULL, bufferSizes[i], PROT_READ, MAP_SHARED, fd, 0), [bufferSizes, i](uint8_t* p) {
-              if (p) {
-                munmap(p, bufferSizes[i]);
-              }
-            }
-          );
-
-      if (buffer[i].get() == MAP_FAILED) {
-        QNN_ERROR("Failed to mmap file %s", m_cachedBinaryPath.c_str());
-        close(fd);
-        return StatusCode::FAILURE;
-      }
+  buffer = std::shared_ptr<uint8_t>(
+      (uint8_t*)mmap(NULL, bufferSize, PROT_READ, MAP_SHARED, fd, 0), [bufferSize](uint8_t* p) {
+          if (p) {
+            munmap(p, bufferSize);
+          }
+        }
+      );
+
+  if (buffer.get() == MAP_FAILED) {
+    QNN_ERROR("Failed to mmap file %s", path.c_str());
+    close(fd);
+    return StatusCode::FAILURE;
+  }
 #else
-      buffer[i] = std::shared_ptr<uint8_t>(new uint8_t[bufferSizes[i]], std::default_delete<uint8_t[]>());
-      if (!buffer[i]) {
-        QNN_ERROR("Failed to allocate memory.");
-        return StatusCode::FAILURE;
-      }
+  buffer = std::shared_ptr<uint8_t>(new uint8_t[bufferSize], std::default_delete<uint8_t[]>());
+  if (!buffer) {
+    QNN_ERROR("Failed to allocate memory.");
+    return StatusCode::FAILURE;
+  }
 
-      status = tools::datautil::readBinaryFromFile(
-          m_cachedBinaryPath, reinterpret_cast<uint8_t*>(buffer[i].get()), bufferSizes[i]);
-      if (status != tools::datautil::StatusCode::SUCCESS) {
-        QNN_ERROR("Failed to read binary data.");
-        return StatusCode::FAILURE;
-      }
-#endif
-    }
+  status = tools::datautil::readBinaryFromFile(
+      path, reinterpret_cast<uint8_t*>(buffer.get()), bufferSize);
+  if (status != tools::datautil::StatusCode::SUCCESS) {
+    QNN_ERROR("Failed to read binary data.");
+    return StatusCode::FAILURE;
   }
+#endif
+
+  return StatusCode::SUCCESS;
+}
 
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createContextsFromBuffers(
+    std::vector<std::shared_ptr<uint8_t>> &buffer,
+    std::vector<uint64_t> &bufferSizes,
+    Qnn_ContextHandle_t *contexts,
+    qnn_wrapper_api::GraphInfo_t **&graphsInfo,
+    uint32_t &graphsCount) {
   // inspect binary info
   auto returnStatus = StatusCode::SUCCESS;
+  const int n_chunks = buffer.size();
   std::vector<qnn_wrapper_api::GraphInfo_t **> graphInfos(n_chunks);
   std::vector<uint32_t> graphCounts(n_chunks);
   for (int i = 0; i < n_chunks; i++)
@@ -457,7 +527,7 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createFromBinary(uint8_t *in_buffer,
             (const QnnContext_Config_t**)m_contextConfig,
             static_cast<void*>(buffer[i].get()),
             bufferSizes[i],
-            &m_context[i],
+            &contexts[i],
             m_profileBackendHandle)) {
       QNN_ERROR("Could not create context from binary.");
       returnStatus = StatusCode::FAILURE;
@@ -475,7 +545,7 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createFromBinary(uint8_t *in_buffer,
         }
         if (QNN_SUCCESS !=
             m_qnnFunctionPointers.qnnInterface.graphRetrieve(
-                m_context[i], (*graphInfos[i])[graphIdx].graphName, &((*graphInfos[i])[graphIdx].graph))) {
+                contexts[i], (*graphInfos[i])[graphIdx].graphName, &((*graphInfos[i])[graphIdx].graph))) {
           QNN_ERROR("Unable to retrieve graph handle for graph Idx: %d", graphIdx);
           returnStatus = StatusCode::FAILURE;
         }
@@ -487,14 +557,14 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createFromBinary(uint8_t *in_buffer,
     }
   }
 
-  m_graphsCount = 0;
+  graphsCount = 0;
   for (auto i : graphCounts) {
-    m_graphsCount += i;
+    graphsCount += i;
   }
-  m_graphsInfo = (qnn_wrapper_api::GraphInfo_t **)calloc(m_graphsCount, sizeof(qnn_wrapper_api::GraphInfo_t *));
+  graphsInfo = (qnn_wrapper_api::GraphInfo_t **)calloc(graphsCount, sizeof(qnn_wrapper_api::GraphInfo_t *));
   qnn_wrapper_api::GraphInfo_t *graphInfoArr =
-      (qnn_wrapper_api::GraphInfo_t *)calloc(m_graphsCount, sizeof(qnn_wrapper_api::GraphInfo_t));
-  if (nullptr == m_graphsInfo || nullptr == graphInfoArr) {
+      (qnn_wrapper_api::GraphInfo_t *)calloc(graphsCount, sizeof(qnn_wrapper_api::GraphInfo_t));
+  if (nullptr == graphsInfo || nullptr == graphInfoArr) {
     QNN_ERROR("Failure to allocate memory for *graphInfo");
     returnStatus = StatusCode::FAILURE;
   }
@@ -502,16 +572,28 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::createFromBinary(uint8_t *in_buffer,
     int gidx = 0;
     for (int i = 0; i < n_chunks; i++) {
       for (int j = 0; j < graphCounts[i]; j++) {
-        m_graphsInfo[gidx] = graphInfoArr + gidx;
-        m_graphsInfo[gidx]->graph = (*graphInfos[i])[j].graph;
-        m_graphsInfo[gidx]->graphName = strdup((*graphInfos[i])[j].graphName);
-        m_graphsInfo[gidx]->inputTensors = (*graphInfos[i])[j].inputTensors;
-        m_graphsInfo[gidx]->numInputTensors = (*graphInfos[i])[j].numInputTensors;
-        m_graphsInfo[gidx]->outputTensors = (*graphInfos[i])[j].outputTensors;
-        m_graphsInfo[gidx]->numOutputTensors = (*graphInfos[i])[j].numOutputTensors;
+        graphsInfo[gidx] = graphInfoArr + gidx;
+        graphsInfo[gidx]->graph = (*graphInfos[i])[j].graph;
+        graphsInfo[gidx]->graphName = strdup((*graphInfos[i])[j].graphName);
+        graphsInfo[gidx]->inputTensors = (*graphInfos[i])[j].inputTensors;
+        graphsInfo[gidx]->numInputTensors = (*graphInfos[i])[j].numInputTensors;
+        graphsInfo[gidx]->outputTensors = (*graphInfos[i])[j].outputTensors;
+        graphsInfo[gidx]->numOutputTensors = (*graphInfos[i])[j].numOutputTensors;
         gidx++;
       }
     }
+  } else {
+    // the per-chunk infos that did load are not referenced by graphsInfo yet,
+    // and its entries are still null, so release both here
+    for (int i = 0; i < n_chunks; i++) {
+      if (nullptr != graphInfos[i]) {
+        qnn_wrapper_api::freeGraphsInfo(&graphInfos[i], graphCounts[i]);
+      }
+    }
+    free(graphInfoArr);
+    free(graphsInfo);
+    graphsInfo = nullptr;
+    graphsCount = 0;
   }
   return returnStatus;
 }
@@ -807,68 +889,140 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::initializeTensors() {
       }
       for (size_t i = 0; i < graphInfo.numInputTensors; i++) {
         QNN_INFO("Input Tensor %d : %s Type: %d", i, QNN_TENSOR_GET_NAME(m_inputTensors[graph_id][i]), QNN_TENSOR_GET_DATA_TYPE(m_inputTensors[graph_id][i]));
-        std::vector<size_t> dims;
-        for (int j = 0; j < QNN_TENSOR_GET_RANK(m_inputTensors[graph_id][i]); j++) {
-          dims.push_back(*(QNN_TENSOR_GET_DIMENSIONS(m_inputTensors[graph_id][i]) + j));
-        }
-        if (QNN_TENSOR_GET_DATA_TYPE(m_inputTensors[graph_id][i]) == QNN_DATATYPE_FLOAT_16)
-          memset(QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[graph_id][i]).data, 0, datautil::calculateElementCount(dims) * sizeof(uint16_t));
-        else if (QNN_TENSOR_GET_DATA_TYPE(m_inputTensors[graph_id][i]) == QNN_DATATYPE_FLOAT_32)
-          memset(QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[graph_id][i]).data, 0, datautil::calculateElementCount(dims) * sizeof(float));
-        else {
-          float *ptr = new float[datautil::calculateElementCount(dims)];
-          memset(ptr, 0, datautil::calculateElementCount(dims) * sizeof(float));
-          m_ioTensor.copyFromFloatToNative(ptr, &m_inputTensors[graph_id][i]);
-          delete[] ptr;
-        }
       }
       for (size_t i = 0; i < graphInfo.numOutputTensors; i++) {
         QNN_INFO("Output Tensor %d : %s Type: %d", i, QNN_TENSOR_GET_NAME(m_outputTensors[graph_id][i]), QNN_TENSOR_GET_DATA_TYPE(m_outputTensors[graph_id][i]));
         if (std::string(QNN_TENSOR_GET_NAME(m_outputTensors[graph_id][i])).find("kv") != std::string::npos) {
           m_isExternalWkv = true;
         }
-        std::vector<size_t> dims;
-        for (int j = 0; j < QNN_TENSOR_GET_RANK(m_outputTensors[graph_id][i]); j++) {
-          dims.push_back(*(QNN_TENSOR_GET_DIMENSIONS(m_outputTensors[graph_id][i]) + j));
-        }
-        if (QNN_TENSOR_GET_DATA_TYPE(m_outputTensors[graph_id][i]) == QNN_DATATYPE_FLOAT_16)
-          memset(QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][i]).data, 0, datautil::calculateElementCount(dims) * sizeof(uint16_t));
-        else if (QNN_TENSOR_GET_DATA_TYPE(m_outputTensors[graph_id][i]) == QNN_DATATYPE_FLOAT_32)
-          memset(QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][i]).data, 0, datautil::calculateElementCount(dims) * sizeof(float));
-        else {
-          float *ptr = new float[datautil::calculateElementCount(dims)];
-          memset(ptr, 0, datautil::calculateElementCount(dims) * sizeof(float));
-          m_ioTensor.copyFromFloatToNative(ptr, &m_outputTensors[graph_id][i]);
-          delete[] ptr;
+      }
+      m_ioTensor.zeroArena(m_inputTensors[graph_id], m_outputTensors[graph_id],
+                           graphInfo.numInputTensors, graphInfo.numOutputTensors);
+    }
+    m_initialState.resize(getStateSize());
+    saveStates(m_initialState.data(), m_initialState.size());
+    if (m_prefillGraphsCount > 0 && StatusCode::SUCCESS != initializePrefillTensors()) {
+      QNN_WARN("Prefill graphs do not match the decode graphs, sequence prefill disabled.");
+      for (uint32_t graph_id = 0; graph_id < m_prefillGraphsCount; graph_id++) {
+        auto graphInfo = (*m_prefillGraphsInfo)[graph_id];
+        if (m_prefillInputTensors[graph_id] || m_prefillOutputTensors[graph_id]) {
+          m_ioTensor.tearDownInputAndOutputTensors(m_prefillInputTensors[graph_id], m_prefillOutputTensors[graph_id],
+                                                   graphInfo.numInputTensors, graphInfo.numOutputTensors);
         }
+        m_prefillInputTensors[graph_id]  = nullptr;
+        m_prefillOutputTensors[graph_id] = nullptr;
       }
+      qnn_wrapper_api::freeGraphsInfo(&m_prefillGraphsInfo, m_prefillGraphsCount);
+      m_prefillGraphsInfo = nullptr;
+      m_prefillGraphsCount = 0;
+      m_prefillSeqLength = 0;
     }
   }
   return StatusCode::SUCCESS;
 }
 
-rwkv_app::StatusCode rwkv_app::QnnRwkvApp::execute(int token) {
-  auto returnStatus = StatusCode::SUCCESS;
+static size_t getTensorElementCount(const Qnn_Tensor_t &tensor) {
+  size_t count = 1;
+  for (uint32_t i = 0; i < QNN_TENSOR_GET_RANK(tensor); i++) {
+    count *= *(QNN_TENSOR_GET_DIMENSIONS(tensor) + i);
+  }
+  return count;
+}
 
-  if (nullptr == m_inputTensors[0] || nullptr == m_outputTensors[0])
+static bool isSameStateLayout(const Qnn_Tensor_t &a, const Qnn_Tensor_t &b) {
+  if (QNN_TENSOR_GET_DATA_TYPE(a) != QNN_TENSOR_GET_DATA_TYPE(b) ||
+      getTensorElementCount(a) != getTensorElementCount(b)) {
+    return false;
+  }
+  if (QNN_TENSOR_GET_DATA_TYPE(a) == QNN_DATATYPE_FLOAT_16 ||
+      QNN_TENSOR_GET_DATA_TYPE(a) == QNN_DATATYPE_FLOAT_32) {
+    return true;
+  }
+  return QNN_TENSOR_GET_QUANT_PARAMS(a).scaleOffsetEncoding.scale == QNN_TENSOR_GET_QUANT_PARAMS(b).scaleOffsetEncoding.scale &&
+         QNN_TENSOR_GET_QUANT_PARAMS(a).scaleOffsetEncoding.offset == QNN_TENSOR_GET_QUANT_PARAMS(b).scaleOffsetEncoding.offset;
+}
+
+// The prefill graphs get a full set of tensors of their own, state buffers included,
+// but their state buffers are only placeholders: executeSequence() swaps the decode
+// graphs' state buffers in for each call and back afterwards, so both graph sets
+// must agree on the state layout. The prefill state buffers therefore take as much
+// memory again as the decode ones without ever holding a state.
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::initializePrefillTensors() {
+  if (m_prefillGraphsCount != m_graphsCount) {
+    QNN_ERROR("Prefill graph count %d != decode graph count %d", m_prefillGraphsCount, m_graphsCount);
     return StatusCode::FAILURE;
+  }
+  for (uint32_t graph_id = 0; graph_id < m_prefillGraphsCount; graph_id++) {
+    auto graphInfo = (*m_prefillGraphsInfo)[graph_id];
+    QNN_INFO("Prefill graph %u : %s", graph_id, graphInfo.graphName);
+    if (iotensor::StatusCode::SUCCESS !=
+        m_ioTensor.setupInputAndOutputTensors(&m_prefillInputTensors[graph_id], &m_prefillOutputTensors[graph_id], graphInfo)) {
+      QNN_ERROR("Error in setting up prefill Input and output Tensors");
+      return StatusCode::FAILURE;
+    }
+    if (graphInfo.numInputTensors != (*m_graphsInfo)[graph_id].numInputTensors ||
+        graphInfo.numOutputTensors != (*m_graphsInfo)[graph_id].numOutputTensors) {
+      QNN_ERROR("Prefill graph %d tensor count mismatch", graph_id);
+      return StatusCode::FAILURE;
+    }
+    for (size_t idx = 1; idx < graphInfo.numInputTensors; idx++) {
+      if (!isSameStateLayout(m_prefillInputTensors[graph_id][idx], m_inputTensors[graph_id][idx]) ||
+          !isSameStateLayout(m_prefillOutputTensors[graph_id][idx - 1], m_outputTensors[graph_id][idx - 1])) {
+        QNN_ERROR("Prefill graph %d state %d layout mismatch", graph_id, idx);
+        return StatusCode::FAILURE;
+      }
+    }
+  }
+
+  if (QNN_TENSOR_GET_RANK(m_prefillInputTensors[0][0]) < 2) {
+    return StatusCode::FAILURE;
+  }
+  m_prefillSeqLength = *(QNN_TENSOR_GET_DIMENSIONS(m_prefillInputTensors[0][0]) + 1);
+  QNN_INFO("Prefill sequence length: %d", m_prefillSeqLength);
+  return m_prefillSeqLength > 1 ? StatusCode::SUCCESS : StatusCode::FAILURE;
+}
+
+// Chunk binaries hold one graph each; a model composed from a library has all of its
+// graphs in the first context.
+Qnn_ContextHandle_t rwkv_app::QnnRwkvApp::graphContext(bool prefill, uint32_t graph_id) {
+  const Qnn_ContextHandle_t *contexts = prefill ? m_prefillContext : m_context;
+  return (graph_id < max_chunks && contexts[graph_id]) ? contexts[graph_id] : contexts[0];
+}
+
+// Moves the last outputs into the state inputs by swapping client buffers.
+void rwkv_app::QnnRwkvApp::copyStatesInPlace() {
+  if (!m_inferenced)
+    return;
+
+  for (size_t graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 1; idx < (*m_graphsInfo)[graph_id].numInputTensors; idx++) {
+      // copyTensor(&m_inputTensors[graph_id][idx], &m_outputTensors[graph_id][idx-1]);
+      // zero copy
+      auto tmp = getQnnTensorClientBuf(m_inputTensors[graph_id][idx]);
+      setQnnTensorClientBuf(m_inputTensors[graph_id][idx], getQnnTensorClientBuf(m_outputTensors[graph_id][idx-1]));
+      setQnnTensorClientBuf(m_outputTensors[graph_id][idx-1], tmp);
+    }
+  }
+}
 
+// Writes the token id, or its embedding when the model takes embeddings, into the
+// first graph's first input.
+void rwkv_app::QnnRwkvApp::writeTokenInput(Qnn_Tensor_t *input, int token) {
   if (m_embedding.empty()) {
-    int *token_input = (int*)QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[0][0]).data;
+    int *token_input = (int*)QNN_TENSOR_GET_CLIENT_BUF(input).data;
     *token_input = token;
   } else {
-    if (QNN_TENSOR_GET_DATA_TYPE(m_inputTensors[0][0]) == QNN_DATATYPE_FLOAT_16) {
-      half_float::half *ptr = (half_float::half*)QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[0][0]).data;
-      for (int i = 0; i < m_embedding.size(); i++) {
-        ptr[i] = half_float::half(m_embedding[token][i]);
-      }
-    } else if (QNN_TENSOR_GET_DATA_TYPE(m_inputTensors[0][0]) == QNN_DATATYPE_FLOAT_32) {
-      float *ptr = (float*)QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[0][0]).data;
-      memcpy(ptr, m_embedding[token].data(), m_embedding[token].size() * sizeof(float));
-    } else {
-      m_ioTensor.copyFromFloatToNative(m_embedding[token].data(), &m_inputTensors[0][0]);
-    }
+    m_ioTensor.copyFromFloatToNative(m_embedding[token].data(), input);
   }
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::execute(int token) {
+  auto returnStatus = StatusCode::SUCCESS;
+
+  if (nullptr == m_inputTensors[0] || nullptr == m_outputTensors[0])
+    return StatusCode::FAILURE;
+
+  writeTokenInput(&m_inputTensors[0][0], token);
 
   for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
     auto graphInfo     = (*m_graphsInfo)[graph_id];
@@ -881,13 +1035,96 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::execute(int token) {
     std::chrono::high_resolution_clock::time_point infer_start = std::chrono::high_resolution_clock::now();
     auto executeStatus =
         m_qnnFunctionPointers.qnnInterface.graphExecute(graphInfo.graph,
-                                                        m_inputTensors[graph_id],
+                                                        m_ioTensor.bindRegisteredBuffers(m_inputTensors[graph_id],
+                                                            graphInfo.numInputTensors, graphContext(false, graph_id), m_executeInputs),
+                                                        graphInfo.numInputTensors,
+                                                        m_ioTensor.bindRegisteredBuffers(m_outputTensors[graph_id],
+                                                            graphInfo.numOutputTensors, graphContext(false, graph_id), m_executeOutputs),
+                                                        graphInfo.numOutputTensors,
+                                                        m_profileBackendHandle,
+                                                        nullptr);
+    std::chrono::high_resolution_clock::time_point infer_end = std::chrono::high_resolution_clock::now();
+    if (!graph_id)
+      m_lastInferenceTime = std::chrono::duration_cast<std::chrono::microseconds>(infer_end - infer_start);
+    else
+      m_lastInferenceTime += std::chrono::duration_cast<std::chrono::microseconds>(infer_end - infer_start);
+
+    if (QNN_GRAPH_NO_ERROR != executeStatus) {
+      returnStatus = StatusCode::FAILURE;
+    }
+  }
+
+  m_inferenced = true;
+
+  return returnStatus;
+}
+
+// Runs exactly m_prefillSeqLength tokens through the sequence graphs. The caller is
+// responsible for moving the last outputs into the state inputs beforehand, the
+// same way as for execute().
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::executeSequence(const int *tokens) {
+  auto returnStatus = StatusCode::SUCCESS;
+
+  if (0 == m_prefillSeqLength || nullptr == m_prefillInputTensors[0] || nullptr == m_prefillOutputTensors[0])
+    return StatusCode::FAILURE;
+
+  if (m_embedding.empty()) {
+    int *token_input = (int*)QNN_TENSOR_GET_CLIENT_BUF(m_prefillInputTensors[0][0]).data;
+    memcpy(token_input, tokens, m_prefillSeqLength * sizeof(int));
+  } else {
+    const size_t n_embd = m_embedding[0].size();
+    if (QNN_TENSOR_GET_DATA_TYPE(m_prefillInputTensors[0][0]) == QNN_DATATYPE_FLOAT_16) {
+      uint16_t *ptr = (uint16_t*)QNN_TENSOR_GET_CLIENT_BUF(m_prefillInputTensors[0][0]).data;
+      for (uint32_t t = 0; t < m_prefillSeqLength; t++) {
+        datautil::kernels::floatToHalf(ptr + t * n_embd, m_embedding[tokens[t]].data(), n_embd);
+      }
+    } else if (QNN_TENSOR_GET_DATA_TYPE(m_prefillInputTensors[0][0]) == QNN_DATATYPE_FLOAT_32) {
+      float *ptr = (float*)QNN_TENSOR_GET_CLIENT_BUF(m_prefillInputTensors[0][0]).data;
+      for (uint32_t t = 0; t < m_prefillSeqLength; t++) {
+        memcpy(ptr + t * n_embd, m_embedding[tokens[t]].data(), n_embd * sizeof(float));
+      }
+    } else {
+      std::vector<float> buffer(m_prefillSeqLength * n_embd);
+      for (uint32_t t = 0; t < m_prefillSeqLength; t++) {
+        memcpy(buffer.data() + t * n_embd, m_embedding[tokens[t]].data(), n_embd * sizeof(float));
+      }
+      m_ioTensor.copyFromFloatToNative(buffer.data(), &m_prefillInputTensors[0][0]);
+    }
+  }
+
+  // swapping twice restores the prefill graphs' own buffers
+  auto swapStates = [this](int graph_id) {
+    for (size_t idx = 1; idx < (*m_prefillGraphsInfo)[graph_id].numInputTensors; idx++) {
+      auto tmp = getQnnTensorClientBuf(m_prefillInputTensors[graph_id][idx]);
+      setQnnTensorClientBuf(m_prefillInputTensors[graph_id][idx], getQnnTensorClientBuf(m_inputTensors[graph_id][idx]));
+      setQnnTensorClientBuf(m_inputTensors[graph_id][idx], tmp);
+      tmp = getQnnTensorClientBuf(m_prefillOutputTensors[graph_id][idx - 1]);
+      setQnnTensorClientBuf(m_prefillOutputTensors[graph_id][idx - 1], getQnnTensorClientBuf(m_outputTensors[graph_id][idx - 1]));
+      setQnnTensorClientBuf(m_outputTensors[graph_id][idx - 1], tmp);
+    }
+  };
+
+  for (uint32_t graph_id = 0; graph_id < m_prefillGraphsCount; graph_id++) {
+    auto graphInfo     = (*m_prefillGraphsInfo)[graph_id];
+    if (graph_id) { // chunked models
+      auto tmp = getQnnTensorClientBuf(&m_prefillInputTensors[graph_id][0]);
+      setQnnTensorClientBuf(&m_prefillInputTensors[graph_id][0], getQnnTensorClientBuf(&m_prefillOutputTensors[graph_id - 1][(*m_prefillGraphsInfo)[graph_id - 1].numOutputTensors - 1]));
+      setQnnTensorClientBuf(&m_prefillOutputTensors[graph_id - 1][(*m_prefillGraphsInfo)[graph_id - 1].numOutputTensors - 1], tmp);
+    }
+    swapStates(graph_id);
+    std::chrono::high_resolution_clock::time_point infer_start = std::chrono::high_resolution_clock::now();
+    auto executeStatus =
+        m_qnnFunctionPointers.qnnInterface.graphExecute(graphInfo.graph,
+                                                        m_ioTensor.bindRegisteredBuffers(m_prefillInputTensors[graph_id],
+                                                            graphInfo.numInputTensors, graphContext(true, graph_id), m_executeInputs),
                                                         graphInfo.numInputTensors,
-                                                        m_outputTensors[graph_id],
+                                                        m_ioTensor.bindRegisteredBuffers(m_prefillOutputTensors[graph_id],
+                                                            graphInfo.numOutputTensors, graphContext(true, graph_id), m_executeOutputs),
                                                         graphInfo.numOutputTensors,
                                                         m_profileBackendHandle,
                                                         nullptr);
     std::chrono::high_resolution_clock::time_point infer_end = std::chrono::high_resolution_clock::now();
+    swapStates(graph_id);
     if (!graph_id)
       m_lastInferenceTime = std::chrono::duration_cast<std::chrono::microseconds>(infer_end - infer_start);
     else
@@ -903,7 +1140,34 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::execute(int token) {
   return returnStatus;
 }
 
+// Converts the logits of the last execute() (or, with sequence set, of every position
+// of the last executeSequence()) to float.
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::readLogits(bool sequence, std::vector<float> &logits) {
+  Qnn_Tensor_t **outputTensors = sequence ? m_prefillOutputTensors : m_outputTensors;
+  auto graphsInfo              = sequence ? m_prefillGraphsInfo : m_graphsInfo;
+  uint32_t graphsCount         = sequence ? m_prefillGraphsCount : m_graphsCount;
+  if (0 == graphsCount || nullptr == outputTensors[graphsCount - 1]) {
+    return StatusCode::FAILURE;
+  }
+  Qnn_Tensor_t *tensor = &outputTensors[graphsCount - 1][(*graphsInfo)[graphsCount - 1].numOutputTensors - 1];
+  logits.resize(getTensorElementCount(*tensor));
+  if (iotensor::StatusCode::SUCCESS != m_ioTensor.convertToFloat(logits.data(), tensor)) {
+    return StatusCode::FAILURE;
+  }
+  return StatusCode::SUCCESS;
+}
+
 rwkv_app::StatusCode rwkv_app::QnnRwkvApp::freeGraphs() {
+  m_async.reset();
+  m_pipeline.reset();
+  m_speculative.reset();
+  m_beamSearch.reset();
+  // hand the IOTensor-owned buffers back to the tensors before tearing them down
+  activateSession(&m_defaultSession);
+  while (!m_sessions.empty()) {
+    destroySession(m_sessions.back().get());
+  }
+
   for (int i = 0; i < m_graphsCount; i++) {
     auto graphInfo     = (*m_graphsInfo)[i];
     m_ioTensor.tearDownInputAndOutputTensors(
@@ -914,9 +1178,433 @@ rwkv_app::StatusCode rwkv_app::QnnRwkvApp::freeGraphs() {
 
   qnn_wrapper_api::freeGraphsInfo(&m_graphsInfo, m_graphsCount);
   m_graphsInfo = nullptr;
+  m_initialState.clear();
+
+  for (uint32_t i = 0; i < m_prefillGraphsCount; i++) {
+    auto graphInfo     = (*m_prefillGraphsInfo)[i];
+    m_ioTensor.tearDownInputAndOutputTensors(
+        m_prefillInputTensors[i], m_prefillOutputTensors[i], graphInfo.numInputTensors, graphInfo.numOutputTensors);
+    m_prefillInputTensors[i]  = nullptr;
+    m_prefillOutputTensors[i] = nullptr;
+  }
+  if (m_prefillGraphsInfo) {
+    qnn_wrapper_api::freeGraphsInfo(&m_prefillGraphsInfo, m_prefillGraphsCount);
+    m_prefillGraphsInfo = nullptr;
+  }
   return StatusCode::SUCCESS;
 }
 
+static bool allocateZeroedBuffer(Qnn_Tensor_t tensor, Qnn_ClientBuffer_t &buffer, iotensor::IOTensor &ioTensor) {
+  buffer.dataSize = QNN_TENSOR_GET_CLIENT_BUF(tensor).dataSize;
+  buffer.data = ioTensor.allocator()->allocate(buffer.dataSize);
+  if (nullptr == buffer.data) {
+    return false;
+  }
+  setQnnTensorClientBuf(tensor, buffer);
+  ioTensor.fillWithZero(&tensor);
+  return true;
+}
+
+rwkv_app::QnnRwkvSession *rwkv_app::QnnRwkvApp::createSession() {
+  if (nullptr == m_inputTensors[0] || nullptr == m_outputTensors[0])
+    return nullptr;
+
+  std::unique_ptr<QnnRwkvSession> session(new QnnRwkvSession());
+  bool ok = true;
+  session->inputBuffers.resize(m_graphsCount);
+  session->outputBuffers.resize(m_graphsCount);
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    auto graphInfo = (*m_graphsInfo)[graph_id];
+    for (size_t idx = 1; idx < graphInfo.numInputTensors; idx++) {
+      Qnn_ClientBuffer_t buffer = QNN_CLIENT_BUFFER_INIT;
+      ok = ok && allocateZeroedBuffer(m_inputTensors[graph_id][idx], buffer, m_ioTensor);
+      session->inputBuffers[graph_id].push_back(buffer);
+      buffer = QNN_CLIENT_BUFFER_INIT;
+      ok = ok && allocateZeroedBuffer(m_outputTensors[graph_id][idx - 1], buffer, m_ioTensor);
+      session->outputBuffers[graph_id].push_back(buffer);
+    }
+  }
+  auto lastGraph = (*m_graphsInfo)[m_graphsCount - 1];
+  ok = ok && allocateZeroedBuffer(m_outputTensors[m_graphsCount - 1][lastGraph.numOutputTensors - 1],
+                                  session->logitsBuffer, m_ioTensor);
+
+  m_sessions.push_back(std::move(session));
+  if (!ok) {
+    QNN_ERROR("Failed to allocate session state buffers");
+    destroySession(m_sessions.back().get());
+    return nullptr;
+  }
+  return m_sessions.back().get();
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::destroySession(QnnRwkvSession *session) {
+  if (nullptr == session || &m_defaultSession == session)
+    return StatusCode::FAILURE;
+
+  auto it = std::find_if(m_sessions.begin(), m_sessions.end(),
+                         [session](const std::unique_ptr<QnnRwkvSession> &s) { return s.get() == session; });
+  if (it == m_sessions.end())
+    return StatusCode::FAILURE;
+
+  if (m_activeSession == session)
+    activateSession(&m_defaultSession);
+
+  auto allocator = m_ioTensor.allocator();
+  for (auto &buffers : session->inputBuffers)
+    for (auto &buffer : buffers)
+      if (buffer.data)
+        allocator->deallocate(buffer.data);
+  for (auto &buffers : session->outputBuffers)
+    for (auto &buffer : buffers)
+      if (buffer.data)
+        allocator->deallocate(buffer.data);
+  if (session->logitsBuffer.data)
+    allocator->deallocate(session->logitsBuffer.data);
+  m_sessions.erase(it);
+  return StatusCode::SUCCESS;
+}
+
+// Maps a public session handle to the session, nullptr being the default session.
+rwkv_app::QnnRwkvSession *rwkv_app::QnnRwkvApp::findSession(void *handle) {
+  if (nullptr == handle)
+    return &m_defaultSession;
+  for (auto &session : m_sessions) {
+    if (session.get() == handle)
+      return session.get();
+  }
+  return nullptr;
+}
+
+// Rebinds client buffers only, the same way the in-place state copy does.
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::activateSession(QnnRwkvSession *session) {
+  if (nullptr == session)
+    return StatusCode::FAILURE;
+  if (m_activeSession == session)
+    return StatusCode::SUCCESS;
+  if (nullptr == m_inputTensors[0] || nullptr == m_outputTensors[0])
+    return StatusCode::FAILURE;
+  if (findSession(session) != session)
+    return StatusCode::FAILURE;
+
+  captureSessionBuffers(m_activeSession);
+  bindSessionBuffers(session);
+  m_activeSession = session;
+  return StatusCode::SUCCESS;
+}
+
+void rwkv_app::QnnRwkvApp::captureSessionBuffers(QnnRwkvSession *session) {
+  session->inputBuffers.resize(m_graphsCount);
+  session->outputBuffers.resize(m_graphsCount);
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    auto graphInfo = (*m_graphsInfo)[graph_id];
+    session->inputBuffers[graph_id].resize(graphInfo.numInputTensors - 1);
+    session->outputBuffers[graph_id].resize(graphInfo.numInputTensors - 1);
+    for (size_t idx = 1; idx < graphInfo.numInputTensors; idx++) {
+      session->inputBuffers[graph_id][idx - 1] = getQnnTensorClientBuf(m_inputTensors[graph_id][idx]);
+      session->outputBuffers[graph_id][idx - 1] = getQnnTensorClientBuf(m_outputTensors[graph_id][idx - 1]);
+    }
+  }
+  auto lastGraph = (*m_graphsInfo)[m_graphsCount - 1];
+  session->logitsBuffer = getQnnTensorClientBuf(m_outputTensors[m_graphsCount - 1][lastGraph.numOutputTensors - 1]);
+  session->inferenced = m_inferenced;
+}
+
+void rwkv_app::QnnRwkvApp::bindSessionBuffers(QnnRwkvSession *session) {
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    auto graphInfo = (*m_graphsInfo)[graph_id];
+    for (size_t idx = 1; idx < graphInfo.numInputTensors; idx++) {
+      setQnnTensorClientBuf(m_inputTensors[graph_id][idx], session->inputBuffers[graph_id][idx - 1]);
+      setQnnTensorClientBuf(m_outputTensors[graph_id][idx - 1], session->outputBuffers[graph_id][idx - 1]);
+    }
+  }
+  auto lastGraph = (*m_graphsInfo)[m_graphsCount - 1];
+  setQnnTensorClientBuf(m_outputTensors[m_graphsCount - 1][lastGraph.numOutputTensors - 1], session->logitsBuffer);
+  m_inferenced = session->inferenced;
+}
+
+// Copies the state of a parked session into another parked session. The logits are
+// not copied; they are rewritten by the next execute.
+void rwkv_app::QnnRwkvApp::copySessionState(QnnRwkvSession *dst, const QnnRwkvSession *src) {
+  auto &from = src->inferenced ? src->outputBuffers : src->inputBuffers;
+  auto &to   = src->inferenced ? dst->outputBuffers : dst->inputBuffers;
+  for (size_t graph_id = 0; graph_id < from.size(); graph_id++) {
+    for (size_t idx = 0; idx < from[graph_id].size(); idx++) {
+      memcpy(to[graph_id][idx].data, from[graph_id][idx].data, from[graph_id][idx].dataSize);
+    }
+  }
+  dst->inferenced = src->inferenced;
+}
+
+// Native-dtype state snapshots. The live state sits in the output buffers once a
+// token has been executed and in the input buffers before that.
+size_t rwkv_app::QnnRwkvApp::getStateSize() {
+  size_t size = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 0; idx < (*m_graphsInfo)[graph_id].numOutputTensors - 1; idx++) {
+      size += QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][idx]).dataSize;
+    }
+  }
+  return size;
+}
+
+// Start of the buffers of tensors[first, first + count) when they lie back to back,
+// as they do in a graph's arena while all of its states are swapped together (the
+// tensor sizes permitting); nullptr otherwise, e.g. while a session is active.
+static uint8_t *contiguousStates(Qnn_Tensor_t *tensors, size_t first, size_t count, size_t &size) {
+  if (0 == count)
+    return nullptr;
+  uint8_t *start = static_cast<uint8_t *>(QNN_TENSOR_GET_CLIENT_BUF(tensors[first]).data);
+  uint8_t *next  = start;
+  for (size_t idx = first; idx < first + count; idx++) {
+    auto clientBuf = QNN_TENSOR_GET_CLIENT_BUF(tensors[idx]);
+    if (clientBuf.data != next)
+      return nullptr;
+    next += clientBuf.dataSize;
+  }
+  size = next - start;
+  return start;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::saveStates(uint8_t *buffer, size_t size) {
+  if (nullptr == m_outputTensors[0] || size < getStateSize())
+    return StatusCode::FAILURE;
+
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    const size_t numStates = (*m_graphsInfo)[graph_id].numOutputTensors - 1;
+    size_t bytes = 0;
+    uint8_t *states = m_inferenced ? contiguousStates(m_outputTensors[graph_id], 0, numStates, bytes)
+                                   : contiguousStates(m_inputTensors[graph_id], 1, numStates, bytes);
+    if (states) {
+      memcpy(buffer, states, bytes);
+      buffer += bytes;
+      continue;
+    }
+    for (size_t idx = 0; idx < numStates; idx++) {
+      auto clientBuf = m_inferenced ? QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][idx])
+                                    : QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[graph_id][idx + 1]);
+      memcpy(buffer, clientBuf.data, clientBuf.dataSize);
+      buffer += clientBuf.dataSize;
+    }
+  }
+  return StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::loadStates(const uint8_t *buffer, size_t size) {
+  if (nullptr == m_outputTensors[0] || size != getStateSize())
+    return StatusCode::FAILURE;
+
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    const size_t numStates = (*m_graphsInfo)[graph_id].numOutputTensors - 1;
+    size_t bytes = 0;
+    uint8_t *states = contiguousStates(m_outputTensors[graph_id], 0, numStates, bytes);
+    if (states) {
+      memcpy(states, buffer, bytes);
+      buffer += bytes;
+      continue;
+    }
+    for (size_t idx = 0; idx < numStates; idx++) {
+      auto clientBuf = QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][idx]);
+      memcpy(clientBuf.data, buffer, clientBuf.dataSize);
+      buffer += clientBuf.dataSize;
+    }
+  }
+  m_inferenced = true;
+  return StatusCode::SUCCESS;
+}
+
+// A memcpy of the initial image per graph (per tensor while a session is bound),
+// instead of re-encoding zeros for every quantized state tensor.
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::resetStates() {
+  if (m_initialState.empty())
+    return StatusCode::FAILURE;
+  return loadStates(m_initialState.data(), m_initialState.size());
+}
+
+// State image layout: header, one StateTensorInfo per state tensor, then the raw
+// native bytes of each tensor at 64-byte aligned offsets so a mapped file can be
+// copied from directly.
+namespace {
+const char g_stateImageMagic[8] = {'R', 'W', 'K', 'V', 'S', 'T', 'A', 'T'};
+const uint32_t g_stateImageVersion = 1;
+const size_t g_stateImageAlignment = 64;
+
+struct StateImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numTensors;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+
+struct StateTensorInfo {
+  uint32_t dataType;
+  int32_t offset;
+  float scale;
+  uint32_t reserved;
+  uint64_t byteOffset;  // relative to dataOffset
+  uint64_t byteSize;
+};
+
+inline size_t alignUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+size_t rwkv_app::QnnRwkvApp::getStateImageSize() {
+  size_t numTensors = 0, dataSize = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 0; idx < (*m_graphsInfo)[graph_id].numOutputTensors - 1; idx++) {
+      dataSize += alignUp(QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][idx]).dataSize, g_stateImageAlignment);
+      numTensors++;
+    }
+  }
+  return alignUp(sizeof(StateImageHeader) + numTensors * sizeof(StateTensorInfo), g_stateImageAlignment) + dataSize;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::saveStateImage(uint8_t *buffer, size_t size) {
+  if (nullptr == m_outputTensors[0] || nullptr == buffer || size < getStateImageSize())
+    return StatusCode::FAILURE;
+
+  uint32_t numTensors = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    numTensors += (*m_graphsInfo)[graph_id].numOutputTensors - 1;
+  }
+  StateImageHeader header;
+  memcpy(header.magic, g_stateImageMagic, sizeof(header.magic));
+  header.version    = g_stateImageVersion;
+  header.numTensors = numTensors;
+  header.dataOffset = alignUp(sizeof(StateImageHeader) + numTensors * sizeof(StateTensorInfo), g_stateImageAlignment);
+  header.dataSize   = getStateImageSize() - header.dataOffset;
+  memset(buffer, 0, header.dataOffset);
+  memcpy(buffer, &header, sizeof(header));
+
+  StateTensorInfo *infos = reinterpret_cast<StateTensorInfo *>(buffer + sizeof(StateImageHeader));
+  uint64_t byteOffset = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 0; idx < (*m_graphsInfo)[graph_id].numOutputTensors - 1; idx++) {
+      auto &tensor   = m_outputTensors[graph_id][idx];
+      auto clientBuf = m_inferenced ? QNN_TENSOR_GET_CLIENT_BUF(tensor)
+                                    : QNN_TENSOR_GET_CLIENT_BUF(m_inputTensors[graph_id][idx + 1]);
+      StateTensorInfo info;
+      info.dataType   = QNN_TENSOR_GET_DATA_TYPE(tensor);
+      info.offset     = QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset;
+      info.scale      = QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale;
+      info.reserved   = 0;
+      info.byteOffset = byteOffset;
+      info.byteSize   = clientBuf.dataSize;
+      memcpy(infos++, &info, sizeof(info));
+      memcpy(buffer + header.dataOffset + byteOffset, clientBuf.data, clientBuf.dataSize);
+      byteOffset += alignUp(clientBuf.dataSize, g_stateImageAlignment);
+    }
+  }
+  return StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::loadStateImage(const uint8_t *buffer, size_t size) {
+  if (nullptr == m_outputTensors[0] || nullptr == buffer || size < sizeof(StateImageHeader))
+    return StatusCode::FAILURE;
+
+  StateImageHeader header;
+  memcpy(&header, buffer, sizeof(header));
+  if (memcmp(header.magic, g_stateImageMagic, sizeof(header.magic)) || header.version != g_stateImageVersion) {
+    QNN_ERROR("Not a state image or unsupported version");
+    return StatusCode::FAILURE;
+  }
+  // sizes come from the file, so compare without sums that could wrap
+  if (header.dataOffset > size || header.dataSize > size - header.dataOffset ||
+      sizeof(StateImageHeader) + (uint64_t)header.numTensors * sizeof(StateTensorInfo) > header.dataOffset) {
+    QNN_ERROR("Truncated state image");
+    return StatusCode::FAILURE;
+  }
+
+  uint32_t numTensors = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    numTensors += (*m_graphsInfo)[graph_id].numOutputTensors - 1;
+  }
+  if (numTensors != header.numTensors) {
+    QNN_ERROR("State image has %d tensors, model has %d", header.numTensors, numTensors);
+    return StatusCode::FAILURE;
+  }
+
+  // validate everything before touching the live state
+  const uint8_t *infos = buffer + sizeof(StateImageHeader);
+  uint32_t tensorIdx = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 0; idx < (*m_graphsInfo)[graph_id].numOutputTensors - 1; idx++, tensorIdx++) {
+      auto &tensor = m_outputTensors[graph_id][idx];
+      StateTensorInfo info;
+      memcpy(&info, infos + tensorIdx * sizeof(StateTensorInfo), sizeof(info));
+      if (info.dataType != QNN_TENSOR_GET_DATA_TYPE(tensor) ||
+          info.byteSize != QNN_TENSOR_GET_CLIENT_BUF(tensor).dataSize ||
+          info.byteOffset > header.dataSize || info.byteSize > header.dataSize - info.byteOffset ||
+          (info.dataType != QNN_DATATYPE_FLOAT_16 && info.dataType != QNN_DATATYPE_FLOAT_32 &&
+           (info.scale != QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale ||
+            info.offset != QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset))) {
+        QNN_ERROR("State image does not match the model at tensor %d", tensorIdx);
+        return StatusCode::FAILURE;
+      }
+    }
+  }
+
+  tensorIdx = 0;
+  for (int graph_id = 0; graph_id < m_graphsCount; graph_id++) {
+    for (size_t idx = 0; idx < (*m_graphsInfo)[graph_id].numOutputTensors - 1; idx++, tensorIdx++) {
+      StateTensorInfo info;
+      memcpy(&info, infos + tensorIdx * sizeof(StateTensorInfo), sizeof(info));
+      memcpy(QNN_TENSOR_GET_CLIENT_BUF(m_outputTensors[graph_id][idx]).data,
+             buffer + header.dataOffset + info.byteOffset, info.byteSize);
+    }
+  }
+  m_inferenced = true;
+  return StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::saveStateImageToFile(const std::string &path) {
+  std::vector<uint8_t> image(getStateImageSize());
+  if (StatusCode::SUCCESS != saveStateImage(image.data(), image.size()))
+    return StatusCode::FAILURE;
+  std::ofstream file(path, std::ios::out | std::ios::binary);
+  if (!file.write(reinterpret_cast<const char *>(image.data()), image.size())) {
+    QNN_ERROR("Failed to write state image %s", path.c_str());
+    return StatusCode::FAILURE;
+  }
+  return StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::QnnRwkvApp::loadStateImageFromFile(const std::string &path) {
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    QNN_ERROR("Failed to open file %s", path.c_str());
+    return StatusCode::FAILURE;
+  }
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size <= 0) {
+    close(fd);
+    return StatusCode::FAILURE;
+  }
+  void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    QNN_ERROR("Failed to mmap file %s", path.c_str());
+    return StatusCode::FAILURE;
+  }
+  auto returnStatus = loadStateImage(static_cast<const uint8_t *>(image), size);
+  munmap(image, size);
+  return returnStatus;
+#else
+  tools::datautil::StatusCode status{tools::datautil::StatusCode::SUCCESS};
+  size_t size = 0;
+  std::tie(status, size) = tools::datautil::getFileSize(path);
+  if (0 == size)
+    return StatusCode::FAILURE;
+  std::vector<uint8_t> image(size);
+  if (tools::datautil::StatusCode::SUCCESS != tools::datautil::readBinaryFromFile(path, image.data(), size))
+    return StatusCode::FAILURE;
+  return loadStateImage(image.data(), size);
+#endif
+}
+
 void rwkv_app::QnnRwkvApp::copyTensor(Qnn_Tensor_t *dst, Qnn_Tensor_t *src) {
     std::vector<size_t> dims;
     for (int i = 0; i < QNN_TENSOR_GET_RANK(dst); i++) {
@@ -943,37 +1631,8 @@ void rwkv_app::QnnRwkvApp::copyTensor(Qnn_Tensor_t *dst, Qnn_Tensor_t *src) {
                             datautil::calculateElementCount(dims) * sizeof(int16_t));
     }
     else {
-      float *buffer;
-      if (QNN_TENSOR_GET_DATA_TYPE(src) == QNN_DATATYPE_FLOAT_16) {
-        half_float::half *ptr = (half_float::half*)QNN_TENSOR_GET_CLIENT_BUF(src).data;
-        buffer = (float*)malloc(datautil::calculateElementCount(dims) * sizeof(float));
-        for (int i = 0; i < datautil::calculateElementCount(dims); i++) {
-          buffer[i] = float(ptr[i]);
-        }
-      } else if (QNN_TENSOR_GET_DATA_TYPE(src) != QNN_DATATYPE_FLOAT_32) {
-        m_ioTensor.convertToFloat(&buffer, src);
-      } else {
-        buffer = (float*)malloc(datautil::calculateElementCount(dims) * sizeof(float));
-        pal::StringOp::memscpy(buffer,
-                              datautil::calculateElementCount(dims) * sizeof(float),
-                              QNN_TENSOR_GET_CLIENT_BUF(src).data,
-                              datautil::calculateElementCount(dims) * sizeof(float));
-      }
-
-      if (QNN_TENSOR_GET_DATA_TYPE(dst) == QNN_DATATYPE_FLOAT_16) {
-        half_float::half *ptr = (half_float::half*)QNN_TENSOR_GET_CLIENT_BUF(dst).data;
-        for (int i = 0; i < datautil::calculateElementCount(dims); i++) {
-          ptr[i] = half_float::half(buffer[i]);
-          free(buffer);
-        }
-      } else if (QNN_TENSOR_GET_DATA_TYPE(dst) != QNN_DATATYPE_FLOAT_32) {
-        m_ioTensor.copyFromFloatToNative(buffer, dst);
-        free(buffer);
-      } else {
-        pal::StringOp::memscpy(QNN_TENSOR_GET_CLIENT_BUF(dst).data,
-                              datautil::calculateElementCount(dims) * sizeof(float),
-                              buffer,
-                              datautil::calculateElementCount(dims) * sizeof(float));
-      }
+      std::vector<float> buffer(datautil::calculateElementCount(dims));
+      m_ioTensor.convertToFloat(buffer.data(), src);
+      m_ioTensor.copyFromFloatToNative(buffer.data(), dst);
     }
   };
@@ -6,6 +6,7 @@
 
 #include "IOTensor.hpp"
 #include "Interfaces.hpp"
+#include "PrefixCache.hpp"
 #include "half.hpp"
 
 namespace qnn {
@@ -23,6 +24,20 @@ enum class StatusCode {
 
 const int max_chunks = 8;
 
+class PipelineExecutor;
+class AsyncExecutor;
+class SpeculativeDecoder;
+class BeamSearch;
+
+// State buffers of one conversation. The active session's buffers are bound to
+// m_inputTensors/m_outputTensors, the others are parked here until activated.
+struct QnnRwkvSession {
+  std::vector<std::vector<Qnn_ClientBuffer_t>> inputBuffers;   // [graph][input idx - 1]
+  std::vector<std::vector<Qnn_ClientBuffer_t>> outputBuffers;  // [graph][output idx]
+  Qnn_ClientBuffer_t logitsBuffer = QNN_CLIENT_BUFFER_INIT;
+  bool inferenced = false;
+};
+
 class QnnRwkvApp {
  public:
   QnnRwkvApp(QnnFunctionPointers qnnFunctionPointers,
@@ -57,14 +72,68 @@ class QnnRwkvApp {
 
   StatusCode initializeTensors();
 
+  Qnn_ContextHandle_t graphContext(bool prefill, uint32_t graph_id);
+
+  void copyStatesInPlace();
+
+  void writeTokenInput(Qnn_Tensor_t *input, int token);
+
   StatusCode execute(int token);
 
+  StatusCode executeSequence(const int *tokens);
+
+  StatusCode readLogits(bool sequence, std::vector<float> &logits);
+
   void copyTensor(Qnn_Tensor_t *dst, Qnn_Tensor_t *src);
 
+  QnnRwkvSession *createSession();
+
+  StatusCode destroySession(QnnRwkvSession *session);
+
+  StatusCode activateSession(QnnRwkvSession *session);
+
+  QnnRwkvSession *findSession(void *handle);
+
+  void captureSessionBuffers(QnnRwkvSession *session);
+
+  void bindSessionBuffers(QnnRwkvSession *session);
+
+  void copySessionState(QnnRwkvSession *dst, const QnnRwkvSession *src);
+
+  size_t getStateSize();
+
+  StatusCode saveStates(uint8_t *buffer, size_t size);
+
+  StatusCode loadStates(const uint8_t *buffer, size_t size);
+
+  StatusCode resetStates();
+
+  size_t getStateImageSize();
+
+  StatusCode saveStateImage(uint8_t *buffer, size_t size);
+
+  StatusCode loadStateImage(const uint8_t *buffer, size_t size);
+
+  StatusCode saveStateImageToFile(const std::string &path);
+
+  StatusCode loadStateImageFromFile(const std::string &path);
+
   StatusCode registerOpPackages();
 
   StatusCode createFromBinary(uint8_t *binary, size_t binarySize);
 
+  StatusCode readBinaryFromFile(const std::string &path,
+                                std::shared_ptr<uint8_t> &buffer,
+                                uint64_t &bufferSize);
+
+  StatusCode createContextsFromBuffers(std::vector<std::shared_ptr<uint8_t>> &buffer,
+                                       std::vector<uint64_t> &bufferSizes,
+                                       Qnn_ContextHandle_t *contexts,
+                                       qnn_wrapper_api::GraphInfo_t **&graphsInfo,
+                                       uint32_t &graphsCount);
+
+  StatusCode initializePrefillTensors();
+
   StatusCode saveBinary();
 
   StatusCode freeContext();
@@ -119,7 +188,29 @@ class QnnRwkvApp {
   iotensor::IOTensor m_ioTensor;
   Qnn_Tensor_t *m_inputTensors[max_chunks] = {nullptr};
   Qnn_Tensor_t *m_outputTensors[max_chunks] = {nullptr};
+  // sequence (prefill) graphs, sharing the state buffers of the decode graphs above
+  Qnn_ContextHandle_t m_prefillContext[max_chunks] = {nullptr};
+  qnn_wrapper_api::GraphInfo_t **m_prefillGraphsInfo = nullptr;
+  uint32_t m_prefillGraphsCount = 0;
+  uint32_t m_prefillSeqLength = 0;
+  // execute-time copies of the tensors with registered buffers bound as memory handles
+  std::vector<Qnn_Tensor_t> m_executeInputs;
+  std::vector<Qnn_Tensor_t> m_executeOutputs;
+  Qnn_Tensor_t *m_prefillInputTensors[max_chunks] = {nullptr};
+  Qnn_Tensor_t *m_prefillOutputTensors[max_chunks] = {nullptr};
   std::vector<std::vector<float>> m_embedding = {};
+  // the default session holds the buffers allocated by m_ioTensor
+  QnnRwkvSession m_defaultSession;
+  QnnRwkvSession *m_activeSession = &m_defaultSession;
+  std::vector<std::unique_ptr<QnnRwkvSession>> m_sessions;
+  std::unique_ptr<prefixcache::PrefixCache> m_prefixCache;
+  std::unique_ptr<PipelineExecutor> m_pipeline;
+  std::unique_ptr<AsyncExecutor> m_async;
+  std::unique_ptr<SpeculativeDecoder> m_speculative;
+  std::unique_ptr<BeamSearch> m_beamSearch;
+  // native initial state in the saveStates() layout, captured after the tensors
+  // are zeroed at init
+  std::vector<uint8_t> m_initialState;
   bool m_isExternalWkv = false;
   bool m_inferenced = false;
   bool m_isBackendInitialized;
@@ -0,0 +1,151 @@
+#include "Logger.hpp"
+#include "QnnTypeMacros.hpp"
+#include "librwkv-qualcomm-async.hpp"
+
+using namespace qnn;
+using namespace qnn::tools;
+
+rwkv_app::AsyncExecutor::AsyncExecutor(QnnRwkvApp *app)
+    : m_app(app), m_useAsync(nullptr != app->m_qnnFunctionPointers.qnnInterface.graphExecuteAsync) {
+  if (!m_useAsync) {
+    QNN_INFO("graphExecuteAsync is not available, calling execute on the worker thread");
+  }
+  m_worker = std::thread(&AsyncExecutor::worker, this);
+}
+
+rwkv_app::AsyncExecutor::~AsyncExecutor() {
+  waitAll();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_worker.joinable()) {
+    m_worker.join();
+  }
+}
+
+uint64_t rwkv_app::AsyncExecutor::submit(int token, Callback done) {
+  Request request;
+  request.token = token;
+  request.done  = done;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    request.id = m_nextId++;
+    m_pending.push_back(request);
+  }
+  m_cv.notify_all();
+  return request.id;
+}
+
+rwkv_app::StatusCode rwkv_app::AsyncExecutor::executeAsync(int token) {
+  auto start = std::chrono::high_resolution_clock::now();
+  m_app->writeTokenInput(&m_app->m_inputTensors[0][0], token);
+  for (uint32_t graph_id = 0; graph_id < m_app->m_graphsCount; graph_id++) {
+    auto graphInfo = (*m_app->m_graphsInfo)[graph_id];
+    if (graph_id) { // chunked models
+      auto &hiddenOutput = m_app->m_outputTensors[graph_id - 1][(*m_app->m_graphsInfo)[graph_id - 1].numOutputTensors - 1];
+      auto tmp = getQnnTensorClientBuf(&m_app->m_inputTensors[graph_id][0]);
+      setQnnTensorClientBuf(&m_app->m_inputTensors[graph_id][0], getQnnTensorClientBuf(&hiddenOutput));
+      setQnnTensorClientBuf(&hiddenOutput, tmp);
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_graphDone = false;
+    }
+    auto executeStatus =
+        m_app->m_qnnFunctionPointers.qnnInterface.graphExecuteAsync(graphInfo.graph,
+                                                                    m_app->m_ioTensor.bindRegisteredBuffers(
+                                                                        m_app->m_inputTensors[graph_id], graphInfo.numInputTensors,
+                                                                        m_app->graphContext(false, graph_id), m_app->m_executeInputs),
+                                                                    graphInfo.numInputTensors,
+                                                                    m_app->m_ioTensor.bindRegisteredBuffers(
+                                                                        m_app->m_outputTensors[graph_id], graphInfo.numOutputTensors,
+                                                                        m_app->graphContext(false, graph_id), m_app->m_executeOutputs),
+                                                                    graphInfo.numOutputTensors,
+                                                                    nullptr,
+                                                                    nullptr,
+                                                                    &AsyncExecutor::notify,
+                                                                    this);
+    if (QNN_GRAPH_NO_ERROR != executeStatus) {
+      QNN_ERROR("graphExecuteAsync failed for graph %d", graph_id);
+      return StatusCode::FAILURE;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_graphDone; });
+    if (!m_graphSucceeded) {
+      QNN_ERROR("Asynchronous execution of graph %d failed", graph_id);
+      return StatusCode::FAILURE;
+    }
+  }
+  m_app->m_inferenced = true;
+  m_app->m_lastInferenceTime = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start);
+  return StatusCode::SUCCESS;
+}
+
+// Runs in the backend's context: only hands the result to the worker. The mutex is
+// held while notifying so the worker cannot move on (and the executor cannot be
+// destroyed) before this is done with it.
+void rwkv_app::AsyncExecutor::notify(void *param, Qnn_NotifyStatus_t notifyStatus) {
+  AsyncExecutor *self = static_cast<AsyncExecutor *>(param);
+  std::lock_guard<std::mutex> lock(self->m_mutex);
+  self->m_graphSucceeded = QNN_SUCCESS == notifyStatus.error;
+  self->m_graphDone      = true;
+  self->m_cv.notify_all();
+}
+
+void rwkv_app::AsyncExecutor::worker() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+    if (m_pending.empty()) {
+      return;
+    }
+    Request request = m_pending.front();
+    m_pending.pop_front();
+    lock.unlock();
+
+    m_app->copyStatesInPlace();
+    auto status = m_useAsync ? executeAsync(request.token) : m_app->execute(request.token);
+    if (request.done) {
+      request.done(request.id, status);
+    }
+
+    lock.lock();
+    m_completedId = request.id;
+    if (StatusCode::SUCCESS != status) {
+      m_failedIds.insert(request.id);
+    }
+    m_cv.notify_all();
+  }
+}
+
+rwkv_app::StatusCode rwkv_app::AsyncExecutor::completedStatus(uint64_t id) {
+  return m_failedIds.count(id) ? StatusCode::FAILURE : StatusCode::SUCCESS;
+}
+
+rwkv_app::StatusCode rwkv_app::AsyncExecutor::wait(uint64_t id) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (0 == id || id >= m_nextId) {
+    return StatusCode::FAILURE;
+  }
+  m_cv.wait(lock, [this, id] { return m_completedId >= id; });
+  return completedStatus(id);
+}
+
+bool rwkv_app::AsyncExecutor::poll(uint64_t id, StatusCode *status) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (0 == id || id >= m_nextId || m_completedId < id) {
+    return false;
+  }
+  if (status) {
+    *status = completedStatus(id);
+  }
+  return true;
+}
+
+void rwkv_app::AsyncExecutor::waitAll() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this] { return m_completedId + 1 == m_nextId; });
+}
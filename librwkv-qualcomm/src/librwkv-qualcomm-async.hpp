@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "librwkv-qualcomm-app.hpp"
+
+namespace qnn {
+namespace tools {
+namespace rwkv_app {
+
+// Queue of single-token executions completed off the calling thread. Requests run
+// in submission order since each one consumes the state the previous one produced.
+// A worker thread runs them one at a time: with graphExecuteAsync it launches each
+// chunk and waits for the backend's notification, otherwise it calls execute().
+//
+// QNN does not say whether graphExecuteAsync may be entered from a notify callback,
+// so the callback only wakes the worker. A request counts as completed once its
+// callback has returned, which keeps the outputs stable for the callback and means
+// nothing of the executor is in use after waitAll().
+class AsyncExecutor {
+ public:
+  typedef std::function<void(uint64_t id, StatusCode status)> Callback;
+
+  explicit AsyncExecutor(QnnRwkvApp *app);
+
+  ~AsyncExecutor();
+
+  uint64_t submit(int token, Callback done);
+
+  StatusCode wait(uint64_t id);
+
+  bool poll(uint64_t id, StatusCode *status);
+
+  void waitAll();
+
+  // True on the thread running the callbacks
+  bool onWorkerThread() const { return std::this_thread::get_id() == m_worker.get_id(); }
+
+ private:
+  struct Request {
+    uint64_t id = 0;
+    int token   = 0;
+    Callback done;
+  };
+
+  static void notify(void *param, Qnn_NotifyStatus_t notifyStatus);
+
+  // Runs every chunk of the model through graphExecuteAsync
+  StatusCode executeAsync(int token);
+
+  void worker();
+
+  StatusCode completedStatus(uint64_t id);
+
+  QnnRwkvApp *m_app;
+  bool m_useAsync;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Request> m_pending;
+  bool m_graphDone      = false;
+  bool m_graphSucceeded = false;
+  bool m_stop           = false;
+  uint64_t m_nextId      = 1;
+  uint64_t m_completedId = 0;
+  std::set<uint64_t> m_failedIds;
+  std::thread m_worker;
+};
+
+}  // namespace rwkv_app
+}  // namespace tools
+}  // namespace qnn
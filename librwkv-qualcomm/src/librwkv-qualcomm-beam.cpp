@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+
+#include "DataKernels.hpp"
+#include "Logger.hpp"
+#include "librwkv-qualcomm-beam.hpp"
+#include "librwkv-qualcomm-pipeline.hpp"
+
+using namespace qnn;
+using namespace qnn::tools;
+
+rwkv_app::BeamSearch::BeamSearch(QnnRwkvApp *app) : m_app(app) {}
+
+rwkv_app::StatusCode rwkv_app::BeamSearch::preparePool(size_t width) {
+  while (m_pool.size() < width) {
+    QnnRwkvSession *session = m_app->createSession();
+    if (nullptr == session) {
+      QNN_ERROR("Failed to create the beam search sessions");
+      return StatusCode::FAILURE;
+    }
+    m_pool.push_back(session);
+  }
+  return StatusCode::SUCCESS;
+}
+
+void rwkv_app::BeamSearch::expand(size_t beam, size_t k) {
+  const size_t vocabSize = m_logits.size();
+  const float maxLogit   = *std::max_element(m_logits.begin(), m_logits.end());
+  m_probs.resize(vocabSize);
+  datautil::kernels::scaledExp(m_probs.data(), m_logits.data(), maxLogit, 1.f, vocabSize);
+  double sum = 0;
+  for (float p : m_probs) {
+    sum += p;
+  }
+  const float logSum = maxLogit + static_cast<float>(std::log(sum));
+
+  m_topIndex.resize(k);
+  k = datautil::kernels::topK(m_topIndex.data(), m_logits.data(), vocabSize, k);
+  const float logProb = m_beams[beam].logProb;
+  for (size_t i = 0; i < k; i++) {
+    const int token = m_topIndex[i];
+    m_candidates.push_back({beam, token, logProb + m_logits[token] - logSum});
+  }
+}
+
+rwkv_app::StatusCode rwkv_app::BeamSearch::executeStep(size_t k) {
+  QnnRwkvSession *origin = m_app->m_activeSession;
+  m_sessions.clear();
+  m_tokens.clear();
+  for (auto &beam : m_beams) {
+    m_sessions.push_back(beam.session);
+    m_tokens.push_back(beam.tokens.back());
+  }
+
+  // with chunks, one pipelined batch keeps every chunk busy; otherwise the beams
+  // simply take turns
+  const bool pipelined = m_app->m_graphsCount > 1;
+  if (pipelined) {
+    if (!m_app->m_pipeline) {
+      m_app->m_pipeline.reset(new PipelineExecutor(m_app));
+    }
+    if (StatusCode::SUCCESS != m_app->m_pipeline->execute(m_sessions.data(), m_tokens.data(), m_sessions.size())) {
+      return StatusCode::FAILURE;
+    }
+  }
+
+  StatusCode status = StatusCode::SUCCESS;
+  m_candidates.clear();
+  for (size_t i = 0; i < m_beams.size() && StatusCode::SUCCESS == status; i++) {
+    status = m_app->activateSession(m_sessions[i]);
+    if (StatusCode::SUCCESS == status && !pipelined) {
+      m_app->copyStatesInPlace();
+      status = m_app->execute(m_tokens[i]);
+    }
+    if (StatusCode::SUCCESS == status) {
+      status = m_app->readLogits(false, m_logits);
+    }
+    if (StatusCode::SUCCESS == status) {
+      expand(i, k);
+    }
+  }
+  m_app->activateSession(origin);
+  return status;
+}
+
+void rwkv_app::BeamSearch::addFinished(const Beam &parent, int token, float logProb, size_t width, float lengthPenalty) {
+  const float score = logProb / std::pow(static_cast<float>(parent.tokens.size() + 1), lengthPenalty);
+  if (m_finished.size() == width && score <= m_finished.back().score) {
+    return;
+  }
+  auto it = std::upper_bound(m_finished.begin(), m_finished.end(), score,
+                             [](float s, const Hypothesis &h) { return s > h.score; });
+  it = m_finished.insert(it, Hypothesis{parent.tokens, score});
+  it->tokens.push_back(token);
+  if (m_finished.size() > width) {
+    m_finished.pop_back();
+  }
+}
+
+rwkv_app::StatusCode rwkv_app::BeamSearch::search(size_t width, size_t maxTokens, int stopToken, float lengthPenalty,
+                                                  int *output, size_t *generated, float *score) {
+  if (0 == width || 0 == maxTokens || nullptr == output || nullptr == generated) {
+    return StatusCode::FAILURE;
+  }
+  QnnRwkvSession *origin = m_app->m_activeSession;
+  if (StatusCode::SUCCESS != m_app->readLogits(false, m_logits) ||
+      StatusCode::SUCCESS != preparePool(width)) {
+    return StatusCode::FAILURE;
+  }
+  // the origin stays bound; its lists only have to be current for the copies
+  m_app->captureSessionBuffers(origin);
+
+  // a beam can lose at most one of its k candidates to the stop token, so width + 1
+  // per beam always leaves enough to refill every beam
+  const size_t k = width + 1;
+  m_finished.clear();
+  m_candidates.clear();
+  m_beams.clear();
+  m_beams.push_back({origin, {}, 0.f, 0});
+  expand(0, k);
+
+  for (;;) {
+    std::sort(m_candidates.begin(), m_candidates.end(),
+              [](const Candidate &a, const Candidate &b) { return a.logProb > b.logProb; });
+    m_next.clear();
+    for (const auto &candidate : m_candidates) {
+      if (m_next.size() == width) {
+        break;
+      }
+      const Beam &parent = m_beams[candidate.beam];
+      if (candidate.token == stopToken || parent.tokens.size() + 1 == maxTokens) {
+        addFinished(parent, candidate.token, candidate.logProb, width, lengthPenalty);
+        continue;
+      }
+      m_next.push_back({nullptr, parent.tokens, candidate.logProb, candidate.beam});
+      m_next.back().tokens.push_back(candidate.token);
+    }
+
+    // stop once no live beam scores better than the worst kept hypothesis
+    bool done = m_next.empty();
+    if (!done && m_finished.size() == width) {
+      float best = -INFINITY;
+      for (const auto &beam : m_next) {
+        best = std::max(best, beam.logProb / std::pow(static_cast<float>(beam.tokens.size()), lengthPenalty));
+      }
+      done = best <= m_finished.back().score;
+    }
+    if (done) {
+      break;
+    }
+
+    // the first child of a beam continues in its session, the others are forked
+    // into the sessions of beams without children
+    m_taken.assign(m_beams.size(), 0);
+    for (auto &beam : m_next) {
+      const Beam &parent = m_beams[beam.parent];
+      if (parent.session != origin && !m_taken[beam.parent]) {
+        beam.session         = parent.session;
+        m_taken[beam.parent] = 1;
+      }
+    }
+    m_sessions.clear();
+    for (auto session : m_pool) {
+      if (std::none_of(m_next.begin(), m_next.end(), [session](const Beam &b) { return b.session == session; })) {
+        m_sessions.push_back(session);
+      }
+    }
+    for (auto &beam : m_next) {
+      if (nullptr == beam.session) {
+        beam.session = m_sessions.back();
+        m_sessions.pop_back();
+        m_app->copySessionState(beam.session, m_beams[beam.parent].session);
+      }
+    }
+
+    std::swap(m_beams, m_next);
+    if (StatusCode::SUCCESS != executeStep(k)) {
+      QNN_ERROR("Beam search step failure");
+      return StatusCode::FAILURE;
+    }
+  }
+
+  if (m_finished.empty()) {
+    return StatusCode::FAILURE;
+  }
+  const Hypothesis &best = m_finished.front();
+  std::copy(best.tokens.begin(), best.tokens.end(), output);
+  *generated = best.tokens.size();
+  if (score) {
+    *score = best.score;
+  }
+  return StatusCode::SUCCESS;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include "librwkv-qualcomm-app.hpp"
+
+namespace qnn {
+namespace tools {
+namespace rwkv_app {
+
+// Beam search from the active session. Every beam runs on a session of its own, taken
+// from a pool of `width` sessions that is created on first use and kept for later
+// searches. When a beam has several surviving children, the first continues in the
+// parent's session and the others get a copy of its native state in the sessions of
+// pruned beams, so a search does not allocate state buffers after the first one.
+//
+// Each step executes one token per live beam, through the chunk pipeline when the
+// model is split into chunks. The sequence graphs do not help here: they run one
+// session at a time and the beams diverge after the first token.
+class BeamSearch {
+ public:
+  explicit BeamSearch(QnnRwkvApp *app);
+
+  // Searches from the active session's state and last logits. A hypothesis ends with
+  // stopToken (included in the output) or after maxTokens tokens and is scored by its
+  // log-probability divided by length^lengthPenalty. The active session is left as
+  // it was.
+  StatusCode search(size_t width, size_t maxTokens, int stopToken, float lengthPenalty,
+                    int *output, size_t *generated, float *score);
+
+ private:
+  struct Beam {
+    QnnRwkvSession *session;
+    std::vector<int> tokens;
+    float logProb;
+    size_t parent;
+  };
+
+  struct Candidate {
+    size_t beam;
+    int token;
+    float logProb;
+  };
+
+  struct Hypothesis {
+    std::vector<int> tokens;
+    float score;
+  };
+
+  StatusCode preparePool(size_t width);
+
+  // Adds the k most likely continuations of m_beams[beam] from the logits in m_logits
+  void expand(size_t beam, size_t k);
+
+  // Runs the last token of every beam in m_next and expands it
+  StatusCode executeStep(size_t k);
+
+  void addFinished(const Beam &parent, int token, float logProb, size_t width, float lengthPenalty);
+
+  QnnRwkvApp *m_app;
+  std::vector<QnnRwkvSession *> m_pool;
+  std::vector<Beam> m_beams;
+  std::vector<Beam> m_next;
+  std::vector<Candidate> m_candidates;
+  std::vector<Hypothesis> m_finished;
+  std::vector<QnnRwkvSession *> m_sessions;
+  std::vector<int> m_tokens;
+  std::vector<char> m_taken;
+  std::vector<float> m_logits;
+  std::vector<float> m_probs;
+  std::vector<int32_t> m_topIndex;
+};
+
+}  // namespace rwkv_app
+}  // namespace tools
+}  // namespace qnn
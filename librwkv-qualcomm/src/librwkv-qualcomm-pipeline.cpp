@@ -0,0 +1,196 @@
+#include <chrono>
+#include <cstring>
+
+#include "Logger.hpp"
+#include "QnnTypeMacros.hpp"
+#include "librwkv-qualcomm-pipeline.hpp"
+
+using namespace qnn;
+using namespace qnn::tools;
+
+rwkv_app::PipelineExecutor::PipelineExecutor(QnnRwkvApp *app)
+    : m_app(app), m_stages(app->m_graphsCount) {
+  // the hand-off buffers come from the tensor allocator like the graph tensors, so
+  // with shared memory the next chunk reads a hidden state in place
+  auto allocator = m_app->m_ioTensor.allocator();
+  for (uint32_t stage = 0; stage + 1 < m_stages; stage++) {
+    auto graphInfo = (*m_app->m_graphsInfo)[stage];
+    auto hidden    = QNN_TENSOR_GET_CLIENT_BUF(m_app->m_outputTensors[stage][graphInfo.numOutputTensors - 1]);
+    for (int slot = 0; slot < 2; slot++) {
+      Qnn_ClientBuffer_t buffer = QNN_CLIENT_BUFFER_INIT;
+      buffer.data     = allocator->allocate(hidden.dataSize);
+      buffer.dataSize = hidden.dataSize;
+      if (nullptr != buffer.data) {
+        memset(buffer.data, 0, buffer.dataSize);
+      }
+      m_hiddenBuffers.push_back(buffer);
+    }
+  }
+  m_stageInputs.resize(m_stages);
+  m_stageOutputs.resize(m_stages);
+  m_done.resize(m_stages, 0);
+  m_stageSeconds.resize(m_stages, 0);
+  for (uint32_t stage = 0; stage < m_stages; stage++) {
+    m_workers.emplace_back(&PipelineExecutor::worker, this, stage);
+  }
+}
+
+rwkv_app::PipelineExecutor::~PipelineExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+  auto allocator = m_app->m_ioTensor.allocator();
+  for (auto &buffer : m_hiddenBuffers) {
+    allocator->deallocate(buffer.data);
+  }
+  for (auto &buffer : m_inputBuffers) {
+    allocator->deallocate(buffer.data);
+  }
+}
+
+rwkv_app::StatusCode rwkv_app::PipelineExecutor::runStage(uint32_t stage, size_t jobIdx, double &seconds) {
+  Job &job       = m_jobs[jobIdx];
+  auto graphInfo = (*m_app->m_graphsInfo)[stage];
+  if (stage > 0) {
+    setQnnTensorClientBuf(job.inputs[stage][0], m_hiddenBuffers[(stage - 1) * 2 + jobIdx % 2]);
+  }
+  if (stage + 1 < m_stages) {
+    setQnnTensorClientBuf(job.outputs[stage][graphInfo.numOutputTensors - 1], m_hiddenBuffers[stage * 2 + jobIdx % 2]);
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  auto executeStatus =
+      m_app->m_qnnFunctionPointers.qnnInterface.graphExecute(graphInfo.graph,
+                                                             m_app->m_ioTensor.bindRegisteredBuffers(
+                                                                 job.inputs[stage].data(), graphInfo.numInputTensors,
+                                                                 m_app->graphContext(false, stage), m_stageInputs[stage]),
+                                                             graphInfo.numInputTensors,
+                                                             m_app->m_ioTensor.bindRegisteredBuffers(
+                                                                 job.outputs[stage].data(), graphInfo.numOutputTensors,
+                                                                 m_app->graphContext(false, stage), m_stageOutputs[stage]),
+                                                             graphInfo.numOutputTensors,
+                                                             nullptr,
+                                                             nullptr);
+  seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  return QNN_GRAPH_NO_ERROR == executeStatus ? StatusCode::SUCCESS : StatusCode::FAILURE;
+}
+
+// Stage s may run job j once stage s-1 has produced it, and once stage s+1 has
+// consumed job j-2, whose hidden-state slot job j reuses.
+void rwkv_app::PipelineExecutor::worker(uint32_t stage) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  uint64_t seenBatch = 0;
+  while (true) {
+    m_cv.wait(lock, [&] { return m_stop || m_batch != seenBatch; });
+    if (m_stop) {
+      return;
+    }
+    seenBatch = m_batch;
+    for (size_t j = 0; j < m_jobs.size(); j++) {
+      m_cv.wait(lock, [&] {
+        return (stage == 0 || m_done[stage - 1] > j) && (stage + 1 == m_stages || m_done[stage + 1] + 2 > j);
+      });
+      lock.unlock();
+      double seconds = 0;
+      auto status    = runStage(stage, j, seconds);
+      lock.lock();
+      if (StatusCode::SUCCESS != status) {
+        m_failed = true;
+      }
+      m_stageSeconds[stage] += seconds;
+      m_done[stage] = j + 1;
+      m_cv.notify_all();
+    }
+  }
+}
+
+rwkv_app::StatusCode rwkv_app::PipelineExecutor::execute(QnnRwkvSession **sessions, const int *tokens, size_t count) {
+  if (0 == count) {
+    return StatusCode::SUCCESS;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (nullptr == sessions[i]) {
+      return StatusCode::FAILURE;
+    }
+    for (size_t j = i + 1; j < count; j++) {
+      if (sessions[i] == sessions[j]) {
+        QNN_ERROR("A session can only appear once per pipelined batch");
+        return StatusCode::FAILURE;
+      }
+    }
+  }
+
+  // park the live buffers so that every session's own buffer lists are current
+  m_app->captureSessionBuffers(m_app->m_activeSession);
+
+  auto tokenInput = QNN_TENSOR_GET_CLIENT_BUF(m_app->m_inputTensors[0][0]);
+  while (m_inputBuffers.size() < count) {
+    Qnn_ClientBuffer_t buffer = QNN_CLIENT_BUFFER_INIT;
+    buffer.data     = m_app->m_ioTensor.allocator()->allocate(tokenInput.dataSize);
+    buffer.dataSize = tokenInput.dataSize;
+    if (nullptr == buffer.data) {
+      return StatusCode::FAILURE;
+    }
+    memset(buffer.data, 0, buffer.dataSize);
+    m_inputBuffers.push_back(buffer);
+  }
+
+  m_jobs.resize(count);
+  for (size_t j = 0; j < count; j++) {
+    Job &job         = m_jobs[j];
+    QnnRwkvSession *session = sessions[j];
+    job.session      = session;
+    job.inputs.resize(m_stages);
+    job.outputs.resize(m_stages);
+    // same ping-pong as QnnRwkvCopyStatesInPlace, on the session's own lists
+    if (session->inferenced) {
+      std::swap(session->inputBuffers, session->outputBuffers);
+    }
+    for (uint32_t stage = 0; stage < m_stages; stage++) {
+      auto graphInfo = (*m_app->m_graphsInfo)[stage];
+      job.inputs[stage].assign(m_app->m_inputTensors[stage], m_app->m_inputTensors[stage] + graphInfo.numInputTensors);
+      job.outputs[stage].assign(m_app->m_outputTensors[stage], m_app->m_outputTensors[stage] + graphInfo.numOutputTensors);
+      for (size_t idx = 1; idx < graphInfo.numInputTensors; idx++) {
+        setQnnTensorClientBuf(job.inputs[stage][idx], session->inputBuffers[stage][idx - 1]);
+        setQnnTensorClientBuf(job.outputs[stage][idx - 1], session->outputBuffers[stage][idx - 1]);
+      }
+    }
+    auto lastGraph = (*m_app->m_graphsInfo)[m_stages - 1];
+    setQnnTensorClientBuf(job.outputs[m_stages - 1][lastGraph.numOutputTensors - 1], session->logitsBuffer);
+    setQnnTensorClientBuf(job.inputs[0][0], m_inputBuffers[j]);
+    m_app->writeTokenInput(&job.inputs[0][0], tokens[j]);
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::fill(m_done.begin(), m_done.end(), 0);
+    std::fill(m_stageSeconds.begin(), m_stageSeconds.end(), 0);
+    m_failed = false;
+    m_batch++;
+    m_cv.notify_all();
+    m_cv.wait(lock, [&] { return m_done[m_stages - 1] == count; });
+  }
+  double wallSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+  double serialSeconds = 0;
+  for (auto seconds : m_stageSeconds) {
+    serialSeconds += seconds;
+  }
+  m_lastTokensPerSecond       = wallSeconds > 0 ? count / wallSeconds : 0;
+  m_lastSerialTokensPerSecond = serialSeconds > 0 ? count / serialSeconds : 0;
+
+  // after a failure the outputs are not a state; the one from before the batch is
+  // in the input lists since the swap above
+  for (size_t j = 0; j < count; j++) {
+    sessions[j]->inferenced = !m_failed;
+  }
+  m_app->bindSessionBuffers(m_app->m_activeSession);
+
+  return m_failed ? StatusCode::FAILURE : StatusCode::SUCCESS;
+}
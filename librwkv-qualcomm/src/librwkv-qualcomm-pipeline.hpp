@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "librwkv-qualcomm-app.hpp"
+
+namespace qnn {
+namespace tools {
+namespace rwkv_app {
+
+// Runs one token for each of several sessions with the chunks of a _chunkXofY model
+// pipelined: while chunk k executes for session A, chunk k-1 executes for session B.
+// Every chunk has a worker thread that takes the batch in order; the hidden state
+// between chunk k-1 and k is handed over through two alternating buffers.
+class PipelineExecutor {
+ public:
+  explicit PipelineExecutor(QnnRwkvApp *app);
+
+  ~PipelineExecutor();
+
+  StatusCode execute(QnnRwkvSession **sessions, const int *tokens, size_t count);
+
+  double m_lastTokensPerSecond = 0;
+  // tokens/s the same batch would have reached with the chunks run back to back
+  double m_lastSerialTokensPerSecond = 0;
+
+ private:
+  struct Job {
+    QnnRwkvSession *session;
+    std::vector<std::vector<Qnn_Tensor_t>> inputs;   // [graph][input]
+    std::vector<std::vector<Qnn_Tensor_t>> outputs;  // [graph][output]
+  };
+
+  void worker(uint32_t stage);
+
+  StatusCode runStage(uint32_t stage, size_t jobIdx, double &seconds);
+
+  QnnRwkvApp *m_app;
+  uint32_t m_stages;
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  uint64_t m_batch = 0;
+  bool m_stop      = false;
+  bool m_failed    = false;
+  std::vector<Job> m_jobs;
+  std::vector<size_t> m_done;  // jobs finished per stage
+  std::vector<double> m_stageSeconds;
+  std::vector<std::vector<Qnn_Tensor_t>> m_stageInputs;   // per-stage execute scratch
+  std::vector<std::vector<Qnn_Tensor_t>> m_stageOutputs;
+  std::vector<Qnn_ClientBuffer_t> m_hiddenBuffers;  // [boundary * 2 + slot]
+  std::vector<Qnn_ClientBuffer_t> m_inputBuffers;   // first-chunk input per job
+};
+
+}  // namespace rwkv_app
+}  // namespace tools
+}  // namespace qnn
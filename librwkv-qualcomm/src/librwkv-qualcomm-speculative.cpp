@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "Logger.hpp"
+#include "librwkv-qualcomm-speculative.hpp"
+
+using namespace qnn;
+using namespace qnn::tools;
+
+rwkv_app::SpeculativeDecoder::SpeculativeDecoder(QnnRwkvApp *target, QnnRwkvApp *draft, size_t draftTokens, float temperature)
+    : m_target(target), m_draft(draft), m_draftTokens(draftTokens), m_temperature(temperature), m_rng(std::random_device{}()) {}
+
+void rwkv_app::SpeculativeDecoder::configure(QnnRwkvApp *draft, size_t draftTokens, float temperature) {
+  m_draft       = draft;
+  m_draftTokens = draftTokens;
+  m_temperature = temperature;
+}
+
+void rwkv_app::SpeculativeDecoder::toProbs(const float *logits, std::vector<float> &probs) {
+  probs.resize(m_vocabSize);
+  const float max_logit = *std::max_element(logits, logits + m_vocabSize);
+  float sum = 0;
+  for (size_t i = 0; i < m_vocabSize; i++) {
+    probs[i] = std::exp((logits[i] - max_logit) / m_temperature);
+    sum += probs[i];
+  }
+  for (auto &p : probs) {
+    p /= sum;
+  }
+}
+
+int rwkv_app::SpeculativeDecoder::sample(const std::vector<float> &probs) {
+  float sum = 0;
+  for (auto p : probs) {
+    sum += p;
+  }
+  float random_value = std::uniform_real_distribution<float>(0, sum)(m_rng);
+  float cumsum = 0;
+  for (size_t i = 0; i < probs.size(); i++) {
+    cumsum += probs[i];
+    if (cumsum >= random_value) {
+      return i;
+    }
+  }
+  return probs.size() - 1;
+}
+
+int rwkv_app::SpeculativeDecoder::argmax(const float *logits) {
+  return std::max_element(logits, logits + m_vocabSize) - logits;
+}
+
+rwkv_app::StatusCode rwkv_app::SpeculativeDecoder::draftExecute(int token) {
+  m_draft->copyStatesInPlace();
+  return m_draft->execute(token);
+}
+
+rwkv_app::StatusCode rwkv_app::SpeculativeDecoder::generate(int lastToken, int *output, size_t maxTokens, size_t *generated, int stopToken) {
+  const size_t seqLength = m_target->m_prefillSeqLength;
+  if (seqLength < 2) {
+    QNN_ERROR("Speculative decoding needs the target model's prefill graphs");
+    return StatusCode::FAILURE;
+  }
+  std::vector<float> draftLogits, targetLogits;
+  if (StatusCode::SUCCESS != m_draft->readLogits(false, draftLogits)) {
+    return StatusCode::FAILURE;
+  }
+  m_vocabSize = draftLogits.size();
+  if (StatusCode::SUCCESS != m_target->readLogits(true, targetLogits) ||
+      targetLogits.size() != seqLength * m_vocabSize) {
+    QNN_ERROR("Draft and target vocabularies differ");
+    return StatusCode::FAILURE;
+  }
+
+  const bool greedy = m_temperature <= 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<int> pending = {lastToken};
+  std::vector<int> proposed, window(seqLength), round;
+  std::vector<std::vector<float>> draftProbs(std::min(m_draftTokens, seqLength - 1));
+  std::vector<std::vector<uint8_t>> draftStates(draftProbs.size() + 1, std::vector<uint8_t>(m_draft->getStateSize()));
+  std::vector<uint8_t> targetState(m_target->getStateSize());
+  std::vector<float> targetProbs;
+  size_t emitted = 0;
+  bool stopped   = false;
+
+  while (emitted < maxTokens && !stopped) {
+    const size_t p = pending.size();
+    const size_t drafts = std::min({draftProbs.size(), seqLength - p, maxTokens - emitted - 1});
+
+    // propose, keeping the draft state after every proposal for the rollback
+    proposed.clear();
+    m_draft->saveStates(draftStates[0].data(), draftStates[0].size());
+    for (size_t i = 0; i < drafts; i++) {
+      int token;
+      if (greedy) {
+        token = argmax(draftLogits.data());
+      } else {
+        toProbs(draftLogits.data(), draftProbs[i]);
+        token = sample(draftProbs[i]);
+      }
+      proposed.push_back(token);
+      if (StatusCode::SUCCESS != draftExecute(token) ||
+          StatusCode::SUCCESS != m_draft->readLogits(false, draftLogits)) {
+        return StatusCode::FAILURE;
+      }
+      m_draft->saveStates(draftStates[i + 1].data(), draftStates[i + 1].size());
+    }
+
+    // verify: row r of the sequence logits predicts window[r + 1]
+    std::fill(window.begin(), window.end(), 0);
+    std::copy(pending.begin(), pending.end(), window.begin());
+    std::copy(proposed.begin(), proposed.end(), window.begin() + p);
+    m_target->saveStates(targetState.data(), targetState.size());
+    m_target->copyStatesInPlace();
+    if (StatusCode::SUCCESS != m_target->executeSequence(window.data()) ||
+        StatusCode::SUCCESS != m_target->readLogits(true, targetLogits)) {
+      return StatusCode::FAILURE;
+    }
+
+    size_t accepted = 0;
+    int extra       = -1;
+    for (; accepted < drafts; accepted++) {
+      const float *row = targetLogits.data() + (p - 1 + accepted) * m_vocabSize;
+      const int token  = proposed[accepted];
+      if (greedy) {
+        if (argmax(row) != token) {
+          extra = argmax(row);
+          break;
+        }
+        continue;
+      }
+      toProbs(row, targetProbs);
+      const auto &q = draftProbs[accepted];
+      if (std::uniform_real_distribution<float>(0, 1)(m_rng) * q[token] <= targetProbs[token]) {
+        continue;
+      }
+      // resample from the residual max(0, p - q)
+      for (size_t i = 0; i < m_vocabSize; i++) {
+        targetProbs[i] = std::max(0.f, targetProbs[i] - q[i]);
+      }
+      extra = sample(targetProbs);
+      break;
+    }
+    if (extra < 0) {
+      const float *row = targetLogits.data() + (p - 1 + drafts) * m_vocabSize;
+      if (greedy) {
+        extra = argmax(row);
+      } else {
+        toProbs(row, targetProbs);
+        extra = sample(targetProbs);
+      }
+    }
+
+    round.assign(proposed.begin(), proposed.begin() + accepted);
+    round.push_back(extra);
+    auto stop = std::find(round.begin(), round.end(), stopToken);
+    if (stop != round.end()) {
+      round.erase(stop + 1, round.end());
+      stopped = true;
+    }
+
+    // the target keeps the new state only if the whole window was real tokens
+    if (p + drafts == seqLength && round.size() == drafts + 1) {
+      pending.assign(1, extra);
+    } else {
+      m_target->loadStates(targetState.data(), targetState.size());
+      pending.insert(pending.end(), round.begin(), round.end());
+    }
+
+    // the draft has consumed every proposal; rewind it to the last kept one
+    const size_t kept = std::min(round.size(), accepted);
+    if (kept != drafts) {
+      m_draft->loadStates(draftStates[kept].data(), draftStates[kept].size());
+    }
+    if (round.size() > accepted) {
+      if (StatusCode::SUCCESS != draftExecute(extra) ||
+          StatusCode::SUCCESS != m_draft->readLogits(false, draftLogits)) {
+        return StatusCode::FAILURE;
+      }
+    }
+
+    std::copy(round.begin(), round.end(), output + emitted);
+    emitted += round.size();
+    m_stats.rounds++;
+    m_stats.draftedTokens += drafts;
+    m_stats.acceptedTokens += kept;
+  }
+
+  // hand the pending tokens to the decode graphs so that the target ends up with
+  // the same state and logits as after QnnRwkvExecute
+  for (auto token : pending) {
+    m_target->copyStatesInPlace();
+    if (StatusCode::SUCCESS != m_target->execute(token)) {
+      return StatusCode::FAILURE;
+    }
+  }
+
+  m_stats.generatedTokens += emitted;
+  m_stats.seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  *generated = emitted;
+  return StatusCode::SUCCESS;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "librwkv-qualcomm-app.hpp"
+
+namespace qnn {
+namespace tools {
+namespace rwkv_app {
+
+// Speculative decoding: a small draft model proposes tokens one by one and the target
+// model scores them all with one call of its prefill (sequence) graph. Tokens are kept
+// by rejection sampling, so the output follows the target distribution exactly.
+//
+// The sequence graph always consumes m_prefillSeqLength tokens and only returns the
+// final state, so the target state is only advanced when a whole window was accepted.
+// Otherwise it is rolled back to the snapshot and the accepted tokens stay pending,
+// to be re-fed at the head of the next window.
+class SpeculativeDecoder {
+ public:
+  struct Stats {
+    size_t rounds          = 0;
+    size_t draftedTokens   = 0;
+    size_t acceptedTokens  = 0;
+    size_t generatedTokens = 0;
+    double seconds         = 0;
+  };
+
+  SpeculativeDecoder(QnnRwkvApp *target, QnnRwkvApp *draft, size_t draftTokens, float temperature);
+
+  void configure(QnnRwkvApp *draft, size_t draftTokens, float temperature);
+
+  void seed(uint64_t seed) { m_rng.seed(seed); }
+
+  // Expects the target to have consumed everything before lastToken, and the draft
+  // everything up to and including it. On return both have consumed the output.
+  StatusCode generate(int lastToken, int *output, size_t maxTokens, size_t *generated, int stopToken);
+
+  const Stats &stats() const { return m_stats; }
+
+ private:
+  void toProbs(const float *logits, std::vector<float> &probs);
+
+  int sample(const std::vector<float> &probs);
+
+  int argmax(const float *logits);
+
+  StatusCode draftExecute(int token);
+
+  QnnRwkvApp *m_target;
+  QnnRwkvApp *m_draft;
+  size_t m_draftTokens;
+  float m_temperature;
+  size_t m_vocabSize = 0;
+  std::mt19937_64 m_rng;
+  Stats m_stats;
+};
+
+}  // namespace rwkv_app
+}  // namespace tools
+}  // namespace qnn
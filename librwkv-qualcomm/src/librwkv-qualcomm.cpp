@@ -1,12 +1,22 @@
 #include "librwkv-qualcomm.h"
 #include "librwkv-qualcomm-app.hpp"
+#include "librwkv-qualcomm-async.hpp"
+#include "librwkv-qualcomm-beam.hpp"
+#include "librwkv-qualcomm-pipeline.hpp"
+#include "librwkv-qualcomm-speculative.hpp"
 #include "DynamicLoadUtil.hpp"
 #include "PAL/DynamicLoading.hpp"
 #include "QnnTypeMacros.hpp"
+#include "DataKernels.hpp"
+#include "LogitsProcessor.hpp"
+#include "StopMatcher.hpp"
+#include "Utf8Stream.hpp"
+#include "TokenConstraint.hpp"
 #include "half.hpp"
 #include "Logger.hpp"
 #include <cmath>
 #include <fstream>
+#include <numeric>
 #include <sstream>
 
 #if !defined(_WIN32) && ENABLE_CHAT_APIS
@@ -107,6 +117,16 @@ StatusCode QnnRwkvBackendInitialize(QnnRwkvBackend_t backend, bool context, bool
         }
     }
 
+    // heap, hugepage, shared (rpcmem registered with the backend) or tracking
+    const char* allocatorName = getenv("RWKV_TENSOR_ALLOCATOR");
+    std::string allocatorType = allocatorName ? allocatorName : (usingHtp ? "shared" : "heap");
+    auto allocator = iotensor::createTensorAllocator(allocatorType, app->m_qnnFunctionPointers.qnnInterface);
+    if (!allocator) {
+        LOG_ERROR("Unknown tensor allocator: " + allocatorType);
+        return StatusCode::FAILURE;
+    }
+    app->m_ioTensor.setAllocator(allocator);
+
     if (rwkv_app::StatusCode::SUCCESS != app->initializeTensors()) {
         LOG_ERROR("Tensor initialization failure");
         return StatusCode::FAILURE;
@@ -300,11 +320,21 @@ StatusCode QnnRwkvSetInput(QnnRwkvBackend_t backend, int inputIdx, float* inputB
     return StatusCode::SUCCESS;
 }
 
+// Synchronous entry points touch the same state as the queued requests, so they
+// drain the async queue first, except from a completion callback, which runs
+// between two requests
+static void waitForAsync(rwkv_app::QnnRwkvApp *app) {
+    if (app->m_async && !app->m_async->onWorkerThread()) {
+        app->m_async->waitAll();
+    }
+}
+
 StatusCode QnnRwkvGetOutput(QnnRwkvBackend_t backend, int outputIdx, float* outputBuffer, size_t outputSize) {
     if (!backend || !outputBuffer) {
         return StatusCode::FAILURE;
     }
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
 
     // std::vector<size_t> shape;
     // if (StatusCode::SUCCESS != QnnRwkvGetOutputShape(backend, outputIdx, shape)) {
@@ -329,18 +359,16 @@ StatusCode QnnRwkvGetOutput(QnnRwkvBackend_t backend, int outputIdx, float* outp
             tensor_id = app->m_graphsInfo[graph_id]->numOutputTensors - 1;
         }
 
-        if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][tensor_id]) == QNN_DATATYPE_FLOAT_32) {
-            memcpy(outputBuffer, QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][tensor_id]).data, outputSize * sizeof(float));
-        } else if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][tensor_id]) == QNN_DATATYPE_FLOAT_16) {
-            half_float::half *ptr = (half_float::half*)QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][tensor_id]).data;
-            for (int i = 0; i < outputSize; i++) {
-                outputBuffer[i] = ptr[i];
-            }
-        } else {
-            float *buffer;
-            app->m_ioTensor.convertToFloat(&buffer, &app->m_outputTensors[graph_id][tensor_id]);
-            memcpy(outputBuffer, buffer, outputSize * sizeof(float));
-            free(buffer);
+        size_t elemcount = 1;
+        for (uint32_t i = 0; i < QNN_TENSOR_GET_RANK(app->m_outputTensors[graph_id][tensor_id]); i++) {
+            elemcount *= *(QNN_TENSOR_GET_DIMENSIONS(app->m_outputTensors[graph_id][tensor_id]) + i);
+        }
+        if (elemcount > outputSize) {
+            LOG_ERROR("Output buffer is too small");
+            return StatusCode::FAILURE;
+        }
+        if (iotensor::StatusCode::SUCCESS != app->m_ioTensor.convertToFloat(outputBuffer, &app->m_outputTensors[graph_id][tensor_id])) {
+            return StatusCode::FAILURE;
         }
     // }
 
@@ -361,6 +389,134 @@ StatusCode QnnRwkvGetOutput(QnnRwkvBackend_t backend, int outputIdx, float* outp
     return StatusCode::SUCCESS;
 }
 
+StatusCode QnnRwkvGetOutputView(QnnRwkvBackend_t backend, int outputIdx, const void **data,
+    QnnRwkvDataType *dtype, float *scale, int32_t *offset, size_t *count) {
+    if (!backend || !data || !dtype || !scale || !offset || !count) {
+        return StatusCode::FAILURE;
+    }
+    if (outputIdx < 0 || outputIdx >= QnnRwkvGetOutputNum(backend)) {
+        LOG_ERROR("Output index out of bounds");
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    int graph_id = 0, tensor_id = outputIdx;
+    if (app->m_graphsCount > 1) {
+        if (outputIdx == QnnRwkvGetOutputNum(backend) - 1) {
+            graph_id = app->m_graphsCount - 1;
+            tensor_id = app->m_graphsInfo[graph_id]->numOutputTensors - 1;
+        } else if (static_cast<uint32_t>(outputIdx) >= app->m_graphsInfo[0]->numOutputTensors - 1) {
+            graph_id = outputIdx / (app->m_graphsInfo[0]->numOutputTensors - 1);
+            tensor_id = outputIdx % (app->m_graphsInfo[0]->numOutputTensors - 1);
+        }
+    }
+    const Qnn_Tensor_t &tensor = app->m_outputTensors[graph_id][tensor_id];
+
+    *scale = 1.f;
+    *offset = 0;
+    switch (QNN_TENSOR_GET_DATA_TYPE(tensor)) {
+        case QNN_DATATYPE_FLOAT_32:
+            *dtype = QnnRwkvDataType::FLOAT_32;
+            break;
+        case QNN_DATATYPE_FLOAT_16:
+            *dtype = QnnRwkvDataType::FLOAT_16;
+            break;
+        case QNN_DATATYPE_UFIXED_POINT_16:
+            *dtype = QnnRwkvDataType::UFIXED_POINT_16;
+            break;
+        case QNN_DATATYPE_UFIXED_POINT_8:
+            *dtype = QnnRwkvDataType::UFIXED_POINT_8;
+            break;
+        case QNN_DATATYPE_INT_32:
+            *dtype = QnnRwkvDataType::INT_32;
+            break;
+        default:
+            *dtype = QnnRwkvDataType::UNSUPPORTED;
+            break;
+    }
+    if (*dtype == QnnRwkvDataType::UFIXED_POINT_16 || *dtype == QnnRwkvDataType::UFIXED_POINT_8) {
+        *scale = QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.scale;
+        *offset = QNN_TENSOR_GET_QUANT_PARAMS(tensor).scaleOffsetEncoding.offset;
+    }
+
+    size_t elemcount = 1;
+    for (uint32_t i = 0; i < QNN_TENSOR_GET_RANK(tensor); i++) {
+        elemcount *= *(QNN_TENSOR_GET_DIMENSIONS(tensor) + i);
+    }
+    *count = elemcount;
+    *data = QNN_TENSOR_GET_CLIENT_BUF(tensor).data;
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvGetOutputTopK(QnnRwkvBackend_t backend, int outputIdx, int k, int *indices, float *values, int *count) {
+    if (!backend || !indices || !values || !count || k <= 0) {
+        return StatusCode::FAILURE;
+    }
+    waitForAsync(static_cast<rwkv_app::QnnRwkvApp *>(backend));
+    const void *data;
+    QnnRwkvDataType dtype;
+    float scale;
+    int32_t offset;
+    size_t elemcount;
+    if (StatusCode::SUCCESS != QnnRwkvGetOutputView(backend, outputIdx, &data, &dtype, &scale, &offset, &elemcount)) {
+        return StatusCode::FAILURE;
+    }
+
+    using namespace qnn::tools::datautil;
+    static_assert(sizeof(int) == sizeof(int32_t), "indices are written as int32_t");
+    int32_t *ids = reinterpret_cast<int32_t *>(indices);
+    const size_t n = std::min<size_t>(k, elemcount);
+    switch (dtype) {
+        case QnnRwkvDataType::FLOAT_32: {
+            const float *ptr = static_cast<const float *>(data);
+            if (n == 1) {
+                ids[0] = kernels::argmax(ptr, elemcount);
+            } else {
+                kernels::topK(ids, ptr, elemcount, n);
+            }
+            for (size_t i = 0; i < n; i++) {
+                values[i] = ptr[ids[i]];
+            }
+            break;
+        }
+        case QnnRwkvDataType::FLOAT_16:
+        case QnnRwkvDataType::UFIXED_POINT_16: {
+            const uint16_t *ptr = static_cast<const uint16_t *>(data);
+            const bool isHalf = dtype == QnnRwkvDataType::FLOAT_16;
+            if (n == 1) {
+                ids[0] = kernels::argmax(ptr, elemcount, isHalf);
+            } else {
+                kernels::topK(ids, ptr, elemcount, n, isHalf);
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (isHalf) {
+                    kernels::halfToFloat(values + i, ptr + ids[i], 1);
+                } else {
+                    values[i] = (ptr[ids[i]] + offset) * scale;
+                }
+            }
+            break;
+        }
+        case QnnRwkvDataType::UFIXED_POINT_8: {
+            const uint8_t *ptr = static_cast<const uint8_t *>(data);
+            if (n == 1) {
+                ids[0] = kernels::argmax(ptr, elemcount);
+            } else {
+                kernels::topK(ids, ptr, elemcount, n);
+            }
+            for (size_t i = 0; i < n; i++) {
+                values[i] = (ptr[ids[i]] + offset) * scale;
+            }
+            break;
+        }
+        default:
+            LOG_ERROR("Unsupported output data type for top-k");
+            return StatusCode::FAILURE;
+    }
+    *count = n;
+    return StatusCode::SUCCESS;
+}
+
 int QnnRwkvGetInputNum(QnnRwkvBackend_t backend) {
     if (!backend) {
         return -1;
@@ -454,8 +610,9 @@ StatusCode QnnRwkvExecute(QnnRwkvBackend_t backend, int token) {
     if (!backend) {
         return StatusCode::FAILURE;
     }
-    QnnRwkvCopyStatesInPlace(backend);
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    QnnRwkvCopyStatesInPlace(backend);
     if (rwkv_app::StatusCode::SUCCESS != app->execute(token)) {
         LOG_ERROR("Execution failure");
         return StatusCode::FAILURE;
@@ -463,58 +620,134 @@ StatusCode QnnRwkvExecute(QnnRwkvBackend_t backend, int token) {
     return StatusCode::SUCCESS;
 }
 
-double QnnRwkvGetLastInferenceTime(QnnRwkvBackend_t backend) {
+// With needLogits set, at least one token is left for the decode graphs so that the
+// final logits come out where QnnRwkvGetOutput reads them. The tail is never padded
+// since padding would advance the state.
+static StatusCode executeTokens(QnnRwkvBackend_t backend, const int* tokens, size_t length, bool needLogits) {
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    size_t i = 0;
+    const size_t seqLength = app->m_prefillSeqLength;
+    if (seqLength > 1) {
+        for (; length - i > seqLength || (!needLogits && length - i == seqLength); i += seqLength) {
+            QnnRwkvCopyStatesInPlace(backend);
+            if (rwkv_app::StatusCode::SUCCESS != app->executeSequence(tokens + i)) {
+                LOG_ERROR("Sequence execution failure");
+                return StatusCode::FAILURE;
+            }
+        }
+    }
+    for (; i < length; i++) {
+        if (StatusCode::SUCCESS != QnnRwkvExecute(backend, tokens[i])) {
+            return StatusCode::FAILURE;
+        }
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvExecuteSequence(QnnRwkvBackend_t backend, const int* tokens, size_t length) {
+    if (!backend || (!tokens && length)) {
+        return StatusCode::FAILURE;
+    }
+    return executeTokens(backend, tokens, length, true);
+}
+
+StatusCode QnnRwkvPrefixCacheEnable(QnnRwkvBackend_t backend, size_t stride, size_t maxBytes) {
     if (!backend) {
-        return -1;
+        return StatusCode::FAILURE;
     }
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
-    return app->m_lastInferenceTime.count();
+    if (maxBytes == 0) {
+        app->m_prefixCache.reset();
+        return StatusCode::SUCCESS;
+    }
+    if (stride == 0) {
+        stride = app->m_prefillSeqLength > 1 ? app->m_prefillSeqLength : 32;
+    }
+    app->m_prefixCache.reset(new prefixcache::PrefixCache(stride, maxBytes));
+    return StatusCode::SUCCESS;
 }
 
-StatusCode QnnRwkvCopyStatesInPlace(QnnRwkvBackend_t backend) {
+StatusCode QnnRwkvPrefixCacheGetStats(QnnRwkvBackend_t backend, QnnRwkvPrefixCacheStats *stats) {
+    if (!backend || !stats) {
+        return StatusCode::FAILURE;
+    }
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
-    if (!app->m_inferenced)
-        return StatusCode::SUCCESS;
+    if (!app->m_prefixCache) {
+        return StatusCode::FAILURE;
+    }
+    auto &cacheStats = app->m_prefixCache->stats();
+    stats->hits = cacheStats.hits;
+    stats->misses = cacheStats.misses;
+    stats->reusedTokens = cacheStats.reusedTokens;
+    stats->evictions = cacheStats.evictions;
+    stats->entries = cacheStats.entries;
+    stats->bytes = cacheStats.bytes;
+    return StatusCode::SUCCESS;
+}
 
-    for (size_t graph_id = 0; graph_id < app->m_graphsCount; graph_id++) {
-        for (size_t idx = 1; idx < (*app->m_graphsInfo)[graph_id].numInputTensors; idx++) {
-            // app->copyTensor(&app->m_inputTensors[graph_id][idx], &app->m_outputTensors[graph_id][idx-1]);
-            // zero copy
-            auto tmp = getQnnTensorClientBuf(app->m_inputTensors[graph_id][idx]);
-            setQnnTensorClientBuf(app->m_inputTensors[graph_id][idx], getQnnTensorClientBuf(app->m_outputTensors[graph_id][idx-1]));
-            setQnnTensorClientBuf(app->m_outputTensors[graph_id][idx-1], tmp);
+StatusCode QnnRwkvExecutePrompt(QnnRwkvBackend_t backend, const int* tokens, size_t length) {
+    if (!backend || !tokens || !length) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    auto &cache = app->m_prefixCache;
+
+    // the last token is always executed to produce the logits
+    size_t pos = 0;
+    const std::vector<uint8_t> *state = nullptr;
+    if (cache) {
+        pos = cache->lookup(tokens, length - 1, &state);
+    }
+    if (pos) {
+        if (rwkv_app::StatusCode::SUCCESS != app->loadStates(state->data(), state->size())) {
+            LOG_ERROR("Failed to restore cached prefix state");
+            return StatusCode::FAILURE;
         }
+    } else {
+        QnnRwkvResetStates(backend);
     }
 
+    if (cache) {
+        const size_t stride = cache->stride();
+        for (size_t next = (pos / stride + 1) * stride; next < length; next += stride) {
+            if (StatusCode::SUCCESS != executeTokens(backend, tokens + pos, next - pos, false)) {
+                return StatusCode::FAILURE;
+            }
+            std::vector<uint8_t> snapshot(app->getStateSize());
+            app->saveStates(snapshot.data(), snapshot.size());
+            cache->insert(tokens, next, std::move(snapshot));
+            pos = next;
+        }
+    }
+    return executeTokens(backend, tokens + pos, length - pos, true);
+}
+
+double QnnRwkvGetLastInferenceTime(QnnRwkvBackend_t backend) {
+    if (!backend) {
+        return -1;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    return app->m_lastInferenceTime.count();
+}
+
+StatusCode QnnRwkvCopyStatesInPlace(QnnRwkvBackend_t backend) {
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    app->copyStatesInPlace();
     return StatusCode::SUCCESS;
 }
 
 StatusCode QnnRwkvResetStates(QnnRwkvBackend_t backend) {
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
     if (!app->m_inferenced)
         return StatusCode::SUCCESS;
-    for (size_t graph_id = 0; graph_id < app->m_graphsCount; graph_id++) {
-        for (size_t idx = 0; idx < (*app->m_graphsInfo)[graph_id].numOutputTensors - 1; idx++) {
-            size_t elemcount = 1;
-            for (int i = 0; i < QNN_TENSOR_GET_RANK(app->m_outputTensors[graph_id][idx]); i++) {
-                elemcount *= *(QNN_TENSOR_GET_DIMENSIONS(app->m_outputTensors[graph_id][idx]) + i);
-            }
-            if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][idx]) == QNN_DATATYPE_FLOAT_16) {
-                uint16_t *ptr = (uint16_t*)QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][idx]).data;
-                memset(ptr, 0, elemcount * sizeof(uint16_t));
-            } else if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][idx]) == QNN_DATATYPE_FLOAT_32) {
-                float *ptr = (float*)QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][idx]).data;
-                memset(ptr, 0, elemcount * sizeof(float));
-            } else {
-                // TODO: optimize
-                float *ptr = new float[elemcount];
-                memset(ptr, 0, elemcount * sizeof(float));
-                app->m_ioTensor.copyFromFloatToNative(ptr, &app->m_outputTensors[graph_id][idx]);
-                delete[] ptr;
-            }
-        }
+    if (rwkv_app::StatusCode::SUCCESS != app->resetStates()) {
+        LOG_ERROR("Failed to reset states");
+        return StatusCode::FAILURE;
     }
-
     return StatusCode::SUCCESS;
 }
 
@@ -529,8 +762,9 @@ StatusCode QnnRwkvSaveContext(QnnRwkvBackend_t backend, std::string contextPath)
     return StatusCode::SUCCESS;
 }
 
-StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, std::vector<std::vector<std::vector<float>>> states) {
+StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, const std::vector<std::vector<std::vector<float>>> &states) {
     rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
 
     size_t n_tensors = states[0].size() * states.size();
     if (n_tensors != app->m_graphsCount * (app->m_graphsInfo[0]->numInputTensors - 1)) {
@@ -538,30 +772,18 @@ StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, std::vector<std::vector<st
         return StatusCode::FAILURE;
     }
     size_t current_tensor = 0;
+    std::vector<float> scaled;
 
     for (size_t graph_id = 0; graph_id < app->m_graphsCount; graph_id++) {
         for (size_t idx = 0; idx < (*app->m_graphsInfo)[graph_id].numOutputTensors - 1; idx++) {
             size_t states_i = current_tensor / states[0].size();
             size_t states_j = current_tensor % states[0].size();
-            if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][idx]) == QNN_DATATYPE_FLOAT_16) {
-                uint16_t *ptr = (uint16_t*)QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][idx]).data;
-                for (size_t i = 0; i < states[states_i][states_j].size(); i++) {
-                    ptr[i] = half_float::half(states[states_i][states_j][i] / 8);
-                }
-            } else if (QNN_TENSOR_GET_DATA_TYPE(app->m_outputTensors[graph_id][idx]) == QNN_DATATYPE_FLOAT_32) {
-                float *ptr = (float*)QNN_TENSOR_GET_CLIENT_BUF(app->m_outputTensors[graph_id][idx]).data;
-                for (size_t i = 0; i < states[states_i][states_j].size(); i++) {
-                    ptr[i] = states[states_i][states_j][i] / 8;
-                }
-            } else {
-                // TODO: optimize
-                float *ptr = new float[states[states_i][states_j].size()];
-                for (size_t i = 0; i < states[states_i][states_j].size(); i++) {
-                    ptr[i] = states[states_i][states_j][i] / 8;
-                }
-                app->m_ioTensor.copyFromFloatToNative(ptr, &app->m_outputTensors[graph_id][idx]);
-                delete[] ptr;
+            const std::vector<float> &state = states[states_i][states_j];
+            scaled.resize(state.size());
+            for (size_t i = 0; i < state.size(); i++) {
+                scaled[i] = state[i] / 8;
             }
+            app->m_ioTensor.copyFromFloatToNative(scaled.data(), &app->m_outputTensors[graph_id][idx]);
             current_tensor++;
         }
     }
@@ -569,81 +791,478 @@ StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, std::vector<std::vector<st
     return StatusCode::SUCCESS;
 }
 
-#if !defined(_WIN32) && ENABLE_CHAT_APIS
-// Completion functions
-static int sample_logits(const float* logits, const size_t size, float temperature, int top_k, float top_p) {
-    temperature = std::max(temperature, 0.1f);
-    temperature = std::min(temperature, 5.f);
-    if (top_k >= size)
-        top_k = size;
-
-    if (top_k == 0 || top_k == 1)
-        return std::max_element(logits, logits + size) - logits;
-
-    // softmax
-    float sum = 0;
-    int *index = new int[size];
-    float *probs = new float[size];
-
-    const float max_logit = *std::max_element(logits, logits + size);
-
-    for (int i = 0; i < size; i++) {
-        probs[i] = std::exp(logits[i] - max_logit);
-        sum += probs[i];
-        index[i] = i;
-    }
-
-    if (top_k != size)
-        std::nth_element(index, index + top_k,
-                index + size,
-                [&](int i, int j) { return probs[i] > probs[j]; });
-    std::sort(index, index + top_k,
-            [&](int i, int j) { return probs[i] > probs[j]; });
-
-    int len = top_k;
-
-    // top-p
-    float cumsum = 0;
-    for (int i = 0; i < len; i++) {
-        probs[index[i]] /= sum;
-        cumsum += probs[index[i]];
-        if (cumsum >= top_p) {
-            len = i + 1;
-            break;
+size_t QnnRwkvGetStateSize(QnnRwkvBackend_t backend) {
+    if (!backend) {
+        return 0;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    return app->getStateImageSize();
+}
+
+StatusCode QnnRwkvSaveState(QnnRwkvBackend_t backend, void *buffer, size_t size) {
+    if (!backend || !buffer) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (rwkv_app::StatusCode::SUCCESS != app->saveStateImage(static_cast<uint8_t *>(buffer), size)) {
+        LOG_ERROR("State saving failed");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvLoadState(QnnRwkvBackend_t backend, const void *buffer, size_t size) {
+    if (!backend || !buffer) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (rwkv_app::StatusCode::SUCCESS != app->loadStateImage(static_cast<const uint8_t *>(buffer), size)) {
+        LOG_ERROR("State loading failed");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSaveStateToFile(QnnRwkvBackend_t backend, std::string path) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (rwkv_app::StatusCode::SUCCESS != app->saveStateImageToFile(path)) {
+        LOG_ERROR("State saving failed: " + path);
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvLoadStateFromFile(QnnRwkvBackend_t backend, std::string path) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (rwkv_app::StatusCode::SUCCESS != app->loadStateImageFromFile(path)) {
+        LOG_ERROR("State loading failed: " + path);
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSessionCreate(QnnRwkvBackend_t backend, QnnRwkvSession_t *session) {
+    if (!backend || !session) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    *session = app->createSession();
+    if (!*session) {
+        LOG_ERROR("Session creation failure");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSessionDestroy(QnnRwkvBackend_t backend, QnnRwkvSession_t session) {
+    if (!backend || !session) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (rwkv_app::StatusCode::SUCCESS != app->destroySession(static_cast<rwkv_app::QnnRwkvSession *>(session))) {
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSessionActivate(QnnRwkvBackend_t backend, QnnRwkvSession_t session) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    rwkv_app::QnnRwkvSession *target = session ? static_cast<rwkv_app::QnnRwkvSession *>(session) : &app->m_defaultSession;
+    if (rwkv_app::StatusCode::SUCCESS != app->activateSession(target)) {
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvExecuteSessions(QnnRwkvBackend_t backend, QnnRwkvSession_t *sessions, const int *tokens, size_t count) {
+    if (!backend || !sessions || !tokens) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    std::vector<rwkv_app::QnnRwkvSession *> targets(count);
+    for (size_t i = 0; i < count; i++) {
+        targets[i] = app->findSession(sessions[i]);
+        if (!targets[i]) {
+            return StatusCode::FAILURE;
         }
     }
+    waitForAsync(app);
+    if (!app->m_pipeline) {
+        app->m_pipeline.reset(new rwkv_app::PipelineExecutor(app));
+    }
+    if (rwkv_app::StatusCode::SUCCESS != app->m_pipeline->execute(targets.data(), tokens, count)) {
+        LOG_ERROR("Pipelined execution failure");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
 
-    // temperature
-    if (fabs(temperature - 1.f) > 1e-6) {
-        cumsum = 0;
-        for (int i = 0; i < len; i++) {
-            probs[index[i]] = std::pow(probs[index[i]], 1.f / temperature);
-            cumsum += probs[index[i]];
+StatusCode QnnRwkvGetPipelineThroughput(QnnRwkvBackend_t backend, double *tokensPerSecond, double *serialTokensPerSecond) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    if (!app->m_pipeline) {
+        return StatusCode::FAILURE;
+    }
+    if (tokensPerSecond) {
+        *tokensPerSecond = app->m_pipeline->m_lastTokensPerSecond;
+    }
+    if (serialTokensPerSecond) {
+        *serialTokensPerSecond = app->m_pipeline->m_lastSerialTokensPerSecond;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvExecuteAsync(QnnRwkvBackend_t backend, int token, QnnRwkvExecuteCallback_t callback, void *user, uint64_t *requestId) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    if (!app->m_async) {
+        app->m_async.reset(new rwkv_app::AsyncExecutor(app));
+    }
+    uint64_t id = app->m_async->submit(token, [callback, user](uint64_t id, rwkv_app::StatusCode status) {
+        if (callback) {
+            callback(user, id, rwkv_app::StatusCode::SUCCESS == status ? StatusCode::SUCCESS : StatusCode::FAILURE);
         }
+    });
+    if (requestId) {
+        *requestId = id;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvWait(QnnRwkvBackend_t backend, uint64_t requestId) {
+    if (!backend) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    if (!app->m_async) {
+        return StatusCode::FAILURE;
+    }
+    if (rwkv_app::StatusCode::SUCCESS != app->m_async->wait(requestId)) {
+        LOG_ERROR("Async execution failure");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+bool QnnRwkvPoll(QnnRwkvBackend_t backend, uint64_t requestId, StatusCode *status) {
+    if (!backend) {
+        return false;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    rwkv_app::StatusCode appStatus;
+    if (!app->m_async || !app->m_async->poll(requestId, &appStatus)) {
+        return false;
+    }
+    if (status) {
+        *status = rwkv_app::StatusCode::SUCCESS == appStatus ? StatusCode::SUCCESS : StatusCode::FAILURE;
+    }
+    return true;
+}
+
+StatusCode QnnRwkvSpeculativeGenerate(QnnRwkvBackend_t backend, QnnRwkvBackend_t draftBackend,
+    const int *tokens, size_t length, int *output, size_t maxTokens, size_t *generated,
+    int draftTokens, float temperature, int stopToken, uint64_t seed) {
+    if (!backend || !draftBackend || backend == draftBackend || !tokens || !length || !output || !generated || draftTokens < 1) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    rwkv_app::QnnRwkvApp *draftApp = static_cast<rwkv_app::QnnRwkvApp *>(draftBackend);
+    if (app->m_prefillSeqLength < 2) {
+        LOG_ERROR("Speculative decoding needs the prefill graphs of the target model");
+        return StatusCode::FAILURE;
     }
 
-    // random choice
-    float random_value = rand() / float(RAND_MAX) * cumsum;
-    
-    int ret = -1;
-    cumsum = 0;
-    for (int i = 0; i < len; i++) {
-        cumsum += probs[index[i]];
-        if (cumsum >= random_value) {
-            ret = index[i];
+    // the target holds back the last token, it heads the first verification window
+    if (StatusCode::SUCCESS != executeTokens(backend, tokens, length - 1, false) ||
+        StatusCode::SUCCESS != executeTokens(draftBackend, tokens, length, true)) {
+        return StatusCode::FAILURE;
+    }
+
+    if (!app->m_speculative) {
+        app->m_speculative.reset(new rwkv_app::SpeculativeDecoder(app, draftApp, draftTokens, temperature));
+    }
+    app->m_speculative->configure(draftApp, draftTokens, temperature);
+    if (seed) {
+        app->m_speculative->seed(seed);
+    }
+    if (rwkv_app::StatusCode::SUCCESS != app->m_speculative->generate(tokens[length - 1], output, maxTokens, generated, stopToken)) {
+        LOG_ERROR("Speculative decoding failure");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSpeculativeGetStats(QnnRwkvBackend_t backend, QnnRwkvSpeculativeStats *stats) {
+    if (!backend || !stats) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    if (!app->m_speculative) {
+        return StatusCode::FAILURE;
+    }
+    auto &decoderStats = app->m_speculative->stats();
+    stats->rounds = decoderStats.rounds;
+    stats->draftedTokens = decoderStats.draftedTokens;
+    stats->acceptedTokens = decoderStats.acceptedTokens;
+    stats->generatedTokens = decoderStats.generatedTokens;
+    stats->acceptanceRate = decoderStats.draftedTokens ? (double)decoderStats.acceptedTokens / decoderStats.draftedTokens : 0;
+    stats->tokensPerSecond = decoderStats.seconds > 0 ? decoderStats.generatedTokens / decoderStats.seconds : 0;
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvBeamSearch(QnnRwkvBackend_t backend, int width, int *output, size_t maxTokens, size_t *generated,
+    float *score, int stopToken, float lengthPenalty) {
+    if (!backend || width < 1 || !output || !maxTokens || !generated) {
+        return StatusCode::FAILURE;
+    }
+    rwkv_app::QnnRwkvApp *app = static_cast<rwkv_app::QnnRwkvApp *>(backend);
+    waitForAsync(app);
+    if (!app->m_beamSearch) {
+        app->m_beamSearch.reset(new rwkv_app::BeamSearch(app));
+    }
+    if (rwkv_app::StatusCode::SUCCESS != app->m_beamSearch->search(width, maxTokens, stopToken, lengthPenalty, output, generated, score)) {
+        LOG_ERROR("Beam search failure");
+        return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+namespace {
+struct SamplerHandle {
+    SamplerHandle(size_t vocabSize, uint64_t seed)
+        : candidates(vocabSize), logits(vocabSize), processor(vocabSize, seed) {}
+
+    std::vector<int> candidates;
+    std::vector<float> logits;
+    sampler::LogitsProcessor processor;
+    std::unique_ptr<constraint::TokenConstraint> constraint;
+};
+}
+
+// values[i] = output element ids[i], dequantized
+static StatusCode gatherOutput(QnnRwkvBackend_t backend, int outputIdx, const int *ids, float *values, size_t count) {
+    const void *data;
+    QnnRwkvDataType dtype;
+    float scale;
+    int32_t offset;
+    size_t elemcount;
+    if (StatusCode::SUCCESS != QnnRwkvGetOutputView(backend, outputIdx, &data, &dtype, &scale, &offset, &elemcount)) {
+        return StatusCode::FAILURE;
+    }
+    switch (dtype) {
+        case QnnRwkvDataType::FLOAT_32:
+            for (size_t i = 0; i < count; i++) {
+                values[i] = static_cast<const float *>(data)[ids[i]];
+            }
+            break;
+        case QnnRwkvDataType::FLOAT_16:
+            for (size_t i = 0; i < count; i++) {
+                datautil::kernels::halfToFloat(values + i, static_cast<const uint16_t *>(data) + ids[i], 1);
+            }
+            break;
+        case QnnRwkvDataType::UFIXED_POINT_16:
+            for (size_t i = 0; i < count; i++) {
+                values[i] = (static_cast<const uint16_t *>(data)[ids[i]] + offset) * scale;
+            }
             break;
+        case QnnRwkvDataType::UFIXED_POINT_8:
+            for (size_t i = 0; i < count; i++) {
+                values[i] = (static_cast<const uint8_t *>(data)[ids[i]] + offset) * scale;
+            }
+            break;
+        default:
+            LOG_ERROR("Unsupported output data type");
+            return StatusCode::FAILURE;
+    }
+    return StatusCode::SUCCESS;
+}
+
+// Fetches the logits the chain needs into the candidate buffer and draws from them.
+// With a constraint the candidates are the tokens it allows, cached per automaton state.
+static int sampleLastOutput(QnnRwkvBackend_t backend, SamplerHandle *handle) {
+    const int outputIdx = QnnRwkvGetOutputNum(backend) - 1;
+    if (handle->constraint) {
+        const std::vector<int> &allowed = handle->constraint->allowed();
+        if (allowed.empty()) {
+            return -1;
+        }
+        std::copy(allowed.begin(), allowed.end(), handle->candidates.begin());
+        if (gatherOutput(backend, outputIdx, allowed.data(), handle->logits.data(), allowed.size()) != StatusCode::SUCCESS) {
+            return -1;
         }
+        int token = handle->processor.sample(handle->candidates.data(), handle->logits.data(), allowed.size());
+        if (token < 0 || !handle->constraint->advance(token)) {
+            return -1;
+        }
+        return token;
     }
-    
-    delete[] index;
-    delete[] probs;
-    return ret;
+    int count = handle->processor.numCandidates();
+    if (static_cast<size_t>(count) >= handle->logits.size()) {
+        count = handle->logits.size();
+        if (QnnRwkvGetOutput(backend, outputIdx, handle->logits.data(), count) != StatusCode::SUCCESS) {
+            return -1;
+        }
+        std::iota(handle->candidates.begin(), handle->candidates.end(), 0);
+    } else if (QnnRwkvGetOutputTopK(backend, outputIdx, count, handle->candidates.data(), handle->logits.data(), &count) != StatusCode::SUCCESS) {
+        return -1;
+    }
+    return handle->processor.sample(handle->candidates.data(), handle->logits.data(), count);
 }
 
+StatusCode QnnRwkvSamplerCreate(QnnRwkvBackend_t backend, QnnRwkvSampler_t *sampler, uint64_t seed) {
+    if (!backend || !sampler) {
+        return StatusCode::FAILURE;
+    }
+    std::vector<size_t> shape;
+    if (StatusCode::SUCCESS != QnnRwkvGetOutputShape(backend, QnnRwkvGetOutputNum(backend) - 1, shape)) {
+        return StatusCode::FAILURE;
+    }
+    size_t elemcount = 1;
+    for (auto dim : shape) {
+        elemcount *= dim;
+    }
+    *sampler = new SamplerHandle(elemcount, seed);
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerDestroy(QnnRwkvSampler_t sampler) {
+    if (!sampler) {
+        return StatusCode::FAILURE;
+    }
+    delete static_cast<SamplerHandle *>(sampler);
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerSetParams(QnnRwkvSampler_t sampler, const QnnRwkvSamplingParams *params) {
+    if (!sampler || !params) {
+        return StatusCode::FAILURE;
+    }
+    sampler::SamplingParams samplingParams;
+    samplingParams.temperature = params->temperature;
+    samplingParams.topK = params->topK;
+    samplingParams.topP = params->topP;
+    samplingParams.minP = params->minP;
+    samplingParams.typicalP = params->typicalP;
+    samplingParams.presencePenalty = params->presencePenalty;
+    samplingParams.frequencyPenalty = params->frequencyPenalty;
+    samplingParams.penaltyDecay = params->penaltyDecay;
+    samplingParams.mirostatTau = params->mirostatTau;
+    samplingParams.mirostatEta = params->mirostatEta;
+    static_cast<SamplerHandle *>(sampler)->processor.setParams(samplingParams);
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerSetChain(QnnRwkvSampler_t sampler, const QnnRwkvSamplingStage *stages, size_t count) {
+    if (!sampler || (!stages && count)) {
+        return StatusCode::FAILURE;
+    }
+    std::vector<sampler::Stage> chain;
+    for (size_t i = 0; i < count; i++) {
+        switch (stages[i]) {
+            case QnnRwkvSamplingStage::BIAS: chain.push_back(sampler::Stage::Bias); break;
+            case QnnRwkvSamplingStage::BAN: chain.push_back(sampler::Stage::Ban); break;
+            case QnnRwkvSamplingStage::PENALTIES: chain.push_back(sampler::Stage::Penalties); break;
+            case QnnRwkvSamplingStage::TEMPERATURE: chain.push_back(sampler::Stage::Temperature); break;
+            case QnnRwkvSamplingStage::TOP_K: chain.push_back(sampler::Stage::TopK); break;
+            case QnnRwkvSamplingStage::TOP_P: chain.push_back(sampler::Stage::TopP); break;
+            case QnnRwkvSamplingStage::MIN_P: chain.push_back(sampler::Stage::MinP); break;
+            case QnnRwkvSamplingStage::TYPICAL: chain.push_back(sampler::Stage::Typical); break;
+            case QnnRwkvSamplingStage::MIROSTAT: chain.push_back(sampler::Stage::Mirostat); break;
+            default:
+                LOG_ERROR("Unknown sampling stage");
+                return StatusCode::FAILURE;
+        }
+    }
+    static_cast<SamplerHandle *>(sampler)->processor.setChain(chain.data(), chain.size());
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerSetLogitBias(QnnRwkvSampler_t sampler, const int *tokens, const float *biases, size_t count) {
+    if (!sampler || ((!tokens || !biases) && count)) {
+        return StatusCode::FAILURE;
+    }
+    SamplerHandle *handle = static_cast<SamplerHandle *>(sampler);
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i] < 0 || static_cast<size_t>(tokens[i]) >= handle->logits.size()) {
+            LOG_ERROR("Logit bias token out of range");
+            return StatusCode::FAILURE;
+        }
+    }
+    handle->processor.clearBias();
+    for (size_t i = 0; i < count; i++) {
+        handle->processor.setBias(tokens[i], biases[i]);
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerSetBannedTokens(QnnRwkvSampler_t sampler, const int *tokens, size_t count) {
+    if (!sampler || (!tokens && count)) {
+        return StatusCode::FAILURE;
+    }
+    SamplerHandle *handle = static_cast<SamplerHandle *>(sampler);
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i] < 0 || static_cast<size_t>(tokens[i]) >= handle->logits.size()) {
+            LOG_ERROR("Banned token out of range");
+            return StatusCode::FAILURE;
+        }
+    }
+    handle->processor.clearBanned();
+    for (size_t i = 0; i < count; i++) {
+        handle->processor.setBanned(tokens[i], true);
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerReset(QnnRwkvSampler_t sampler) {
+    if (!sampler) {
+        return StatusCode::FAILURE;
+    }
+    SamplerHandle *handle = static_cast<SamplerHandle *>(sampler);
+    handle->processor.reset();
+    if (handle->constraint) {
+        handle->constraint->reset();
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode QnnRwkvSamplerSample(QnnRwkvBackend_t backend, QnnRwkvSampler_t sampler, int *token) {
+    if (!backend || !sampler || !token) {
+        return StatusCode::FAILURE;
+    }
+    waitForAsync(static_cast<rwkv_app::QnnRwkvApp *>(backend));
+    *token = sampleLastOutput(backend, static_cast<SamplerHandle *>(sampler));
+    return *token < 0 ? StatusCode::FAILURE : StatusCode::SUCCESS;
+}
+
+#if !defined(_WIN32) && ENABLE_CHAT_APIS
+// Completion functions
 trie_tokenizer tokenizer;
-std::map<int, float> occurences;
-std::vector<float> logits;
-std::string rawMsg;
+std::unique_ptr<SamplerHandle> completionSampler;
+std::unique_ptr<textstream::StopMatcher> stopMatcher;
+textstream::Utf8Stream completionUtf8;
+std::string matchedText;
+std::string completionText;
+bool completionStopped = false;
 int QnnRwkvTokenizerInit(std::string tokenizerPath) {
     if (tokenizer.inited() || tokenizer.load(tokenizerPath) == 0) {
         return 0;
@@ -656,55 +1275,128 @@ int QnnRwkvCompletionInit(QnnRwkvBackend_t backend, const char *msgBuffer, const
     if (!backend || !msgBuffer || msgBufferLength <= 0 || tokenizer.inited()) {
         return -1;
     }
-    if (logits.empty()) {
-        std::vector<size_t> shape;
-        QnnRwkvGetOutputShape(backend, QnnRwkvGetOutputNum(backend) - 1, shape);
-        int64_t elemcount = 1;
-        for (auto dim : shape) {
-            elemcount *= dim;
+    if (!completionSampler) {
+        QnnRwkvSampler_t handle;
+        if (QnnRwkvSamplerCreate(backend, &handle, std::random_device()()) != StatusCode::SUCCESS) {
+            return -1;
         }
-        logits.resize(elemcount);
+        completionSampler.reset(static_cast<SamplerHandle *>(handle));
+        const sampler::Stage chain[] = {sampler::Stage::Penalties, sampler::Stage::TopK,
+                                        sampler::Stage::TopP, sampler::Stage::Temperature};
+        completionSampler->processor.setChain(chain, sizeof(chain) / sizeof(chain[0]));
     }
 
-    occurences.clear();
+    completionSampler->processor.reset();
+    if (!stopMatcher) {
+        stopMatcher.reset(new textstream::StopMatcher());
+        stopMatcher->setPatterns({"\n\n"});
+    }
+    stopMatcher->reset();
+    completionUtf8.reset();
+    completionStopped = false;
 
     std::string msg(msgBuffer, msgBufferLength);
     msg = "User: " + msg + "\n\nAssistant:";
-    rawMsg = msg;
     std::vector<int> prompt_ids = tokenizer.Encode(msg);
-    srand((unsigned)time(NULL));
-
-    for (auto token_id : prompt_ids) {
-        if (QnnRwkvExecute(backend, token_id) != StatusCode::SUCCESS) {
-            return -1;
-        }
+    if (QnnRwkvExecuteSequence(backend, prompt_ids.data(), prompt_ids.size()) != StatusCode::SUCCESS) {
+        return -1;
     }
 
     return prompt_ids.size();
 }
 
 const char * QnnRwkvCompletionGetTokenStr(QnnRwkvBackend_t backend, int *currentTokenNum, float temperature, int topK, float topP, float presencePenalty, float frequencyPenalty, float penaltyDecay) {
-    if (!backend || !currentTokenNum || !tokenizer.inited()) {
+    if (!backend || !currentTokenNum || !tokenizer.inited() || !completionSampler || completionStopped) {
         return nullptr;
     }
 
-    QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, logits.data(), logits.size());
-    for (auto &x : occurences) {
-      logits[x.first] -=
-          frequencyPenalty * x.second + presencePenalty;
-      x.second *= penaltyDecay;
+    // top-k, top-p at temperature 1, then the draw at the (clamped) temperature, in
+    // the original order. Only the top-k logits are fetched, so top-p now keeps the
+    // smallest prefix reaching topP of the top-k mass; it used to be of the whole
+    // vocabulary's, which kept more candidates when topK cut off much of it.
+    sampler::SamplingParams params;
+    params.temperature = std::min(std::max(temperature, 0.1f), 5.f);
+    params.topK = topK == 0 ? 1 : topK;
+    params.topP = topP;
+    params.presencePenalty = presencePenalty;
+    params.frequencyPenalty = frequencyPenalty;
+    params.penaltyDecay = penaltyDecay;
+    completionSampler->processor.setParams(params);
+    int token = sampleLastOutput(backend, completionSampler.get());
+    if (token < 0) {
+        return nullptr;
     }
-    int token = sample_logits(logits.data(), logits.size(), temperature, topK, topP);
-    std::string outputStr = tokenizer.Decode(token);
-    rawMsg += outputStr;
+    std::string_view piece = tokenizer.DecodeView(token);
     (*currentTokenNum)++;
-    occurences[token]++;
     QnnRwkvExecute(backend, token);
 
-    if (rawMsg.substr(rawMsg.size() - 2) == "\n\n") {
+    // the text before a stop string still goes out with the token that completes it,
+    // and the next call ends the completion. Characters split across tokens are
+    // returned once complete.
+    matchedText.clear();
+    completionText.clear();
+    completionStopped = stopMatcher->feed(piece.data(), piece.size(), matchedText);
+    completionUtf8.feed(matchedText.data(), matchedText.size(), completionText);
+    if (completionStopped) {
+        completionUtf8.flush(completionText);
+    }
+    if (completionStopped && completionText.empty()) {
         return nullptr;
     }
+    return completionText.c_str();
+}
+
+StatusCode QnnRwkvCompletionSetStopStrings(const char **stopStrings, size_t count) {
+    if (!stopStrings && count) {
+        return StatusCode::FAILURE;
+    }
+    std::vector<std::string> patterns(stopStrings, stopStrings + count);
+    if (!stopMatcher) {
+        stopMatcher.reset(new textstream::StopMatcher());
+    }
+    stopMatcher->setPatterns(patterns);
+    return StatusCode::SUCCESS;
+}
+
+const char * QnnRwkvCompletionFlush() {
+    matchedText.clear();
+    completionText.clear();
+    if (stopMatcher && !completionStopped) {
+        stopMatcher->flush(matchedText);
+        completionUtf8.feed(matchedText.data(), matchedText.size(), completionText);
+        completionUtf8.flush(completionText);
+    }
+    return completionText.c_str();
+}
+
+StatusCode QnnRwkvSamplerSetConstraint(QnnRwkvSampler_t sampler, const char *pattern, bool grammar) {
+    if (!sampler) {
+        return StatusCode::FAILURE;
+    }
+    SamplerHandle *handle = static_cast<SamplerHandle *>(sampler);
+    if (!pattern) {
+        handle->constraint.reset();
+        return StatusCode::SUCCESS;
+    }
+    if (!tokenizer.inited()) {
+        LOG_ERROR("Constrained decoding needs QnnRwkvTokenizerInit first");
+        return StatusCode::FAILURE;
+    }
+    constraint::Dfa dfa;
+    std::string error;
+    if (!(grammar ? dfa.compileGrammar(pattern, &error) : dfa.compileRegex(pattern, &error))) {
+        LOG_ERROR("Constraint compile failure: " + error);
+        return StatusCode::FAILURE;
+    }
+    handle->constraint.reset(new constraint::TokenConstraint(std::move(dfa),
+        [](const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) {
+            tokenizer.CollectTokens(transitions, state, tokens);
+        }, tokenizer.eos_token_id));
+    return StatusCode::SUCCESS;
+}
 
-    return outputStr.c_str();
+bool QnnRwkvSamplerConstraintMatched(QnnRwkvSampler_t sampler) {
+    SamplerHandle *handle = static_cast<SamplerHandle *>(sampler);
+    return handle && handle->constraint && (handle->constraint->accepting() || handle->constraint->finished());
 }
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,8 @@ typedef void* QnnRwkvBackend_t;
 
 typedef void* QnnRwkvModel_t;
 
+typedef void* QnnRwkvSession_t;
+
 StatusCode QnnRwkvBackendCreate(QnnRwkvBackend_t *backend, QnnRwkvModel_t *modelHandle, std::string modelPath, std::string backendPath);
 
 StatusCode QnnRwkvBackendCreateWithContext(QnnRwkvBackend_t *backend, QnnRwkvModel_t *modelHandle, std::string contextPath, std::string backendPath, std::string systemlibPath);
@@ -26,6 +29,26 @@ StatusCode QnnRwkvSetInput(QnnRwkvBackend_t backend, int inputIdx, float* inputB
 
 StatusCode QnnRwkvGetOutput(QnnRwkvBackend_t backend, int outputIdx, float* outputBuffer, size_t outputSize);
 
+enum class QnnRwkvDataType {
+  FLOAT_32,
+  FLOAT_16,
+  UFIXED_POINT_16,
+  UFIXED_POINT_8,
+  INT_32,
+  UNSUPPORTED
+};
+
+// Exposes an output tensor's client buffer without copying. For ufixed types an
+// element q stands for (q + offset) * scale; for float types scale is 1 and offset 0.
+// The view stays valid until the next execute or session switch.
+StatusCode QnnRwkvGetOutputView(QnnRwkvBackend_t backend, int outputIdx, const void **data,
+    QnnRwkvDataType *dtype, float *scale, int32_t *offset, size_t *count);
+
+// The k largest elements of an output, largest first, as indices and float values.
+// Selection runs on the native data and only the winners are dequantized; k == 1
+// is a plain argmax scan. *count is set to min(k, element count).
+StatusCode QnnRwkvGetOutputTopK(QnnRwkvBackend_t backend, int outputIdx, int k, int *indices, float *values, int *count);
+
 int QnnRwkvGetInputNum(QnnRwkvBackend_t backend);
 
 int QnnRwkvGetOutputNum(QnnRwkvBackend_t backend);
@@ -36,6 +59,30 @@ StatusCode QnnRwkvGetOutputShape(QnnRwkvBackend_t backend, int outputIdx, std::v
 
 StatusCode QnnRwkvExecute(QnnRwkvBackend_t backend, int token);
 
+// Feeds a whole prompt. Uses the sequence (prefill) graphs when the "_prefill" binaries
+// were found next to the model, and single-token steps otherwise and for the tail.
+StatusCode QnnRwkvExecuteSequence(QnnRwkvBackend_t backend, const int* tokens, size_t length);
+
+struct QnnRwkvPrefixCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t reusedTokens;
+  uint64_t evictions;
+  size_t entries;
+  size_t bytes;
+};
+
+// Caches native state snapshots taken every `stride` prompt tokens (0: the prefill
+// sequence length) in a token-id trie, evicting LRU entries beyond maxBytes.
+// maxBytes == 0 disables the cache.
+StatusCode QnnRwkvPrefixCacheEnable(QnnRwkvBackend_t backend, size_t stride, size_t maxBytes);
+
+StatusCode QnnRwkvPrefixCacheGetStats(QnnRwkvBackend_t backend, QnnRwkvPrefixCacheStats *stats);
+
+// Starts the active session over with the given prompt, restoring the longest cached
+// prefix instead of executing it.
+StatusCode QnnRwkvExecutePrompt(QnnRwkvBackend_t backend, const int* tokens, size_t length);
+
 double QnnRwkvGetLastInferenceTime(QnnRwkvBackend_t backend);
 
 StatusCode QnnRwkvCopyStatesInPlace(QnnRwkvBackend_t backend);
@@ -44,7 +91,137 @@ StatusCode QnnRwkvResetStates(QnnRwkvBackend_t backend);
 
 StatusCode QnnRwkvSaveContext(QnnRwkvBackend_t backend, std::string contextPath);
 
-StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, std::vector<std::vector<std::vector<float>>> states);
+StatusCode QnnRwkvSetStates(QnnRwkvBackend_t backend, const std::vector<std::vector<std::vector<float>>> &states);
+
+// Raw native-dtype state images (with per-tensor dtype/scale/offset metadata) of the
+// active session. Loading checks the metadata against the model and is a memcpy per
+// tensor; file images are mmap'ed.
+size_t QnnRwkvGetStateSize(QnnRwkvBackend_t backend);
+
+StatusCode QnnRwkvSaveState(QnnRwkvBackend_t backend, void *buffer, size_t size);
+
+StatusCode QnnRwkvLoadState(QnnRwkvBackend_t backend, const void *buffer, size_t size);
+
+StatusCode QnnRwkvSaveStateToFile(QnnRwkvBackend_t backend, std::string path);
+
+StatusCode QnnRwkvLoadStateFromFile(QnnRwkvBackend_t backend, std::string path);
+
+// Sessions let one loaded model serve several conversations. Each session owns its own
+// state and logits buffers; Execute/GetOutput/ResetStates/SetStates act on the active one.
+// Activating a nullptr session switches back to the backend's built-in session.
+StatusCode QnnRwkvSessionCreate(QnnRwkvBackend_t backend, QnnRwkvSession_t *session);
+
+StatusCode QnnRwkvSessionDestroy(QnnRwkvBackend_t backend, QnnRwkvSession_t session);
+
+StatusCode QnnRwkvSessionActivate(QnnRwkvBackend_t backend, QnnRwkvSession_t session);
+
+// Executes tokens[i] on sessions[i] (nullptr: the built-in session), pipelining the
+// chunks of a _chunkXofY model across the sessions. Each session may appear once.
+StatusCode QnnRwkvExecuteSessions(QnnRwkvBackend_t backend, QnnRwkvSession_t *sessions, const int *tokens, size_t count);
+
+// Aggregate tokens/s of the last QnnRwkvExecuteSessions batch, and what the same batch
+// would have reached with its chunk executions run back to back.
+StatusCode QnnRwkvGetPipelineThroughput(QnnRwkvBackend_t backend, double *tokensPerSecond, double *serialTokensPerSecond);
+
+// Called on the executor's thread once the request has run. The next request only
+// starts after it returns, so it can read the outputs (QnnRwkvGetOutput*), but it
+// must not queue or execute tokens itself.
+typedef void (*QnnRwkvExecuteCallback_t)(void *user, uint64_t requestId, StatusCode status);
+
+// Queues one token (as QnnRwkvExecute) and returns immediately. Requests complete
+// in submission order; synchronous calls wait for the queue to drain first.
+StatusCode QnnRwkvExecuteAsync(QnnRwkvBackend_t backend, int token, QnnRwkvExecuteCallback_t callback, void *user, uint64_t *requestId = nullptr);
+
+// Blocks until the request has completed and returns its status.
+StatusCode QnnRwkvWait(QnnRwkvBackend_t backend, uint64_t requestId);
+
+// Returns true once the request has completed, storing its status.
+bool QnnRwkvPoll(QnnRwkvBackend_t backend, uint64_t requestId, StatusCode *status);
+
+struct QnnRwkvSpeculativeStats {
+  uint64_t rounds;
+  uint64_t draftedTokens;
+  uint64_t acceptedTokens;
+  uint64_t generatedTokens;
+  double acceptanceRate;
+  double tokensPerSecond;
+};
+
+// Feeds tokens to both models, then generates up to maxTokens tokens (stopping after
+// stopToken) with draftBackend proposing up to draftTokens tokens per round and the
+// backend verifying them with its prefill graphs, which are required. Sampling is
+// plain softmax at the given temperature; temperature <= 0 is greedy. Afterwards both
+// backends have consumed the output, as with QnnRwkvExecute. Stats accumulate per backend.
+// The random generator is kept per backend and seeded randomly; a non-zero seed
+// reseeds it first, so that a run can be reproduced.
+StatusCode QnnRwkvSpeculativeGenerate(QnnRwkvBackend_t backend, QnnRwkvBackend_t draftBackend,
+    const int *tokens, size_t length, int *output, size_t maxTokens, size_t *generated,
+    int draftTokens = 4, float temperature = 1.f, int stopToken = 0, uint64_t seed = 0);
+
+StatusCode QnnRwkvSpeculativeGetStats(QnnRwkvBackend_t backend, QnnRwkvSpeculativeStats *stats);
+
+// Beam search with `width` beams from the active session's state and last output, for
+// short deterministic outputs. A hypothesis ends after stopToken or maxTokens tokens and
+// is scored by its log-probability / length^lengthPenalty; the best one is written to
+// output. The beams run on sessions the backend keeps for later searches, batched
+// through the chunk pipeline on _chunkXofY models. The active session is left as it
+// was, so execute the output to continue from it.
+StatusCode QnnRwkvBeamSearch(QnnRwkvBackend_t backend, int width, int *output, size_t maxTokens, size_t *generated,
+    float *score = nullptr, int stopToken = 0, float lengthPenalty = 1.f);
+
+typedef void* QnnRwkvSampler_t;
+
+enum class QnnRwkvSamplingStage {
+  BIAS,
+  BAN,
+  PENALTIES,
+  TEMPERATURE,
+  TOP_K,
+  TOP_P,
+  MIN_P,
+  TYPICAL,
+  MIROSTAT
+};
+
+// Neutral values disable a stage: topK <= 0, topP >= 1, minP <= 0, typicalP >= 1,
+// mirostatTau <= 0. temperature <= 0 is greedy.
+struct QnnRwkvSamplingParams {
+  float temperature = 1.f;
+  int topK = 0;
+  float topP = 1.f;
+  float minP = 0.f;
+  float typicalP = 1.f;
+  float presencePenalty = 0.f;
+  float frequencyPenalty = 0.f;
+  float penaltyDecay = 1.f;
+  float mirostatTau = 0.f;
+  float mirostatEta = 0.1f;
+};
+
+// A sampler runs a chain of stages over the largest logits of the backend's last
+// output and draws a token. Only as many logits as the chain can need are fetched
+// (e.g. topK plus the penalized and banned tokens), and every stage filters the
+// same candidate buffer in place. The default chain is bias, ban, penalties, top-k,
+// typical, top-p, min-p, temperature, mirostat. Penalty counts and the mirostat
+// state follow the drawn tokens until QnnRwkvSamplerReset.
+StatusCode QnnRwkvSamplerCreate(QnnRwkvBackend_t backend, QnnRwkvSampler_t *sampler, uint64_t seed);
+
+StatusCode QnnRwkvSamplerDestroy(QnnRwkvSampler_t sampler);
+
+StatusCode QnnRwkvSamplerSetParams(QnnRwkvSampler_t sampler, const QnnRwkvSamplingParams *params);
+
+StatusCode QnnRwkvSamplerSetChain(QnnRwkvSampler_t sampler, const QnnRwkvSamplingStage *stages, size_t count);
+
+// Replaces the logit biases and the banned tokens respectively
+StatusCode QnnRwkvSamplerSetLogitBias(QnnRwkvSampler_t sampler, const int *tokens, const float *biases, size_t count);
+
+StatusCode QnnRwkvSamplerSetBannedTokens(QnnRwkvSampler_t sampler, const int *tokens, size_t count);
+
+StatusCode QnnRwkvSamplerReset(QnnRwkvSampler_t sampler);
+
+// Fails if the output could not be read, every candidate was banned or a constraint
+// has finished
+StatusCode QnnRwkvSamplerSample(QnnRwkvBackend_t backend, QnnRwkvSampler_t sampler, int *token);
 
 #if !defined(_WIN32) && ENABLE_CHAT_APIS
 // Completion functions
@@ -53,4 +230,26 @@ int QnnRwkvTokenizerInit(std::string tokenizerPath);
 int QnnRwkvCompletionInit(QnnRwkvBackend_t backend, const char *msgBuffer, const int msgBufferLength, int maxTokenNum);
 
 const char * QnnRwkvCompletionGetTokenStr(QnnRwkvBackend_t backend, float temperature = 1, int topK = 128, float topP = 0.9, float presencePenalty = 0.4, float frequencyPenalty = 0.4, float penaltyDecay = 0.996);
+
+// Completions end at any of the stop strings ("\n\n" unless set), found by an
+// Aho-Corasick matcher over the decoded bytes. While the text could still be the start
+// of a stop string it is held back, and so are the leading bytes of a UTF-8 character
+// split across tokens, so QnnRwkvCompletionGetTokenStr may return an empty string; the
+// stop string itself is never returned. The returned text is valid until the next call.
+StatusCode QnnRwkvCompletionSetStopStrings(const char **stopStrings, size_t count);
+
+// Text still held back when a completion is cut off without reaching a stop string
+const char * QnnRwkvCompletionFlush();
+
+// Restricts the sampler to tokens of the completion tokenizer that keep the output a
+// prefix of a match of pattern: a regex, or with grammar a list of `name ::= regex`
+// rules referring to each other as <name> and starting at `root` (see RegexDfa.hpp).
+// The allowed tokens of each automaton state are found once by walking the tokenizer
+// trie and cached, and sampling then only reads those logits. End-of-text (token 0)
+// is allowed once the output matches. A nullptr pattern removes the constraint;
+// QnnRwkvSamplerReset starts it over.
+StatusCode QnnRwkvSamplerSetConstraint(QnnRwkvSampler_t sampler, const char *pattern, bool grammar = false);
+
+// Whether the tokens sampled under the constraint so far form a full match
+bool QnnRwkvSamplerConstraintMatched(QnnRwkvSampler_t sampler);
 #endif
\ No newline at end of file
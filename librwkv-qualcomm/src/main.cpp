@@ -5,79 +5,13 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
-#include <map>
 
 #include "librwkv-qualcomm.h"
 #include "tokenizer.h"
+#include "PenaltyTable.hpp"
+#include "Sampler.hpp"
+#include "Utf8Stream.hpp"
 
-static int sample_logits(const float* logits, const size_t size, float temperature, int top_k, float top_p) {
-    temperature = std::max(temperature, 0.1f);
-    temperature = std::min(temperature, 5.f);
-    if (top_k >= size)
-        top_k = size;
-
-    if (top_k == 0 || top_k == 1)
-        return std::max_element(logits, logits + size) - logits;
-
-    // softmax
-    float sum = 0;
-    int *index = new int[size];
-    float *probs = new float[size];
-
-    const float max_logit = *std::max_element(logits, logits + size);
-
-    for (int i = 0; i < size; i++) {
-        probs[i] = std::exp(logits[i] - max_logit);
-        sum += probs[i];
-        index[i] = i;
-    }
-
-    if (top_k != size)
-        std::nth_element(index, index + top_k,
-                index + size,
-                [&](int i, int j) { return probs[i] > probs[j]; });
-    std::sort(index, index + top_k,
-            [&](int i, int j) { return probs[i] > probs[j]; });
-
-    int len = top_k;
-
-    // top-p
-    float cumsum = 0;
-    for (int i = 0; i < len; i++) {
-        probs[index[i]] /= sum;
-        cumsum += probs[index[i]];
-        if (cumsum >= top_p) {
-            len = i + 1;
-            break;
-        }
-    }
-
-    // temperature
-    if (fabs(temperature - 1.f) > 1e-6) {
-        cumsum = 0;
-        for (int i = 0; i < len; i++) {
-            probs[index[i]] = std::pow(probs[index[i]], 1.f / temperature);
-            cumsum += probs[index[i]];
-        }
-    }
-
-    // random choice
-    float random_value = rand() / float(RAND_MAX) * cumsum;
-    
-    int ret = -1;
-    cumsum = 0;
-    for (int i = 0; i < len; i++) {
-        cumsum += probs[index[i]];
-        if (cumsum >= random_value) {
-            ret = index[i];
-            break;
-        }
-    }
-    
-    delete[] index;
-    delete[] probs;
-    return ret;
-}
 
 int main(int argc, char** argv) {
   std::cout.setf(std::ios::unitbuf);
@@ -124,12 +58,14 @@ int main(int argc, char** argv) {
     elemcount *= dim;
   }
 
+  std::vector<int> candidates(elemcount);
   std::vector<float> logits(elemcount);
+  int num_candidates;
 
-  std::map<int, float> occurences;
+  qnn::tools::sampler::PenaltyTable penalties(elemcount);
   std::vector<double> inference_durations;
   std::string prompt = "User: 请为我写一首诗。\n\nAssistant:";
-  srand((unsigned)time(NULL));
+  qnn::tools::sampler::Sampler sampler(elemcount);
 
   const float presence_penalty = 0.4;
   const float freq_penalty = 0.4;
@@ -139,37 +75,42 @@ int main(int argc, char** argv) {
   const float top_p = 0.9;
 
   std::vector<int> prompt_ids = tokenizer.Encode(prompt);
-  for (auto token_id : prompt_ids) {
-    if (QnnRwkvExecute(backend, token_id) != StatusCode::SUCCESS) {
-      std::cerr << "QnnRwkvExecute failed" << std::endl;
-      return EXIT_FAILURE;
-    }
-    inference_durations.push_back(QnnRwkvGetLastInferenceTime(backend));
+  auto prefill_start = std::chrono::high_resolution_clock::now();
+  if (QnnRwkvExecuteSequence(backend, prompt_ids.data(), prompt_ids.size()) != StatusCode::SUCCESS) {
+    std::cerr << "QnnRwkvExecuteSequence failed" << std::endl;
+    return EXIT_FAILURE;
   }
+  std::chrono::duration<double> prefill_duration = std::chrono::high_resolution_clock::now() - prefill_start;
 
-  QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, logits.data(), logits.size());
+  QnnRwkvGetOutputTopK(backend, QnnRwkvGetOutputNum(backend) - 1, top_k, candidates.data(), logits.data(), &num_candidates);
 
-  int token = sample_logits(logits.data(), logits.size(), temperature, top_k, top_p);
+  int token = sampler.sample(candidates.data(), logits.data(), num_candidates, temperature, top_k, top_p);
   std::cout << prompt;
+  // tokens can end inside a character, print whole characters only
+  qnn::tools::textstream::Utf8Stream utf8;
+  std::string text;
   for (int i = 0; i < 300; i++) {
-    std::cout << tokenizer.Decode(token);
+    std::string_view piece = tokenizer.DecodeView(token);
+    text.clear();
+    utf8.feed(piece.data(), piece.size(), text);
+    std::cout << text;
     if (QnnRwkvExecute(backend, token) != StatusCode::SUCCESS) {
       std::cerr << "QnnRwkvExecute failed" << std::endl;
       return EXIT_FAILURE;
     }
-    QnnRwkvGetOutput(backend, QnnRwkvGetOutputNum(backend) - 1, logits.data(), logits.size());
+    // penalties only lower logits, so top_k + penalties.numTokens() candidates are enough
+    num_candidates = std::min<int>(top_k + penalties.numTokens(), elemcount);
+    QnnRwkvGetOutputTopK(backend, QnnRwkvGetOutputNum(backend) - 1, num_candidates, candidates.data(), logits.data(), &num_candidates);
     inference_durations.push_back(QnnRwkvGetLastInferenceTime(backend));
-    for (auto &x : occurences) {
-      logits[x.first] -=
-          freq_penalty * x.second + presence_penalty;
-      x.second *= penalty_decay;
-    }
+    penalties.apply(candidates.data(), logits.data(), num_candidates, presence_penalty, freq_penalty);
 
-    token = sample_logits(logits.data(), logits.size(), temperature, top_k, top_p);
+    token = sampler.sample(candidates.data(), logits.data(), num_candidates, temperature, top_k, top_p);
 
-    occurences[token]++;
+    penalties.update(token, penalty_decay);
   }
-  std::cout << std::endl;
+  text.clear();
+  utf8.flush(text);
+  std::cout << text << std::endl;
 
   double duration_invoke = 0;
   for (auto duration : inference_durations) {
@@ -177,6 +118,7 @@ int main(int argc, char** argv) {
   }
   std::cout << "Average time per token: " << duration_invoke / inference_durations.size() << "s" << std::endl;
   std::cout << "Average tokens per second: " << inference_durations.size() / duration_invoke << std::endl;
+  std::cout << "Prefill tokens per second: " << prompt_ids.size() / prefill_duration.count() << std::endl;
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DataKernels.hpp"
+#include "Sampler.hpp"
+
+using qnn::tools::sampler::Sampler;
+
+// sample_logits as main.cpp had it before the Sampler, as the baseline
+static int legacy_sample_logits(const float* logits, const size_t size, float temperature, int top_k, float top_p) {
+    temperature = std::max(temperature, 0.1f);
+    temperature = std::min(temperature, 5.f);
+    if (top_k < 0 || static_cast<size_t>(top_k) >= size)
+        top_k = size;
+
+    if (top_k == 0 || top_k == 1)
+        return std::max_element(logits, logits + size) - logits;
+
+    // softmax
+    float sum = 0;
+    int *index = new int[size];
+    float *probs = new float[size];
+
+    const float max_logit = *std::max_element(logits, logits + size);
+
+    for (size_t i = 0; i < size; i++) {
+        probs[i] = std::exp(logits[i] - max_logit);
+        sum += probs[i];
+        index[i] = i;
+    }
+
+    if (static_cast<size_t>(top_k) != size)
+        std::nth_element(index, index + top_k,
+                index + size,
+                [&](int i, int j) { return probs[i] > probs[j]; });
+    std::sort(index, index + top_k,
+            [&](int i, int j) { return probs[i] > probs[j]; });
+
+    int len = top_k;
+
+    // top-p
+    float cumsum = 0;
+    for (int i = 0; i < len; i++) {
+        probs[index[i]] /= sum;
+        cumsum += probs[index[i]];
+        if (cumsum >= top_p) {
+            len = i + 1;
+            break;
+        }
+    }
+
+    // temperature
+    if (fabs(temperature - 1.f) > 1e-6) {
+        cumsum = 0;
+        for (int i = 0; i < len; i++) {
+            probs[index[i]] = std::pow(probs[index[i]], 1.f / temperature);
+            cumsum += probs[index[i]];
+        }
+    }
+
+    // random choice
+    float random_value = rand() / float(RAND_MAX) * cumsum;
+
+    int ret = -1;
+    cumsum = 0;
+    for (int i = 0; i < len; i++) {
+        cumsum += probs[index[i]];
+        if (cumsum >= random_value) {
+            ret = index[i];
+            break;
+        }
+    }
+
+    delete[] index;
+    delete[] probs;
+    return ret;
+}
+
+// Average microseconds per call, cycling through the logit sets
+static double bench(const std::function<int(const float *)> &fn, const std::vector<std::vector<float>> &logits, int iterations) {
+    volatile int sink = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        sink = sink + fn(logits[i % logits.size()].data());
+    }
+    std::chrono::duration<double, std::micro> duration = std::chrono::high_resolution_clock::now() - start;
+    return duration.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    const size_t vocab_size = 65536;
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]\n";
+        return EXIT_FAILURE;
+    }
+
+    // logits with a few confident tokens over a broad tail, as from a real model
+    std::mt19937 rng(42);
+    std::normal_distribution<float> tail(-2.f, 3.f);
+    std::vector<std::vector<float>> logits(16, std::vector<float>(vocab_size));
+    for (auto &set : logits) {
+        for (auto &x : set) {
+            x = tail(rng);
+        }
+        for (int i = 0; i < 8; i++) {
+            set[rng() % vocab_size] = 12.f + i;
+        }
+    }
+
+    struct Config {
+        const char *name;
+        float temperature;
+        int top_k;
+        float top_p;
+        bool gumbel;
+    };
+    const Config configs[] = {
+        {"greedy", 1.f, 1, 1.f, false},
+        {"top_k=128 top_p=0.9 T=0.7", 0.7f, 128, 0.9f, false},
+        {"top_k=128 top_p=1 T=1", 1.f, 128, 1.f, false},
+        {"top_k=128 top_p=1 T=1 gumbel", 1.f, 128, 1.f, true},
+        {"top_k=vocab top_p=0.9 T=1", 1.f, (int)vocab_size, 0.9f, false},
+    };
+
+    std::cout << "vocab " << vocab_size << ", " << iterations << " iterations, kernels: "
+              << qnn::tools::datautil::kernels::isaName() << std::endl;
+    Sampler sampler(vocab_size, 0);
+    for (const auto &config : configs) {
+        sampler.setGumbelMax(config.gumbel);
+        double legacy_us = bench([&](const float *x) {
+            return legacy_sample_logits(x, vocab_size, config.temperature, config.top_k, config.top_p);
+        }, logits, iterations);
+        double sampler_us = bench([&](const float *x) {
+            return sampler.sample(x, vocab_size, config.temperature, config.top_k, config.top_p);
+        }, logits, iterations);
+        std::cout << config.name << ": legacy " << legacy_us << " us, sampler " << sampler_us
+                  << " us (" << legacy_us / sampler_us << "x)" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
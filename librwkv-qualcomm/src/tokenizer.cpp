@@ -8,23 +8,50 @@ int trie_tokenizer::load(const std::string vocab_file) {
     return 0;
 }
 
+int trie_tokenizer::SaveImage(const std::string image_file) const {
+    if (!_tokenizer->save(image_file))
+        return 1;
+    return 0;
+}
+
 bool trie_tokenizer::inited() const {
     return _tokenizer->inited();
 }
 
 std::vector<int> trie_tokenizer::Encode(std::string_view str) const {
-    auto ids = _tokenizer->encode(std::string(str));
+    auto ids = _tokenizer->encode(str);
     return ids;
 }
 
+void trie_tokenizer::EncodeBatch(const std::vector<std::string_view> &docs, std::vector<int> &tokens,
+                                 std::vector<size_t> &offsets, unsigned threads) const {
+    _tokenizer->encodeBatch(docs, tokens, offsets, threads);
+}
+
 std::string trie_tokenizer::Decode(int id) const {
-    return _tokenizer->decode(std::vector<int>{id});
+    return std::string(_tokenizer->token(id));
 }
 
 std::string trie_tokenizer::Decode(const std::vector<int> &ids) const {
     return _tokenizer->decode(ids);
 }
 
+std::string_view trie_tokenizer::DecodeView(int id) const {
+    return _tokenizer->token(id);
+}
+
+void trie_tokenizer::Decode(int id, std::string &out) const {
+    out.append(_tokenizer->token(id));
+}
+
+void trie_tokenizer::Decode(const int *ids, size_t count, std::string &out) const {
+    _tokenizer->decodeAppend(ids, count, out);
+}
+
+void trie_tokenizer::CollectTokens(const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) const {
+    _tokenizer->collect(transitions, state, tokens);
+}
+
 std::vector<int> abc_tokenizer::Encode(std::string_view str) const {
   std::vector<int> ids;
   for (int i = 0; i < str.size(); ++i) {
@@ -1,7 +1,10 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 class TRIE_TOKENIZER;
@@ -24,10 +27,24 @@ public:
 class trie_tokenizer : public tokenizer_base {
 public:
     trie_tokenizer() : tokenizer_base(0, 0, 0) {};
+    // vocab_file is a text vocabulary or an image written by SaveImage, which is
+    // mapped read-only instead of being parsed
     int load(const std::string vocab_file);
+    int SaveImage(const std::string image_file) const;
     std::vector<int> Encode(std::string_view str) const;
+    // Encodes every document on a thread pool (threads 0: one per core) into one
+    // array; document i is tokens[offsets[i], offsets[i + 1])
+    void EncodeBatch(const std::vector<std::string_view> &docs, std::vector<int> &tokens, std::vector<size_t> &offsets,
+                     unsigned threads = 0) const;
     std::string Decode(const std::vector<int> &ids) const;
     std::string Decode(int id) const;
+    // Bytes of one token without copying, valid while the tokenizer is loaded
+    std::string_view DecodeView(int id) const;
+    // Append to out instead of returning a new string
+    void Decode(int id, std::string &out) const;
+    void Decode(const int *ids, size_t count, std::string &out) const;
+    // Walks the vocabulary trie in lockstep with an automaton, see TRIE::collect
+    void CollectTokens(const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) const;
     bool inited() const;
 private:
     TRIE_TOKENIZER * _tokenizer;
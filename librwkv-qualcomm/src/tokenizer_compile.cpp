@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "tokenizer.h"
+
+// Compiles a text vocabulary (assets/rwkv_vocab_v20230424.txt) into a tokenizer image
+// that trie_tokenizer::load maps instead of parsing, then checks that the image
+// decodes every token and encodes the vocabulary file the same way as the text.
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <vocab.txt> <tokenizer.bin>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  trie_tokenizer text;
+  if (text.load(argv[1]) != 0) {
+    std::cerr << "Failed to load vocabulary " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (text.SaveImage(argv[2]) != 0) {
+    std::cerr << "Failed to write " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  trie_tokenizer image;
+  if (image.load(argv[2]) != 0) {
+    std::cerr << "Failed to load the image back" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int tokens = 0;
+  for (int id = 0; id < 65536; id++) {
+    if (text.Decode(id) != image.Decode(id)) {
+      std::cerr << "Token " << id << " differs in the image" << std::endl;
+      return EXIT_FAILURE;
+    }
+    tokens += !text.Decode(id).empty();
+  }
+  std::ifstream file(argv[1]);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  if (text.Encode(contents.str()) != image.Encode(contents.str())) {
+    std::cerr << "The image encodes differently" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Wrote " << argv[2] << " with " << tokens << " tokens" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -5,11 +5,20 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <set>
 #include <unordered_map>
 #include <cassert>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <unordered_set>
 #include <string>
@@ -18,6 +27,8 @@
 #include <codecvt>
 #include <locale>
 #include <future>
+#include <thread>
+#include <atomic>
 #include <execution>
 
 struct VectorEqual {
@@ -254,108 +265,289 @@ std::vector<uint8_t> processEscapes(const std::string &input, bool utf8_string =
     return result;
 }
 
-class TRIE : public std::enable_shared_from_this<TRIE> {
+// Byte trie of the vocabulary as a double array. The child of node s on byte c is
+// t = base[s] + c if check[t] == s, and value[t] is the token ending at t or -1. The
+// three fields of a node share a unit, so a step of a walk reads one unit, and the
+// array is padded so that base[s] + c is always in range. The root is unit 0.
+//
+// The units are built in place or point into a tokenizer image (see attach).
+class TRIE {
+    public:
+        struct Unit {
+            int32_t base;
+            int32_t check;  // parent, -1 for a free unit
+            int32_t value;
+        };
+
     private:
-        uint8_t ch;
-        std::vector<std::shared_ptr<TRIE>> to;
-        std::unordered_set<int> values; // Store integer values
-        std::shared_ptr<TRIE> front;
+        static const int32_t kFree = -1;
+        static const int32_t kRoot = -2;
+
+        // Result of the first two bytes of a walk: the longest token among them
+        // (length 0 for none) and the node to go on from, -1 when the walk ends there.
+        // 8 bytes, so the table is 512KB.
+        struct Jump {
+            int32_t node;
+            int32_t token : 30;
+            uint32_t length : 2;
+        };
+
+        std::vector<Unit> storage;
+        const Unit *units = nullptr;
+        size_t numUnits   = 0;
+        std::vector<Jump> jumps;
+
+        int32_t child(int32_t node, uint8_t c) const {
+            const int32_t t = units[node].base + c;
+            return units[node].base != 0 && units[t].check == node ? t : -1;
+        }
 
-    public:
-        // Constructor
-        TRIE(std::shared_ptr<TRIE> front = nullptr, uint8_t ch = 0) : front(front), ch(ch), to(256, nullptr) {}
-
-        // Add a string to the trie
-        std::shared_ptr<TRIE> add(const std::vector<uint8_t>& key, size_t idx = 0, int val = -1) {
-            if (idx == key.size()) {
-                if (val == -1) {
-                    // Convert the key bytes to an integer representation if needed
-                    // Or handle the case where no value is provided differently
-                    // For now, we'll just not add a value if -1 is still the placeholder
-                } else {
-                    values.insert(val); // Insert the integer value
+        // Indexed by the first two bytes, first byte high. Rebuilt from the units, so
+        // images do not store it.
+        void buildJumps() {
+            jumps.assign(256 * 256, Jump{-1, 0, 0});
+            for (int c0 = 0; c0 < 256; c0++) {
+                const int32_t first = child(0, c0);
+                if (first < 0) {
+                    continue;
+                }
+                for (int c1 = 0; c1 < 256; c1++) {
+                    Jump& jump         = jumps[c0 << 8 | c1];
+                    const int32_t next = child(first, c1);
+                    if (next >= 0 && units[next].value >= 0) {
+                        jump.token  = units[next].value;
+                        jump.length = 2;
+                    } else if (units[first].value >= 0) {
+                        jump.token  = units[first].value;
+                        jump.length = 1;
+                    }
+                    if (next >= 0 && units[next].base != 0) {
+                        jump.node = next;
+                    }
                 }
-                return shared_from_this();
             }
-            uint8_t uchar = key[idx];
-            if (!to[uchar]) {
-                to[uchar] = std::make_shared<TRIE>(shared_from_this(), uchar);
+        }
+
+        // Continues a walk at node with key[idx], keeping the longest token in ret
+        void walk(const uint8_t *key, size_t size, size_t idx, int32_t node, std::tuple<size_t, int>& ret) const {
+            const Unit *u = units;
+            for (; idx < size; idx++) {
+                const int32_t t = u[node].base + key[idx];
+                if (u[t].check != node) {
+                    break;
+                }
+                node = t;
+                if (u[node].value >= 0) {
+                    ret = std::make_tuple(idx + 1, u[node].value);
+                }
             }
-            return to[uchar]->add(key, idx + 1, val);
         }
 
-        std::tuple<size_t, int> find_longest_fast(const std::vector<uint8_t>& key, size_t idx = 0) {
-            //std::shared_ptr<TRIE> u = shared_from_this();
-            auto u = this;
-            std::tuple<size_t, int> ret;
+        // Places the children of node for the sorted keys [lo, hi), all of which
+        // share their first depth bytes with it, then their subtrees.
+        void place(const std::vector<std::pair<std::vector<uint8_t>, int>>& entries, size_t lo, size_t hi,
+                   size_t depth, int32_t node, size_t& firstFree) {
+            while (lo < hi && entries[lo].first.size() == depth) {
+                storage[node].value = entries[lo++].second;  // the last of duplicate keys wins
+            }
+            if (lo == hi) {
+                return;
+            }
 
-            if (idx < key.size()) {  // Changed from <= to <
-                uint8_t uchar = key[idx];
-                while (u->to[uchar] != nullptr) {
-                    u = u->to[uchar].get();
-                    ++idx;
-                    if (!u->values.empty()) {
-                        ret = std::make_tuple(idx, *u->values.begin());
-                    }
-                    if (idx >= key.size()) {  // Changed from == to >= for safety, though it's essentially similar in this context
+            std::vector<uint8_t> labels;
+            std::vector<size_t> bounds;
+            for (size_t i = lo; i < hi; i++) {
+                if (labels.empty() || labels.back() != entries[i].first[depth]) {
+                    labels.push_back(entries[i].first[depth]);
+                    bounds.push_back(i);
+                }
+            }
+            bounds.push_back(hi);
+
+            // first base from the lowest free unit on that puts every child on a free unit
+            while (firstFree < storage.size() && storage[firstFree].check != kFree) {
+                firstFree++;
+            }
+            int32_t base;
+            for (size_t pos = firstFree;; pos++) {
+                if (pos < storage.size() && storage[pos].check != kFree) {
+                    continue;
+                }
+                base = static_cast<int32_t>(pos) - labels[0];
+                if (base < 1) {
+                    continue;
+                }
+                bool fits = true;
+                for (uint8_t c : labels) {
+                    size_t t = base + c;
+                    if (t < storage.size() && storage[t].check != kFree) {
+                        fits = false;
                         break;
                     }
-                    uchar = key.size() > idx ? key[idx] : 0; // Safe check for next character
+                }
+                if (fits) {
+                    break;
                 }
             }
-
-            return ret;
+            if (storage.size() < static_cast<size_t>(base) + 256) {
+                storage.resize(static_cast<size_t>(base) + 256, Unit{0, kFree, -1});
+            }
+            storage[node].base = base;
+            for (uint8_t c : labels) {
+                storage[base + c].check = node;
+            }
+            for (size_t i = 0; i < labels.size(); i++) {
+                place(entries, bounds[i], bounds[i + 1], depth + 1, base + labels[i], firstFree);
+            }
         }
 
-        std::tuple<size_t, std::shared_ptr<TRIE>, std::unordered_set<int>> find_longest(const std::vector<uint8_t>& key, size_t idx = 0) {
-            std::shared_ptr<TRIE> u = shared_from_this();
-            std::tuple<size_t, std::shared_ptr<TRIE>, std::unordered_set<int>> ret;
-
-            if (idx < key.size()) {  // Changed from <= to <
-                uint8_t uchar = key[idx];
-                while (u->to[uchar] != nullptr) {
-                    u = u->to[uchar];
-                    ++idx;
-                    if (!u->values.empty()) {
-                        ret = std::make_tuple(idx, u, u->values);
-                    }
-                    if (idx >= key.size()) {  // Changed from == to >= for safety, though it's essentially similar in this context
-                        break;
+        void collect(int32_t node, const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) const {
+            const int32_t base = units[node].base;
+            if (base == 0) {
+                return;
+            }
+            const int32_t *next = transitions + state * 256;
+            for (int c = 0; c < 256; c++) {
+                const Unit &child = units[base + c];
+                if (child.check == node && next[c] >= 0) {
+                    if (child.value >= 0) {
+                        tokens.emplace_back(child.value, next[c]);
                     }
-                    uchar = key.size() > idx ? key[idx] : 0; // Safe check for next character
+                    collect(base + c, transitions, next[c], tokens);
                 }
             }
+        }
 
-            return ret;
+    public:
+        TRIE() : storage(256, Unit{0, kFree, -1}) {
+            storage[0].check = kRoot;
+            units    = storage.data();
+            numUnits = storage.size();
         }
 
+        // entries are (bytes, token) pairs; empty keys are ignored
+        void build(std::vector<std::pair<std::vector<uint8_t>, int>> entries) {
+            std::stable_sort(entries.begin(), entries.end(),
+                [](const std::pair<std::vector<uint8_t>, int>& a, const std::pair<std::vector<uint8_t>, int>& b) {
+                    return a.first < b.first;
+                });
+            storage.assign(256, Unit{0, kFree, -1});
+            storage[0].check = kRoot;
+            size_t lo = 0;
+            while (lo < entries.size() && entries[lo].first.empty()) {
+                lo++;
+            }
+            size_t firstFree = 1;
+            place(entries, lo, entries.size(), 0, 0, firstFree);
+            storage.shrink_to_fit();
+            units    = storage.data();
+            numUnits = storage.size();
+            buildJumps();
+        }
 
-        // Represent the TRIE as a string (for debugging purposes)
-        std::string to_string() const {
-            std::string result;
-            for (auto fr = shared_from_this(); fr != nullptr; fr = fr->front) { // Directly use shared_ptr for parent
-                if (fr->ch != 0) {
-                    result = std::string(1, static_cast<char>(fr->ch)) + result;
-                }
+        // Uses count units from the caller, which must stay valid, instead of building.
+        // They come from a file, so every index a walk can take from them is checked:
+        // children within the array and values below numTokens.
+        bool attach(const Unit *data, size_t count, size_t numTokens) {
+            if (count < 256 || data[0].check != kRoot) {
+                return false;
             }
-            // Convert values set to string
-            std::string values_str = "{";
-            for (const auto& val : values) {
-                if (values_str.length() > 1) {
-                    values_str += ", ";
+            for (size_t i = 0; i < count; i++) {
+                const Unit& u = data[i];
+                if (u.check == kFree) {
+                    continue;
                 }
-                values_str += std::to_string(val);
+                if ((i != 0 && (u.check < 0 || static_cast<size_t>(u.check) >= count)) ||
+                    u.base < 0 || (u.base != 0 && static_cast<size_t>(u.base) + 255 >= count) ||
+                    u.value < -1 || (u.value >= 0 && static_cast<size_t>(u.value) >= numTokens)) {
+                    return false;
+                }
+            }
+            storage.clear();
+            storage.shrink_to_fit();
+            units    = data;
+            numUnits = count;
+            buildJumps();
+            return true;
+        }
+
+        const Unit *data() const {
+            return units;
+        }
+
+        size_t size() const {
+            return numUnits;
+        }
+
+        // End of the longest token starting at key[idx] and that token, or (0, 0) if
+        // none does
+        std::tuple<size_t, int> find_longest_fast(const std::vector<uint8_t>& key, size_t idx = 0) const {
+            return find_longest(key.data(), key.size(), idx);
+        }
+
+        std::tuple<size_t, int> find_longest(const uint8_t *key, size_t size, size_t idx) const {
+            std::tuple<size_t, int> ret(0, 0);
+            if (idx + 1 >= size || jumps.empty()) {
+                walk(key, size, idx, 0, ret);
+                return ret;
+            }
+            // one lookup replaces the first two steps; single-byte tokens that start no
+            // longer one (most punctuation and ASCII before a space) end here
+            const Jump& jump = jumps[key[idx] << 8 | key[idx + 1]];
+            if (jump.length != 0) {
+                ret = std::make_tuple(idx + jump.length, jump.token);
             }
-            values_str += "}";
-            return "<TRIE " + result + " " + values_str + ">";
+            if (jump.node >= 0) {
+                walk(key, size, idx + 2, jump.node, ret);
+            }
+            return ret;
+        }
+
+        // Appends (token, end state) for the tokens whose bytes lead an automaton from
+        // state through non-negative states. transitions holds 256 next states per
+        // state; a subtree is skipped at the first negative one.
+        void collect(const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) const {
+            collect(0, transitions, state, tokens);
+        }
+
+        size_t memoryBytes() const {
+            return storage.capacity() * sizeof(Unit) + jumps.capacity() * sizeof(Jump);
         }
 };
 
+// Layout of a compiled tokenizer image (TRIE_TOKENIZER::save). The sections start at
+// the given file offsets, 8-byte aligned: numTokens + 1 uint32 offsets into the blob
+// (token i is blob[offsets[i], offsets[i + 1]), empty for unused ids), the trie units
+// and the token bytes. Integers are in the writer's byte order, which is recorded so
+// that a mismatching reader rejects the image.
+struct TokenizerImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t numTokens;
+    uint32_t numUnits;
+    uint64_t offsetsOffset;
+    uint64_t unitsOffset;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+};
+
+static const char kTokenizerImageMagic[8]     = {'R', 'W', 'K', 'V', 'T', 'O', 'K', '\0'};
+static const uint32_t kTokenizerImageVersion   = 1;
+static const uint32_t kTokenizerImageByteOrder = 0x01020304;
+
 class TRIE_TOKENIZER {
     private:
-        std::unordered_map<int, std::vector<uint8_t>> idx2token;
-        std::unordered_map<std::vector<uint8_t>, int, VectorHash, VectorEqual> token2idx;
-        std::shared_ptr<TRIE> root;
+        TRIE root;
+        // token i is blob[offsets[i], offsets[i + 1]); both point into the vectors
+        // below or into the mapped image
+        std::vector<uint8_t> blobStorage;
+        std::vector<uint32_t> offsetStorage;
+        const uint8_t *blob     = nullptr;
+        const uint32_t *offsets = nullptr;
+        size_t numTokens        = 0;
+        void *mapping           = nullptr;
+        size_t mappingSize      = 0;
 
         std::vector<uint8_t> stringToBytes(const std::string& str) {
             return std::vector<uint8_t>(str.begin(), str.end());
@@ -367,13 +559,12 @@ class TRIE_TOKENIZER {
 
         bool _inited = false;
 
-    public:
-        TRIE_TOKENIZER(const std::string& file_name) {
-            root = std::make_shared<TRIE>();
+        bool loadText(const std::string& file_name) {
             std::ifstream file(file_name);
             if (!file.is_open()) {
-                return;
+                return false;
             }
+            std::vector<std::pair<std::vector<uint8_t>, int>> entries;
             std::string line;
             while (getline(file, line)) {
                 size_t firstSpace = line.find(' ');
@@ -383,11 +574,122 @@ class TRIE_TOKENIZER {
                 bool utf8_string = line[firstSpace+1] != 'b';
                 std::vector<uint8_t> x;
                 x = processEscapes(processVocabFormat(line.substr(firstSpace + 1, lastSpace - firstSpace)), utf8_string, utf8_byte_length);
-                idx2token[idx] = x;
-                token2idx[x] = idx;
-                root->add(x, 0, idx);
+                if (idx >= 0) {
+                    entries.emplace_back(x, idx);
+                }
+            }
+
+            std::vector<const std::vector<uint8_t> *> byId;
+            for (const auto& entry : entries) {
+                if (static_cast<size_t>(entry.second) >= byId.size()) {
+                    byId.resize(entry.second + 1, nullptr);
+                }
+                byId[entry.second] = &entry.first;
+            }
+            offsetStorage.assign(1, 0);
+            for (const auto *bytes : byId) {
+                if (bytes) {
+                    blobStorage.insert(blobStorage.end(), bytes->begin(), bytes->end());
+                }
+                offsetStorage.push_back(static_cast<uint32_t>(blobStorage.size()));
             }
-            _inited = true;
+            blob      = blobStorage.data();
+            offsets   = offsetStorage.data();
+            numTokens = byId.size();
+
+            root.build(std::move(entries));
+            return true;
+        }
+
+        // 1 once mapped, 0 if the file is not an image, -1 for a broken image
+        int loadImage(const std::string& file_name) {
+            int fd = open(file_name.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return 0;
+            }
+            TokenizerImageHeader header = {};
+            struct stat st;
+            if (fstat(fd, &st) != 0 ||
+                pread(fd, &header, sizeof(header), 0) < static_cast<ssize_t>(sizeof(header.magic)) ||
+                memcmp(header.magic, kTokenizerImageMagic, sizeof(kTokenizerImageMagic)) != 0) {
+                close(fd);
+                return 0;
+            }
+            const uint64_t size = st.st_size;
+            if (size < sizeof(header) ||
+                header.version != kTokenizerImageVersion || header.byteOrder != kTokenizerImageByteOrder ||
+                header.offsetsOffset % 8 || header.unitsOffset % 8 ||
+                header.offsetsOffset > size || (header.numTokens + 1ull) * sizeof(uint32_t) > size - header.offsetsOffset ||
+                header.unitsOffset > size || uint64_t(header.numUnits) * sizeof(TRIE::Unit) > size - header.unitsOffset ||
+                header.blobOffset > size || header.blobSize > size - header.blobOffset) {
+                std::cout << "Unsupported or truncated tokenizer image: " << file_name << std::endl;
+                close(fd);
+                return -1;
+            }
+            mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                return -1;
+            }
+            mappingSize = size;
+
+            const uint8_t *base = static_cast<const uint8_t *>(mapping);
+            offsets   = reinterpret_cast<const uint32_t *>(base + header.offsetsOffset);
+            blob      = base + header.blobOffset;
+            numTokens = header.numTokens;
+            bool valid = offsets[0] == 0 && offsets[numTokens] == header.blobSize;
+            for (size_t i = 0; valid && i < numTokens; i++) {
+                valid = offsets[i] <= offsets[i + 1];
+            }
+            if (!valid || !root.attach(reinterpret_cast<const TRIE::Unit *>(base + header.unitsOffset), header.numUnits, numTokens)) {
+                std::cout << "Corrupt tokenizer image: " << file_name << std::endl;
+                return -1;
+            }
+            return 1;
+        }
+
+    public:
+        // Loads a compiled image (see save) by mapping it, or parses a text vocabulary
+        TRIE_TOKENIZER(const std::string& file_name) {
+            int image = loadImage(file_name);
+            _inited = image > 0 || (image == 0 && loadText(file_name));
+        }
+
+        ~TRIE_TOKENIZER() {
+            if (mapping) {
+                munmap(mapping, mappingSize);
+            }
+        }
+
+        TRIE_TOKENIZER(const TRIE_TOKENIZER&) = delete;
+        TRIE_TOKENIZER& operator=(const TRIE_TOKENIZER&) = delete;
+
+        // Writes the token table and the trie as an image that loads without parsing
+        bool save(const std::string& file_name) const {
+            auto align = [](uint64_t offset) { return (offset + 7) & ~uint64_t(7); };
+            TokenizerImageHeader header = {};
+            memcpy(header.magic, kTokenizerImageMagic, sizeof(kTokenizerImageMagic));
+            header.version       = kTokenizerImageVersion;
+            header.byteOrder     = kTokenizerImageByteOrder;
+            header.numTokens     = static_cast<uint32_t>(numTokens);
+            header.numUnits      = static_cast<uint32_t>(root.size());
+            header.offsetsOffset = align(sizeof(header));
+            header.unitsOffset   = align(header.offsetsOffset + (numTokens + 1) * sizeof(uint32_t));
+            header.blobOffset    = align(header.unitsOffset + root.size() * sizeof(TRIE::Unit));
+            header.blobSize      = offsets[numTokens];
+
+            std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+            auto writeAt = [&file](uint64_t offset, const void *data, size_t size) {
+                static const char zeros[8] = {};
+                file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+                file.write(static_cast<const char *>(data), size);
+            };
+            writeAt(0, &header, sizeof(header));
+            writeAt(header.offsetsOffset, offsets, (numTokens + 1) * sizeof(uint32_t));
+            writeAt(header.unitsOffset, root.data(), root.size() * sizeof(TRIE::Unit));
+            writeAt(header.blobOffset, blob, header.blobSize);
+            return file.good();
         }
 
         void testStringToBytes(const std::string& str) {
@@ -404,68 +706,210 @@ class TRIE_TOKENIZER {
         std::vector<uint8_t> decodeBytes(const std::vector<int>& tokens) {
             std::vector<uint8_t> resultBytes;
             for (int token : tokens) {
-                auto it = idx2token.find(token);
-                if (it != idx2token.end()) {
-                    const auto& bytes = it->second;
-                    resultBytes.insert(resultBytes.end(), bytes.begin(), bytes.end());
+                if (token >= 0 && static_cast<size_t>(token) < numTokens) {
+                    resultBytes.insert(resultBytes.end(), blob + offsets[token], blob + offsets[token + 1]);
                 }
             }
             return resultBytes; // Convert the byte vector back to a string
         }
-        
-        std::vector<int> encodeBytes(const std::vector<uint8_t>& src) {
-            std::vector<int> tokens;
-            tokens.reserve(src.size());
-            size_t idx = 0;
-
-            while (idx < src.size()) {
-                int token;
-                size_t old_idx = idx; // Store the old index to check for progress
 
-                // Perform the longest match search from the current index
-                std::tie(idx, token) = root->find_longest_fast(src, idx);
+        // Bytes of one token, empty for an unknown id; valid while the tokenizer lives
+        std::string_view token(int id) const {
+            if (id < 0 || static_cast<size_t>(id) >= numTokens) {
+                return std::string_view();
+            }
+            return std::string_view(reinterpret_cast<const char *>(blob) + offsets[id], offsets[id + 1] - offsets[id]);
+        }
 
-                // Check if the index has advanced, and if any values were found
-                if (idx > old_idx && token != -1) {
-                    tokens.push_back(token);
-                } else {
-                    // No progress was made or no values were found; either way, stop the loop
+        // Appends the bytes of the tokens to out with one reservation, skipping unknown ids
+        void decodeAppend(const int *tokens, size_t count, std::string& out) const {
+            size_t size = out.size();
+            for (size_t i = 0; i < count; i++) {
+                size += token(tokens[i]).size();
+            }
+            out.reserve(size);
+            for (size_t i = 0; i < count; i++) {
+                std::string_view bytes = token(tokens[i]);
+                out.append(bytes.data(), bytes.size());
+            }
+        }
+        
+        // Greedy encoding from src[idx] until a token ends at or after `until`, or until
+        // no token matches (setting *stalled). Returns where it stopped. The ends of
+        // the first maxEnds tokens go to ends.
+        size_t encodeRange(const uint8_t *src, size_t size, size_t idx, size_t until, std::vector<int>& tokens,
+                           bool *stalled, std::vector<size_t> *ends = nullptr, size_t maxEnds = 0) const {
+            *stalled = false;
+            while (idx < until && idx < size) {
+                size_t next;
+                int token;
+                std::tie(next, token) = root.find_longest(src, size, idx);
+                if (next <= idx || token == -1) {
+                    *stalled = true;
                     break;
                 }
+                tokens.push_back(token);
+                if (ends && ends->size() < maxEnds) {
+                    ends->push_back(next);
+                }
+                idx = next;
             }
+            return idx;
+        }
 
-            return tokens;
+        std::vector<int> encodeBytes(const std::vector<uint8_t>& src) const {
+            return encode(std::string_view(reinterpret_cast<const char *>(src.data()), src.size()));
         }
 
 
-        std::vector<int> encode(const std::string& src) {
-            return encodeBytes(stringToBytes(src));
+        std::vector<int> encode(std::string_view src) const {
+            std::vector<int> tokens;
+            tokens.reserve(src.size() / 2);
+            bool stalled;
+            encodeRange(reinterpret_cast<const uint8_t *>(src.data()), src.size(), 0, src.size(), tokens, &stalled);
+            return tokens;
         }
 
-#if 0
-        std::vector<std::vector<int>> encodeBatch(const std::vector<std::string>& src) {
-            std::vector<std::vector<int>> result(src.size());
-            result.reserve(src.size());
+        // Encodes the documents on up to `threads` threads (0 for one per core) into one
+        // flat array: document i is tokens[offsets[i], offsets[i + 1]). Documents longer
+        // than chunkBytes are cut into chunks, preferably at a space or newline, and
+        // encoded in parallel too. Greedy matching only depends on the position, so a
+        // chunk's tokens are taken from the first position where the tokens coming from
+        // the previous chunk end on one of its token boundaries; the result is the same
+        // as encodeBytes per document.
+        void encodeBatch(const std::vector<std::string_view>& src, std::vector<int>& tokens, std::vector<size_t>& offsets,
+                         unsigned threads = 0, size_t chunkBytes = 1 << 18) const {
+            struct Chunk {
+                size_t doc;
+                size_t begin;
+                size_t end;
+                size_t stop;
+                bool stalled;
+                std::vector<int> tokens;
+                std::vector<size_t> ends;  // of the first kSyncTokens tokens
+            };
+            const size_t kSyncTokens = 256;
+            const size_t kSplitSearch = 256;
+
+            std::vector<Chunk> chunks;
+            std::vector<size_t> firstChunk(src.size() + 1);
+            chunkBytes = std::max<size_t>(chunkBytes, kSplitSearch);
+            for (size_t doc = 0; doc < src.size(); doc++) {
+                firstChunk[doc] = chunks.size();
+                const std::string_view text = src[doc];
+                size_t begin = 0;
+                do {
+                    size_t end = text.size();
+                    if (text.size() - begin > chunkBytes + chunkBytes / 2) {
+                        end = begin + chunkBytes;
+                        const size_t limit = std::min(end + kSplitSearch, text.size());
+                        for (size_t i = end; i < limit; i++) {
+                            if (text[i] == ' ' || text[i] == '\n') {
+                                end = i;
+                                break;
+                            }
+                        }
+                    }
+                    chunks.push_back(Chunk{doc, begin, end, begin, false, {}, {}});
+                    begin = end;
+                } while (begin < src[doc].size());
+            }
+            firstChunk[src.size()] = chunks.size();
 
-            // Parallel execution using std::for_each with par execution policy
-            std::for_each(std::execution::par, src.begin(), src.end(),
-                [&result, this](const std::string& s) {
-                    result.emplace_back(encode(s));
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            auto parallelFor = [threads](size_t count, const std::function<void(size_t)>& fn) {
+                std::atomic<size_t> next(0);
+                auto worker = [&]() {
+                    for (size_t i = next++; i < count; i = next++) {
+                        fn(i);
+                    }
+                };
+                std::vector<std::thread> workers;
+                for (unsigned i = 1; i < std::min<size_t>(threads, count); i++) {
+                    workers.emplace_back(worker);
+                }
+                worker();
+                for (auto& thread : workers) {
+                    thread.join();
                 }
-            );
+            };
+
+            parallelFor(chunks.size(), [&](size_t i) {
+                Chunk& chunk = chunks[i];
+                const std::string_view text = src[chunk.doc];
+                chunk.tokens.reserve((chunk.end - chunk.begin) / 2);
+                chunk.stop = encodeRange(reinterpret_cast<const uint8_t *>(text.data()), text.size(), chunk.begin, chunk.end,
+                                         chunk.tokens, &chunk.stalled, &chunk.ends, kSyncTokens);
+            });
+
+            // stitch the chunks of each document into its first one
+            parallelFor(src.size(), [&](size_t doc) {
+                const uint8_t *text = reinterpret_cast<const uint8_t *>(src[doc].data());
+                const size_t size   = src[doc].size();
+                Chunk& first        = chunks[firstChunk[doc]];
+                size_t pos          = first.stop;
+                bool stalled        = first.stalled;
+                for (size_t c = firstChunk[doc] + 1; c < firstChunk[doc + 1] && !stalled; c++) {
+                    Chunk& chunk = chunks[c];
+                    size_t t = 0;
+                    for (;;) {
+                        if (pos == chunk.begin) {
+                            first.tokens.insert(first.tokens.end(), chunk.tokens.begin(), chunk.tokens.end());
+                            break;
+                        }
+                        while (t < chunk.ends.size() && chunk.ends[t] < pos) {
+                            t++;
+                        }
+                        if (t < chunk.ends.size() && chunk.ends[t] == pos) {
+                            first.tokens.insert(first.tokens.end(), chunk.tokens.begin() + t + 1, chunk.tokens.end());
+                            break;
+                        }
+                        if (t == chunk.ends.size()) {
+                            // no boundary in common so far; encode the chunk again from here
+                            pos = encodeRange(text, size, pos, chunk.end, first.tokens, &stalled);
+                            chunk.stop    = pos;
+                            chunk.stalled = stalled;
+                            break;
+                        }
+                        pos = encodeRange(text, size, pos, pos + 1, first.tokens, &stalled);
+                        if (stalled) {
+                            chunk.stop    = pos;
+                            chunk.stalled = true;
+                            break;
+                        }
+                    }
+                    pos     = chunk.stop;
+                    stalled = chunk.stalled;
+                    std::vector<int>().swap(chunk.tokens);
+                }
+            });
 
+            offsets.assign(src.size() + 1, 0);
+            for (size_t doc = 0; doc < src.size(); doc++) {
+                offsets[doc + 1] = offsets[doc] + chunks[firstChunk[doc]].tokens.size();
+            }
+            tokens.resize(offsets[src.size()]);
+            parallelFor(src.size(), [&](size_t doc) {
+                const std::vector<int>& docTokens = chunks[firstChunk[doc]].tokens;
+                std::copy(docTokens.begin(), docTokens.end(), tokens.begin() + offsets[doc]);
+            });
+        }
+
+        std::string decode(const std::vector<int>& tokens) const {
+            std::string result;
+            decodeAppend(tokens.data(), tokens.size(), result);
             return result;
         }
-#endif
 
-        std::string decode(const std::vector<int>& tokens) {
-            return bytesToString(decodeBytes(tokens));
+        void collect(const int32_t *transitions, int32_t state, std::vector<std::pair<int, int32_t>> &tokens) const {
+            root.collect(transitions, state, tokens);
         }
 
         void printTokens(const std::vector<int>& tokens) {
             for (auto i : tokens) {
-                auto s = idx2token[i];
-                std::cout << bytesToString(s) << " ";
+                std::cout << bytesToString(decodeBytes({i})) << " ";
             }
             std::cout << std::endl;
         }